@@ -23,21 +23,26 @@ main(void) {
                        .font_size = &font_size};
     grid_full_rect(gr, &par);
     par.color = &content1;
-    grid_text(gr, "Some drawing in graphics region 1.",
-              NULL, unit(0.8, "npc"), &par);
+    unit_t top = Unit(0.8, "npc");
+    grid_text(gr, "Some drawing in graphics region 1.", NULL, &top, &par);
 
     grid_up_viewport_1(gr);
     grid_push_viewport(gr, vp2);
     par.color = &content4;
     grid_full_rect(gr, &par);
     par.color = &content1;
-    grid_text(gr, "Some drawing in graphics region 2.",
-              NULL, unit(0.8, "npc"), &par);
+    grid_text(gr, "Some drawing in graphics region 2.", NULL, &top, &par);
 
     grid_up_viewport_1(gr);
     grid_down_viewport(gr, "vp1");
+    unit_t bottom = Unit(0.2, "npc");
     grid_text(gr, "Some more drawing in graphics region 1.",
-              NULL, unit(0.2, "npc"), &par);
+              NULL, &bottom, &par);
 
-    cairo_surface_write_to_png(gr->surface, "basic_viewports.png");
+    grid_write_png(gr, "basic_viewports.png");
+
+    // pushing a viewport doesn't take ownership of it
+    free_grid_viewport(vp1);
+    free_grid_viewport(vp2);
+    free_grid_context(gr);
 }
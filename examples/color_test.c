@@ -78,5 +78,6 @@ main(void) {
     par.fill = &green;
     grid_rect(gr, &x, &y, &width, &height, &par);
 
-    cairo_surface_write_to_png(gr->surface, "color_test.png");
+    grid_write_png(gr, "color_test.png");
+    free_grid_context(gr);
 }
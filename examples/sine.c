@@ -13,12 +13,13 @@ main(void) {
     grid_par_t par = {.color = &transparent, .fill = &lightbg1};
     grid_full_rect(gr, &par);
 
-    grid_push_viewport(gr,
+    grid_push_new_viewport(gr,
       new_grid_viewport(unit(0, "npc"), unit_sub(unit(1, "npc"), unit(4.1, "lines")),
                         unit(1, "npc"), unit(4.1, "lines")));
+    unit_t font_size = Unit(30, "px");
     par = (grid_par_t){.color = &content1, 
                        .vjust = "middle", 
-                       .font_size = unit(30, "px")};
+                       .font_size = &font_size};
     grid_text(gr, "the sine function", NULL, NULL, &par);
     grid_pop_viewport_1(gr);
 
@@ -29,15 +30,16 @@ main(void) {
         y[i] = sin(x[i]);
     }
 
-    grid_push_viewport(gr, new_grid_plot_viewport(gr, 4.1, 1.1, 3.1, 3.1));
-    grid_push_viewport(gr, new_grid_data_viewport(100, x, y));
+    grid_push_new_viewport(gr, new_grid_plot_viewport(gr, 4.1, 1.1, 3.1, 3.1));
+    grid_push_new_viewport(gr, new_grid_data_viewport(100, x, y));
 
     par = (grid_par_t){.color = &transparent, .fill = &bg2};
     grid_full_rect(gr, &par);
 
     unit_array_t x_units = UnitArray(100, x, "native");
     unit_array_t y_units = UnitArray(100, y, "native");
-    grid_set_line_width(gr, unit(5, "px"));
+    unit_t line_width = Unit(5, "px");
+    grid_set_line_width(gr, &line_width);
     par = (grid_par_t){.color = &blue};
     grid_lines(gr, &x_units, &y_units, &par);
 
@@ -62,9 +64,11 @@ main(void) {
     par = (grid_par_t){.color = &violet};
     grid_lines(gr, &x_units, &y_units, &par);
 
-    par = (grid_par_t){.line_width = unit(2, "px")};
+    unit_t axis_width = Unit(2, "px");
+    par = (grid_par_t){.line_width = &axis_width};
     grid_xaxis(gr, &par);
     grid_yaxis(gr, &par);
 
-    cairo_surface_write_to_png(gr->surface, "sine.png");
+    grid_write_png(gr, "sine.png");
+    free_grid_context(gr);
 }
@@ -0,0 +1,238 @@
+#include "grid_alloc.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void*
+grid_std_malloc(size_t size, void *ud) {
+    return malloc(size);
+}
+
+static void*
+grid_std_realloc(void *ptr, size_t old_size, size_t new_size, void *ud) {
+    return realloc(ptr, new_size);
+}
+
+static void
+grid_std_free(void *ptr, size_t size, void *ud) {
+    free(ptr);
+}
+
+static grid_allocator_t grid_default_allocator = {
+    .malloc = grid_std_malloc,
+    .realloc = grid_std_realloc,
+    .free = grid_std_free,
+    .lock = PTHREAD_MUTEX_INITIALIZER
+};
+
+static grid_allocator_t *grid_current_allocator = &grid_default_allocator;
+
+/**
+ * Allocate a new \ref grid_allocator_t with the given hooks. `realloc` may be
+ * `NULL`. The allocator itself is allocated with `malloc`.
+ */
+grid_allocator_t*
+new_grid_allocator(grid_malloc_fn malloc_fn, grid_realloc_fn realloc_fn,
+                   grid_free_fn free_fn, void *ud)
+{
+    grid_allocator_t *allocator = malloc(sizeof(grid_allocator_t));
+    allocator->malloc = malloc_fn;
+    allocator->realloc = realloc_fn;
+    allocator->free = free_fn;
+    allocator->ud = ud;
+    pthread_mutex_init(&allocator->lock, NULL);
+    allocator->stats = (grid_memory_stats_t){ 0 };
+    return allocator;
+}
+
+/**
+ * Deallocate a \ref grid_allocator_t. Memory still allocated through it must
+ * not be freed afterwards.
+ */
+void
+free_grid_allocator(grid_allocator_t *allocator) {
+    pthread_mutex_destroy(&allocator->lock);
+    free(allocator);
+}
+
+/**
+ * Route griddle's allocations through `allocator`, or through the C library
+ * if `allocator` is `NULL`. Objects are freed through the allocator that was
+ * in effect when they were allocated, so set the allocator only while no
+ * objects allocated through the old one remain, except for contexts: a
+ * context allocates and frees everything it owns through its own allocator,
+ * which is the one in effect when it was created unless it's given one with
+ * `new_grid_context_with_allocator`. griddle never sets the allocator
+ * itself. The allocator in effect isn't guarded by a lock, so set it while no
+ * other thread is using griddle.
+ *
+ * \return The allocator in effect before the call.
+ */
+grid_allocator_t*
+grid_set_allocator(grid_allocator_t *allocator) {
+    grid_allocator_t *old = grid_current_allocator;
+    grid_current_allocator = allocator ? allocator : &grid_default_allocator;
+    return old;
+}
+
+/**
+ * \return The allocator in effect. Its counters cover all of griddle's
+ * allocations through it, including those of contexts.
+ */
+grid_allocator_t*
+grid_get_allocator(void) {
+    return grid_current_allocator;
+}
+
+/**
+ * Copy the counters of an allocator.
+ */
+void
+grid_allocator_stats(grid_allocator_t *allocator, grid_memory_stats_t *stats) {
+    pthread_mutex_lock(&allocator->lock);
+    *stats = allocator->stats;
+    pthread_mutex_unlock(&allocator->lock);
+}
+
+static void
+grid_allocator_count(grid_allocator_t *allocator, size_t freed,
+                     size_t allocated)
+{
+    pthread_mutex_lock(&allocator->lock);
+    grid_memory_stats_t *stats = &allocator->stats;
+    stats->live_bytes += allocated - freed;
+    if (stats->live_bytes > stats->high_water)
+        stats->high_water = stats->live_bytes;
+    stats->allocations += allocated > 0;
+    stats->frees += freed > 0;
+    pthread_mutex_unlock(&allocator->lock);
+}
+
+/**
+ * Allocate `size` bytes through `allocator`. Allocation failures are fatal,
+ * as they are throughout griddle.
+ */
+void*
+grid_allocator_malloc(grid_allocator_t *allocator, size_t size) {
+    if (size == 0)
+        size = 1;
+
+    void *ptr = allocator->malloc(size, allocator->ud);
+    if (!ptr) {
+        fprintf(stderr, "Error: can't allocate %zu bytes\n", size);
+        abort();
+    }
+
+    grid_allocator_count(allocator, 0, size);
+    return ptr;
+}
+
+/**
+ * Allocate `n` zeroed elements of `size` bytes through `allocator`.
+ */
+void*
+grid_allocator_calloc(grid_allocator_t *allocator, size_t n, size_t size) {
+    if (size > 0 && n > SIZE_MAX / size) {
+        fprintf(stderr, "Error: can't allocate %zu elements of %zu bytes\n",
+                n, size);
+        abort();
+    }
+
+    void *ptr = grid_allocator_malloc(allocator, n * size);
+    memset(ptr, 0, n * size);
+    return ptr;
+}
+
+/**
+ * Resize an allocation of `old_size` bytes made through `allocator`. `ptr`
+ * may be `NULL` if `old_size` is 0.
+ */
+void*
+grid_allocator_realloc(grid_allocator_t *allocator, void *ptr,
+                       size_t old_size, size_t new_size)
+{
+    if (!ptr)
+        return grid_allocator_malloc(allocator, new_size);
+    if (old_size == 0)
+        old_size = 1;
+    if (new_size == 0)
+        new_size = 1;
+
+    void *resized;
+    if (allocator->realloc) {
+        resized = allocator->realloc(ptr, old_size, new_size, allocator->ud);
+    } else {
+        resized = allocator->malloc(new_size, allocator->ud);
+        if (resized) {
+            memcpy(resized, ptr, old_size < new_size ? old_size : new_size);
+            allocator->free(ptr, old_size, allocator->ud);
+        }
+    }
+
+    if (!resized) {
+        fprintf(stderr, "Error: can't allocate %zu bytes\n", new_size);
+        abort();
+    }
+
+    grid_allocator_count(allocator, old_size, new_size);
+    return resized;
+}
+
+/**
+ * Release an allocation of `size` bytes made through `allocator`. `ptr` may
+ * be `NULL`.
+ */
+void
+grid_allocator_free(grid_allocator_t *allocator, void *ptr, size_t size) {
+    if (!ptr)
+        return;
+    if (size == 0)
+        size = 1;
+
+    allocator->free(ptr, size, allocator->ud);
+    grid_allocator_count(allocator, size, 0);
+}
+
+/**
+ * Allocate `size` bytes through the allocator in effect.
+ */
+void*
+grid_malloc(size_t size) {
+    return grid_allocator_malloc(grid_current_allocator, size);
+}
+
+void*
+grid_calloc(size_t n, size_t size) {
+    return grid_allocator_calloc(grid_current_allocator, n, size);
+}
+
+void*
+grid_realloc(void *ptr, size_t old_size, size_t new_size) {
+    return grid_allocator_realloc(grid_current_allocator, ptr, old_size,
+                                  new_size);
+}
+
+void
+grid_free(void *ptr, size_t size) {
+    grid_allocator_free(grid_current_allocator, ptr, size);
+}
+
+/**
+ * Copy a string through the allocator in effect. Free the copy with
+ * \ref grid_free_string.
+ */
+char*
+grid_strdup(const char *s) {
+    size_t len = strlen(s) + 1;
+    char *copy = grid_malloc(len);
+    memcpy(copy, s, len);
+    return copy;
+}
+
+void
+grid_free_string(char *s) {
+    if (s)
+        grid_free(s, strlen(s) + 1);
+}
@@ -0,0 +1,97 @@
+#ifndef GridAlloc_h
+#define GridAlloc_h
+
+#include <pthread.h>
+#include <stddef.h>
+
+/**
+ * Allocate `size` bytes, or return `NULL`.
+ */
+typedef void *(*grid_malloc_fn)(size_t size, void *ud);
+
+/**
+ * Resize an allocation of `old_size` bytes to `new_size` bytes, or return
+ * `NULL` and leave it unchanged.
+ */
+typedef void *(*grid_realloc_fn)(void *ptr, size_t old_size, size_t new_size,
+                                 void *ud);
+
+/**
+ * Release an allocation of `size` bytes.
+ */
+typedef void (*grid_free_fn)(void *ptr, size_t size, void *ud);
+
+/**
+ * Counters describing the memory allocated through an allocator or by a
+ * context.
+ */
+typedef struct {
+    size_t live_bytes,  /**< Bytes allocated and not yet freed. */
+           high_water;  /**< Largest value `live_bytes` has had. */
+    long allocations,   /**< Successful allocations. */
+         frees;         /**< Allocations released. */
+} grid_memory_stats_t;
+
+/**
+ * Hooks through which griddle allocates memory, and counters of the memory
+ * allocated through them. Frees are given the size of the allocation, so the
+ * hooks can be backed by arenas that don't record sizes. The hooks may be
+ * called from several threads at once; the counters are kept under a lock.
+ * See \ref grid_set_allocator.
+ */
+typedef struct {
+    grid_malloc_fn malloc;
+    grid_realloc_fn realloc; /**< Optional; resizing falls back on `malloc`
+                                  and `free` if it's `NULL`. */
+    grid_free_fn free;
+    void *ud;                /**< Passed to the hooks. */
+    pthread_mutex_t lock;
+    grid_memory_stats_t stats;
+} grid_allocator_t;
+
+grid_allocator_t*
+new_grid_allocator(grid_malloc_fn, grid_realloc_fn, grid_free_fn, void*);
+
+void
+free_grid_allocator(grid_allocator_t*);
+
+grid_allocator_t*
+grid_set_allocator(grid_allocator_t*);
+
+grid_allocator_t*
+grid_get_allocator(void);
+
+void
+grid_allocator_stats(grid_allocator_t*, grid_memory_stats_t*);
+
+void*
+grid_allocator_malloc(grid_allocator_t*, size_t);
+
+void*
+grid_allocator_calloc(grid_allocator_t*, size_t, size_t);
+
+void*
+grid_allocator_realloc(grid_allocator_t*, void*, size_t, size_t);
+
+void
+grid_allocator_free(grid_allocator_t*, void*, size_t);
+
+void*
+grid_malloc(size_t);
+
+void*
+grid_calloc(size_t, size_t);
+
+void*
+grid_realloc(void*, size_t, size_t);
+
+void
+grid_free(void*, size_t);
+
+char*
+grid_strdup(const char*);
+
+void
+grid_free_string(char*);
+
+#endif
@@ -0,0 +1,573 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include "grid_colfile.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define GridColfileAlign(N) (((N) + 7) & ~(int64_t)7)
+
+/**
+ * Size in bytes of one value of a column type, or 0 for unknown types.
+ */
+static size_t
+grid_colfile_type_size(uint32_t type) {
+    switch (type) {
+    case GRID_COLFILE_F64: return sizeof(double);
+    case GRID_COLFILE_F32: return sizeof(float);
+    case GRID_COLFILE_I32: return sizeof(int32_t);
+    case GRID_COLFILE_I64: return sizeof(int64_t);
+    default: return 0;
+    }
+}
+
+/**
+ * Value `i` of a typed array, as a double.
+ */
+static double
+grid_colfile_value(uint32_t type, const void *data, long i) {
+    switch (type) {
+    case GRID_COLFILE_F64: return ((const double*)data)[i];
+    case GRID_COLFILE_F32: return ((const float*)data)[i];
+    case GRID_COLFILE_I32: return ((const int32_t*)data)[i];
+    case GRID_COLFILE_I64: return (double)((const int64_t*)data)[i];
+    default: return 0;
+    }
+}
+
+/**
+ * Add values `[first, first + n)` of a typed array to a range.
+ */
+static void
+grid_colfile_scan(uint32_t type, const void *data, long first, long n,
+                  grid_range_t *r)
+{
+    if (type == GRID_COLFILE_F64) {
+        grid_range_add_array_parallel(r, n, (const double*)data + first, 0);
+        return;
+    }
+
+    long i;
+    for (i = first; i < first + n; i++)
+        grid_range_add(r, grid_colfile_value(type, data, i));
+}
+
+/**
+ * Write `n_columns` columns of `n_rows` values each to a new column file at
+ * `path`. Column `j` is named `names[j]` and holds values of type `types[j]`
+ * at `columns[j]`. If `chunk_rows` is positive, the minimum, maximum, and
+ * count of finite values of every `chunk_rows` rows of each column are stored
+ * with it.
+ *
+ * \return `false` if the file can't be written.
+ */
+bool
+grid_write_colfile(const char *path, long n_rows, int n_columns,
+                   const char **names, const grid_colfile_type_t *types,
+                   const void **columns, long chunk_rows)
+{
+    if (chunk_rows < 0)
+        chunk_rows = 0;
+
+    long n_chunks = chunk_rows ? (n_rows + chunk_rows - 1) / chunk_rows : 0;
+
+    grid_colfile_header_t header = {
+        .version = GRID_COLFILE_VERSION,
+        .byte_order = GRID_COLFILE_BYTE_ORDER,
+        .n_columns = n_columns,
+        .n_rows = n_rows,
+        .chunk_rows = chunk_rows
+    };
+    memcpy(header.magic, GRID_COLFILE_MAGIC, sizeof(header.magic));
+
+    grid_colfile_column_t *descs = grid_calloc(n_columns,
+                                               sizeof(grid_colfile_column_t));
+    int64_t offset = sizeof(header) + n_columns * sizeof(grid_colfile_column_t);
+
+    int j;
+    for (j = 0; j < n_columns; j++) {
+        size_t size = grid_colfile_type_size(types[j]);
+        if (!size) {
+            fprintf(stderr, "Warning: unknown column type %d\n", types[j]);
+            grid_free(descs, n_columns * sizeof(grid_colfile_column_t));
+            return false;
+        }
+
+        strncpy(descs[j].name, names[j], GRID_COLFILE_NAME_SIZE - 1);
+        descs[j].type = types[j];
+
+        offset = GridColfileAlign(offset);
+        descs[j].data_offset = offset;
+        offset += n_rows * size;
+
+        if (n_chunks) {
+            offset = GridColfileAlign(offset);
+            descs[j].stats_offset = offset;
+            offset += n_chunks * sizeof(grid_colfile_chunk_t);
+        }
+    }
+
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        fprintf(stderr, "Warning: can't open '%s' for writing\n", path);
+        grid_free(descs, n_columns * sizeof(grid_colfile_column_t));
+        return false;
+    }
+
+    static const char zeros[8];
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+              fwrite(descs, sizeof(grid_colfile_column_t), n_columns, f) ==
+                  (size_t)n_columns;
+    offset = sizeof(header) + n_columns * sizeof(grid_colfile_column_t);
+
+    for (j = 0; ok && j < n_columns; j++) {
+        size_t size = grid_colfile_type_size(types[j]);
+
+        ok = fwrite(zeros, 1, descs[j].data_offset - offset, f) ==
+                 (size_t)(descs[j].data_offset - offset) &&
+             fwrite(columns[j], size, n_rows, f) == (size_t)n_rows;
+        offset = descs[j].data_offset + n_rows * size;
+
+        long c;
+        for (c = 0; ok && c < n_chunks; c++) {
+            if (c == 0) {
+                ok = fwrite(zeros, 1, descs[j].stats_offset - offset, f) ==
+                     (size_t)(descs[j].stats_offset - offset);
+                offset = descs[j].stats_offset;
+            }
+
+            long first = c * chunk_rows;
+            long n = first + chunk_rows > n_rows ? n_rows - first : chunk_rows;
+            grid_range_t r;
+            grid_range_init(&r);
+            grid_colfile_scan(types[j], columns[j], first, n, &r);
+
+            grid_colfile_chunk_t chunk = { r.min, r.max, r.count };
+            ok = ok && fwrite(&chunk, sizeof(chunk), 1, f) == 1;
+            offset += sizeof(chunk);
+        }
+    }
+
+    ok = fclose(f) == 0 && ok;
+    grid_free(descs, n_columns * sizeof(grid_colfile_column_t));
+
+    if (!ok)
+        fprintf(stderr, "Warning: failed to write '%s'\n", path);
+
+    return ok;
+}
+
+/**
+ * Test whether `count` items of `size` bytes starting at `offset` lie within
+ * a mapping of `map_size` bytes and past its first `table_end` bytes, which
+ * hold the header and the column table. The test can't overflow, whatever
+ * the file claims.
+ */
+static bool
+grid_colfile_in_bounds(int64_t offset, int64_t count, size_t size,
+                       size_t table_end, size_t map_size)
+{
+    return offset >= 0 && (uint64_t)offset >= table_end &&
+           (uint64_t)offset <= map_size && count >= 0 &&
+           (uint64_t)count <= (map_size - (size_t)offset) / size;
+}
+
+/**
+ * Map the column file at `path` into memory. The file's data is not read
+ * until it is used, and stays mapped until \ref free_grid_colfile.
+ *
+ * \return `NULL` if the file can't be mapped or isn't a valid column file.
+ */
+grid_colfile_t*
+new_grid_colfile(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Warning: can't open '%s'\n", path);
+        return NULL;
+    }
+
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(grid_colfile_header_t))
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Warning: can't map '%s'\n", path);
+        return NULL;
+    }
+
+    size_t map_size = st.st_size;
+    const grid_colfile_header_t *header = map;
+    const grid_colfile_column_t *columns = (const void*)(header + 1);
+
+    // check that everything the header describes lies within the file
+    bool ok = memcmp(header->magic, GRID_COLFILE_MAGIC, 8) == 0 &&
+              header->version == GRID_COLFILE_VERSION &&
+              header->byte_order == GRID_COLFILE_BYTE_ORDER &&
+              header->n_rows >= 0 && header->chunk_rows >= 0 &&
+              grid_colfile_in_bounds(sizeof(*header), header->n_columns,
+                                     sizeof(*columns), 0, map_size);
+
+    size_t table_end = sizeof(*header) +
+                       (size_t)header->n_columns * sizeof(*columns);
+    int64_t n_chunks = ok && header->chunk_rows ?
+        header->n_rows / header->chunk_rows +
+        (header->n_rows % header->chunk_rows != 0) : 0;
+
+    uint32_t j;
+    for (j = 0; ok && j < header->n_columns; j++) {
+        const grid_colfile_column_t *c = columns + j;
+        size_t size = grid_colfile_type_size(c->type);
+
+        ok = size && c->data_offset % 8 == 0 &&
+             grid_colfile_in_bounds(c->data_offset, header->n_rows, size,
+                                    table_end, map_size) &&
+             memchr(c->name, 0, GRID_COLFILE_NAME_SIZE) != NULL;
+
+        if (ok && c->stats_offset)
+            ok = c->stats_offset % 8 == 0 &&
+                 grid_colfile_in_bounds(c->stats_offset, n_chunks,
+                                        sizeof(grid_colfile_chunk_t),
+                                        table_end, map_size);
+    }
+
+    if (!ok) {
+        fprintf(stderr, "Warning: '%s' isn't a valid column file\n", path);
+        munmap(map, map_size);
+        return NULL;
+    }
+
+    grid_colfile_t *cf = grid_malloc(sizeof(grid_colfile_t));
+    cf->map = map;
+    cf->map_size = map_size;
+    cf->header = header;
+    cf->columns = columns;
+    cf->converted = grid_calloc(header->n_columns, sizeof(double*));
+
+    return cf;
+}
+
+/**
+ * Unmap a column file. Unit arrays viewing its columns must not be used
+ * afterwards.
+ */
+void
+free_grid_colfile(grid_colfile_t *cf) {
+    uint32_t j, n_columns = cf->header->n_columns;
+    for (j = 0; j < n_columns; j++)
+        grid_free(cf->converted[j], cf->header->n_rows * sizeof(double));
+    grid_free(cf->converted, n_columns * sizeof(double*));
+
+    munmap(cf->map, cf->map_size);
+    grid_free(cf, sizeof(grid_colfile_t));
+}
+
+/**
+ * Number of rows in each column of a column file.
+ */
+long
+grid_colfile_rows(const grid_colfile_t *cf) {
+    return cf->header->n_rows;
+}
+
+/**
+ * Find a column by name.
+ *
+ * \return The column's index, or -1 if there is no such column.
+ */
+int
+grid_colfile_column(const grid_colfile_t *cf, const char *name) {
+    uint32_t j;
+    for (j = 0; j < cf->header->n_columns; j++)
+        if (strcmp(cf->columns[j].name, name) == 0)
+            return j;
+
+    return -1;
+}
+
+/**
+ * View rows `[first, first + n)` of a column as a \ref unit_array_t of the
+ * given unit type, without copying. Columns of doubles are viewed in place in
+ * the mapping; other columns are converted to doubles the first time they
+ * are viewed, and the conversion is kept with the file. The view is valid
+ * until the file is freed and must not be passed to `free_unit_array`.
+ */
+unit_array_t
+grid_colfile_array(grid_colfile_t *cf, int column, long first, long n,
+                   char *type)
+{
+    long n_rows = cf->header->n_rows;
+    if (column < 0 || column >= (int)cf->header->n_columns ||
+        first < 0 || n < 0 || first > n_rows || n > n_rows - first)
+    {
+        fprintf(stderr, "Warning: %ld rows from row %ld of column %d are "
+                        "outside the file\n", n, first, column);
+        return UnitArray(0, NULL, type);
+    }
+
+    const grid_colfile_column_t *c = cf->columns + column;
+    const void *data = (const char*)cf->map + c->data_offset;
+
+    if (c->type == GRID_COLFILE_F64)
+        return UnitArray(n, (double*)data + first, type);
+
+    if (!cf->converted[column]) {
+        double *values = grid_malloc(n_rows * sizeof(double));
+        long i;
+        for (i = 0; i < n_rows; i++)
+            values[i] = grid_colfile_value(c->type, data, i);
+        cf->converted[column] = values;
+    }
+
+    return UnitArray(n, cf->converted[column] + first, type);
+}
+
+/**
+ * Add the finite values of rows `[first, first + n)` of a column to a range.
+ * Chunks that lie entirely within the rows contribute their stored statistics
+ * without being read; only the partial chunks at either end, or every row
+ * if the file has no statistics, are scanned.
+ */
+void
+grid_colfile_range(const grid_colfile_t *cf, int column, long first, long n,
+                   grid_range_t *r)
+{
+    if (column < 0 || column >= (int)cf->header->n_columns)
+        return;
+
+    if (first < 0) {
+        n += first;
+        first = 0;
+    }
+    if (first + n > cf->header->n_rows)
+        n = cf->header->n_rows - first;
+    if (n <= 0)
+        return;
+
+    const grid_colfile_column_t *c = cf->columns + column;
+    const void *data = (const char*)cf->map + c->data_offset;
+    long chunk_rows = cf->header->chunk_rows;
+
+    if (!c->stats_offset || !chunk_rows) {
+        grid_colfile_scan(c->type, data, first, n, r);
+        return;
+    }
+
+    const grid_colfile_chunk_t *chunks =
+        (const void*)((const char*)cf->map + c->stats_offset);
+    long end = first + n;
+
+    // first and last rows of the whole chunks in the range
+    long whole_first = (first + chunk_rows - 1) / chunk_rows * chunk_rows;
+    long whole_end = end == cf->header->n_rows ? end
+                                               : end / chunk_rows * chunk_rows;
+
+    if (whole_first >= whole_end) {
+        grid_colfile_scan(c->type, data, first, n, r);
+        return;
+    }
+
+    grid_colfile_scan(c->type, data, first, whole_first - first, r);
+
+    long k;
+    for (k = whole_first / chunk_rows; k * chunk_rows < whole_end; k++) {
+        grid_range_t chunk = { chunks[k].min, chunks[k].max, chunks[k].count };
+        grid_range_merge(r, &chunk);
+    }
+
+    grid_colfile_scan(c->type, data, whole_end, end - whole_end, r);
+}
+
+/**
+ * Allocate a \ref grid_viewport_t whose native coordinate system covers the
+ * given columns, as \ref new_grid_data_viewport would. Files with statistics
+ * aren't scanned.
+ */
+grid_viewport_t*
+new_grid_colfile_viewport(const grid_colfile_t *cf, int x_column,
+                          int y_column)
+{
+    grid_range_t x, y;
+    grid_range_init(&x);
+    grid_range_init(&y);
+    grid_colfile_range(cf, x_column, 0, cf->header->n_rows, &x);
+    grid_colfile_range(cf, y_column, 0, cf->header->n_rows, &y);
+
+    return new_grid_range_viewport(&x, &y);
+}
+
+/**
+ * Find the rows of a column that may hold values in `[lo, hi]`, using the
+ * chunk statistics: the rows run from the first to the last chunk whose range
+ * meets `[lo, hi]`, widened by one row on either side so that lines drawn
+ * through them reach the edges. Two neighboring chunks whose ranges both miss
+ * `[lo, hi]` are included too when the line from one to the other crosses it.
+ * Without statistics every row is returned.
+ */
+void
+grid_colfile_visible_rows(const grid_colfile_t *cf, int column,
+                          double lo, double hi, long *first, long *n)
+{
+    long n_rows = cf->header->n_rows;
+    long chunk_rows = cf->header->chunk_rows;
+    *first = 0;
+    *n = n_rows;
+
+    if (column < 0 || column >= (int)cf->header->n_columns) {
+        *n = 0;
+        return;
+    }
+
+    const grid_colfile_column_t *c = cf->columns + column;
+    if (!c->stats_offset || !chunk_rows)
+        return;
+
+    const grid_colfile_chunk_t *chunks =
+        (const void*)((const char*)cf->map + c->stats_offset);
+    long n_chunks = (n_rows + chunk_rows - 1) / chunk_rows;
+
+    const void *data = (const char*)cf->map + c->data_offset;
+
+    long k, k_first = -1, k_last = -1;
+    for (k = 0; k < n_chunks; k++) {
+        // the segment from the previous chunk's last row to this chunk's
+        // first may pass over [lo, hi] without either end inside it
+        if (k > 0) {
+            double a = grid_colfile_value(c->type, data, k * chunk_rows - 1);
+            double b = grid_colfile_value(c->type, data, k * chunk_rows);
+            if ((a < lo && b > hi) || (a > hi && b < lo)) {
+                if (k_first < 0)
+                    k_first = k - 1;
+                k_last = k;
+            }
+        }
+
+        if (chunks[k].count > 0 && chunks[k].max >= lo && chunks[k].min <= hi) {
+            if (k_first < 0)
+                k_first = k;
+            k_last = k;
+        }
+    }
+
+    if (k_first < 0) {
+        *n = 0;
+        return;
+    }
+
+    long start = k_first * chunk_rows, end = (k_last + 1) * chunk_rows;
+    if (start > 0)
+        start--;
+    if (end < n_rows)
+        end++;
+    else
+        end = n_rows;
+
+    *first = start;
+    *n = end - start;
+}
+
+/**
+ * Reads rows of two columns of a column file in chunks, for streaming them to
+ * \ref grid_stream_lines and \ref grid_stream_points.
+ */
+typedef struct {
+    const grid_colfile_t *cf;
+    int x_column, y_column;
+    long row, end;
+} grid_colfile_cursor_t;
+
+static int
+grid_colfile_next(void *data, double *xs, double *ys, int capacity) {
+    grid_colfile_cursor_t *cursor = data;
+    const grid_colfile_t *cf = cursor->cf;
+    const grid_colfile_column_t *x = cf->columns + cursor->x_column,
+                                *y = cf->columns + cursor->y_column;
+    const void *x_data = (const char*)cf->map + x->data_offset,
+               *y_data = (const char*)cf->map + y->data_offset;
+
+    long n = cursor->end - cursor->row;
+    if (n > capacity)
+        n = capacity;
+
+    long i;
+    for (i = 0; i < n; i++) {
+        xs[i] = grid_colfile_value(x->type, x_data, cursor->row + i);
+        ys[i] = grid_colfile_value(y->type, y_data, cursor->row + i);
+    }
+
+    cursor->row += n;
+    return (int)n;
+}
+
+/**
+ * Set up a cursor over the rows of two columns that can fall within the
+ * current viewport's native x-range.
+ *
+ * \return `false` if there are no such rows.
+ */
+static bool
+grid_colfile_visible_cursor(grid_context_t *gr, const grid_colfile_t *cf,
+                            int x_column, int y_column,
+                            grid_colfile_cursor_t *cursor)
+{
+    int n_columns = cf->header->n_columns;
+    if (x_column < 0 || x_column >= n_columns ||
+        y_column < 0 || y_column >= n_columns)
+    {
+        fprintf(stderr, "Warning: no columns %d and %d\n", x_column, y_column);
+        return false;
+    }
+
+    const cairo_matrix_t *m = &gr->current_node->npc_to_ntv;
+    double lo = m->x0, hi = m->x0 + m->xx;
+    if (hi < lo) {
+        double t = lo;
+        lo = hi;
+        hi = t;
+    }
+
+    long first, n;
+    grid_colfile_visible_rows(cf, x_column, lo, hi, &first, &n);
+
+    *cursor = (grid_colfile_cursor_t){
+        .cf = cf, .x_column = x_column, .y_column = y_column,
+        .row = first, .end = first + n
+    };
+
+    return n > 0;
+}
+
+/**
+ * Draw lines through the rows of two columns, in native units of the current
+ * viewport. Only chunks whose x-values can fall within the viewport's native
+ * x-range are read, and they are streamed to \ref grid_stream_lines without
+ * being converted or copied as a whole, so files larger than memory can be
+ * drawn.
+ */
+void
+grid_colfile_lines(grid_context_t *gr, grid_colfile_t *cf, int x_column,
+                   int y_column, const grid_par_t *par)
+{
+    grid_colfile_cursor_t cursor;
+    if (grid_colfile_visible_cursor(gr, cf, x_column, y_column, &cursor))
+        grid_stream_lines(gr, grid_colfile_next, &cursor, "native", par);
+}
+
+/**
+ * Draw a point at each row of two columns, as \ref grid_colfile_lines draws
+ * lines.
+ */
+void
+grid_colfile_points(grid_context_t *gr, grid_colfile_t *cf, int x_column,
+                    int y_column, const grid_par_t *par)
+{
+    grid_colfile_cursor_t cursor;
+    if (grid_colfile_visible_cursor(gr, cf, x_column, y_column, &cursor))
+        grid_stream_points(gr, grid_colfile_next, &cursor, "native", par);
+}
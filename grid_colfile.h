@@ -0,0 +1,100 @@
+#ifndef GridColfile_h
+#define GridColfile_h
+
+#include "griddle.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * A column file holds a header, one \ref grid_colfile_column_t per column,
+ * and the columns' data and statistics, each starting on an 8-byte boundary.
+ * Values are stored in the byte order of the machine that wrote the file;
+ * files written on a machine of the other byte order are rejected.
+ */
+#define GRID_COLFILE_MAGIC "GRIDCOL1"
+#define GRID_COLFILE_VERSION 1
+#define GRID_COLFILE_BYTE_ORDER 0x01020304
+#define GRID_COLFILE_NAME_SIZE 48
+
+typedef enum {
+    GRID_COLFILE_F64 = 1,
+    GRID_COLFILE_F32,
+    GRID_COLFILE_I32,
+    GRID_COLFILE_I64
+} grid_colfile_type_t;
+
+typedef struct {
+    char magic[8];
+    uint32_t version, byte_order;
+    uint32_t n_columns, reserved;
+    int64_t n_rows;
+    int64_t chunk_rows;  /**< Rows per statistics chunk, or 0 if the file has
+                              no statistics. */
+} grid_colfile_header_t;
+
+typedef struct {
+    char name[GRID_COLFILE_NAME_SIZE];
+    uint32_t type, reserved;
+    int64_t data_offset;
+    int64_t stats_offset; /**< Offset of the column's chunk statistics, or 0. */
+} grid_colfile_column_t;
+
+/**
+ * Statistics of one chunk of a column, laid out like a \ref grid_range_t.
+ */
+typedef struct {
+    double min, max;
+    int64_t count;
+} grid_colfile_chunk_t;
+
+/**
+ * A column file mapped into memory. See \ref new_grid_colfile.
+ */
+typedef struct {
+    void *map;
+    size_t map_size;
+    const grid_colfile_header_t *header;
+    const grid_colfile_column_t *columns;
+    double **converted; /**< Columns other than doubles, converted when they
+                             are first viewed. */
+} grid_colfile_t;
+
+bool
+grid_write_colfile(const char*, long, int, const char**,
+                   const grid_colfile_type_t*, const void**, long);
+
+grid_colfile_t*
+new_grid_colfile(const char*);
+
+void
+free_grid_colfile(grid_colfile_t*);
+
+long
+grid_colfile_rows(const grid_colfile_t*);
+
+int
+grid_colfile_column(const grid_colfile_t*, const char*);
+
+unit_array_t
+grid_colfile_array(grid_colfile_t*, int, long, long, char*);
+
+void
+grid_colfile_range(const grid_colfile_t*, int, long, long, grid_range_t*);
+
+grid_viewport_t*
+new_grid_colfile_viewport(const grid_colfile_t*, int, int);
+
+void
+grid_colfile_visible_rows(const grid_colfile_t*, int, double, double,
+                          long*, long*);
+
+void
+grid_colfile_lines(grid_context_t*, grid_colfile_t*, int, int,
+                   const grid_par_t*);
+
+void
+grid_colfile_points(grid_context_t*, grid_colfile_t*, int, int,
+                    const grid_par_t*);
+
+#endif
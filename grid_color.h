@@ -0,0 +1,31 @@
+#ifndef GridColor_h
+#define GridColor_h
+
+#include <stdint.h>
+
+#define GRID_COLOR_LUT_SIZE 1024
+
+/**
+ * Maps values linearly onto a ramp of colors through a precomputed lookup
+ * table of premultiplied ARGB32 pixels, the format of cairo's image surfaces.
+ * Values at or below `min` get the first color of the ramp and values at or
+ * above `max` the last; `NaN` values are transparent. See
+ * \ref new_grid_color_map.
+ */
+typedef struct {
+    uint32_t lut[GRID_COLOR_LUT_SIZE + 1]; /**< Evenly spaced from `min` to
+                                                `max`, then the pixel for
+                                                `NaN`. */
+    double min, max;
+} grid_color_map_t;
+
+grid_color_map_t*
+new_grid_color_map(int, const uint32_t*, double, double);
+
+void
+free_grid_color_map(grid_color_map_t*);
+
+void
+grid_color_map_apply(const grid_color_map_t*, long, const double*, uint32_t*);
+
+#endif
@@ -0,0 +1,450 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include "grid_csv.h"
+
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define GRID_CSV_CHUNK_MIN (1L << 20)
+#define GRID_CSV_NUMBER_SIZE 64
+
+static const double grid_csv_pow10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/**
+ * Parse a field with `strtod`, for numbers the fast path can't handle exactly
+ * and for words like `nan` and `inf`.
+ */
+static double
+grid_csv_strtod(const char *p, const char *end) {
+    char buf[GRID_CSV_NUMBER_SIZE];
+    if (end - p >= GRID_CSV_NUMBER_SIZE)
+        return NAN;
+
+    memcpy(buf, p, end - p);
+    buf[end - p] = '\0';
+
+    char *stop;
+    double v = strtod(buf, &stop);
+    return stop == buf + (end - p) ? v : NAN;
+}
+
+/**
+ * Parse the number in `[p, end)`, ignoring surrounding spaces and quotes.
+ * Empty and malformed fields are `NaN`. Decimal numbers with at most 19
+ * significant digits whose value is an exactly representable integer scaled
+ * by a power of ten up to 1e22 are converted with a single multiplication or
+ * division, which rounds correctly; other numbers fall back on `strtod`.
+ */
+static double
+grid_csv_parse_double(const char *p, const char *end) {
+    while (p < end && (*p == ' ' || *p == '"'))
+        p++;
+    while (end > p && (end[-1] == ' ' || end[-1] == '"' || end[-1] == '\r'))
+        end--;
+
+    if (p == end)
+        return NAN;
+
+    const char *start = p;
+    bool negative = false;
+    if (*p == '-' || *p == '+') {
+        negative = *p == '-';
+        p++;
+    }
+
+    uint64_t mantissa = 0;
+    int digits = 0, exp10 = 0;
+    bool any = false, exact = true;
+
+    for (; p < end && *p >= '0' && *p <= '9'; p++) {
+        any = true;
+        if (digits < 19) {
+            mantissa = 10 * mantissa + (*p - '0');
+            digits += mantissa > 0;
+        } else {
+            exp10++;
+            exact = false;
+        }
+    }
+
+    if (p < end && *p == '.') {
+        for (p++; p < end && *p >= '0' && *p <= '9'; p++) {
+            any = true;
+            if (digits < 19) {
+                mantissa = 10 * mantissa + (*p - '0');
+                digits += mantissa > 0;
+                exp10--;
+            } else {
+                exact = false;
+            }
+        }
+    }
+
+    if (!any)
+        return grid_csv_strtod(start, end);
+
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        p++;
+        bool exp_negative = false;
+        if (p < end && (*p == '-' || *p == '+')) {
+            exp_negative = *p == '-';
+            p++;
+        }
+
+        if (p == end)
+            return NAN;
+
+        int e = 0;
+        for (; p < end && *p >= '0' && *p <= '9'; p++)
+            if (e < 100000)
+                e = 10 * e + (*p - '0');
+
+        exp10 += exp_negative ? -e : e;
+    }
+
+    if (p != end)
+        return NAN;
+
+    if (exact && mantissa <= (1ULL << 53) && exp10 >= -22 && exp10 <= 22) {
+        double v = (double)mantissa;
+        v = exp10 < 0 ? v / grid_csv_pow10[-exp10] : v * grid_csv_pow10[exp10];
+        return negative ? -v : v;
+    }
+
+    return grid_csv_strtod(start, end);
+}
+
+/**
+ * A byte range of the file, holding whole lines, and where its rows go.
+ */
+typedef struct {
+    grid_csv_t *csv;
+    const char *begin, *end;
+    char delim;
+    long rows;        /**< Rows in the range. */
+    long first_row;   /**< Index of the range's first row in the columns. */
+} grid_csv_work_t;
+
+/**
+ * End of the line starting at `p`, not including the newline.
+ */
+static const char*
+grid_csv_line_end(const char *p, const char *end) {
+    const char *nl = memchr(p, '\n', end - p);
+    return nl ? nl : end;
+}
+
+/**
+ * True if a line has nothing but an optional carriage return.
+ */
+static bool
+grid_csv_blank(const char *p, const char *line_end) {
+    return p == line_end || (line_end - p == 1 && *p == '\r');
+}
+
+/**
+ * Count the rows of a range; blank lines are skipped.
+ */
+static void*
+grid_csv_count(void *arg) {
+    grid_csv_work_t *work = arg;
+    const char *p = work->begin;
+    long rows = 0;
+
+    while (p < work->end) {
+        const char *line_end = grid_csv_line_end(p, work->end);
+        rows += !grid_csv_blank(p, line_end);
+        p = line_end + 1;
+    }
+
+    work->rows = rows;
+    return NULL;
+}
+
+/**
+ * Parse the rows of a range into the columns. Missing fields are `NaN`;
+ * extra fields are ignored.
+ */
+static void*
+grid_csv_parse(void *arg) {
+    grid_csv_work_t *work = arg;
+    grid_csv_t *csv = work->csv;
+    const char *p = work->begin;
+    long row = work->first_row;
+
+    while (p < work->end) {
+        const char *line_end = grid_csv_line_end(p, work->end);
+        if (grid_csv_blank(p, line_end)) {
+            p = line_end + 1;
+            continue;
+        }
+
+        int j;
+        for (j = 0; j < csv->n_columns; j++) {
+            if (p > line_end) {
+                csv->columns[j][row] = NAN;
+                continue;
+            }
+
+            const char *field_end = memchr(p, work->delim, line_end - p);
+            if (!field_end)
+                field_end = line_end;
+
+            csv->columns[j][row] = grid_csv_parse_double(p, field_end);
+            p = field_end + 1;
+        }
+
+        row++;
+        p = line_end + 1;
+    }
+
+    return NULL;
+}
+
+/**
+ * Run `fn` on each work item, one thread per item, with the calling thread
+ * taking the first item and any items whose thread couldn't be started.
+ */
+static void
+grid_csv_run(void *(*fn)(void*), grid_csv_work_t *work, int n) {
+    pthread_t *threads = grid_malloc(n * sizeof(pthread_t));
+    bool *started = grid_calloc(n, sizeof(bool));
+
+    int t;
+    for (t = 1; t < n; t++)
+        started[t] = pthread_create(threads + t, NULL, fn, work + t) == 0;
+
+    for (t = 0; t < n; t++)
+        if (!started[t])
+            fn(work + t);
+
+    for (t = 1; t < n; t++)
+        if (started[t])
+            pthread_join(threads[t], NULL);
+
+    grid_free(threads, n * sizeof(pthread_t));
+    grid_free(started, n * sizeof(bool));
+}
+
+static double
+grid_csv_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+/**
+ * Load the numeric columns of a delimited text file, such as a CSV (`delim`
+ * `','`) or TSV (`'\t'`) file. If `header` is true, the first line names the
+ * columns; otherwise the first line just sets the number of columns. Fields
+ * that aren't numbers are `NaN`.
+ *
+ * The file is mapped rather than read, split into ranges of whole lines, and
+ * parsed by `n_threads` threads (one per online processor if `n_threads` is
+ * not positive, and fewer for small files) in two passes: the first counts
+ * the rows of each range, so the second can parse every range directly into
+ * its place in the columns. The time taken is recorded in the result.
+ *
+ * \return `NULL` if the file can't be read.
+ */
+grid_csv_t*
+new_grid_csv(const char *path, char delim, bool header, int n_threads) {
+    double start = grid_csv_now();
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Warning: can't open '%s'\n", path);
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        fprintf(stderr, "Warning: can't stat '%s'\n", path);
+        close(fd);
+        return NULL;
+    }
+
+    size_t size = st.st_size;
+    const char *map = NULL;
+    if (size > 0) {
+        void *m = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (m == MAP_FAILED) {
+            fprintf(stderr, "Warning: can't map '%s'\n", path);
+            close(fd);
+            return NULL;
+        }
+        map = m;
+    }
+    close(fd);
+
+    grid_csv_t *csv = grid_malloc(sizeof(grid_csv_t));
+    csv->n_columns = 0;
+    csv->n_rows = 0;
+    csv->names = NULL;
+    csv->columns = NULL;
+    csv->bytes = size;
+
+    const char *p = map, *end = map + size;
+
+    // the first non-blank line sets the number of columns
+    const char *line_end = p;
+    while (p < end) {
+        line_end = grid_csv_line_end(p, end);
+        if (!grid_csv_blank(p, line_end))
+            break;
+        p = line_end + 1;
+    }
+
+    if (p < end) {
+        csv->n_columns = 1;
+        const char *q;
+        for (q = p; q < line_end; q++)
+            csv->n_columns += *q == delim;
+    }
+
+    if (header && p < end) {
+        csv->names = grid_malloc(csv->n_columns * sizeof(char*));
+
+        int j;
+        for (j = 0; j < csv->n_columns; j++) {
+            const char *field_end = memchr(p, delim, line_end - p);
+            if (!field_end)
+                field_end = line_end;
+
+            const char *a = p, *b = field_end;
+            while (a < b && (*a == ' ' || *a == '"'))
+                a++;
+            while (b > a && (b[-1] == ' ' || b[-1] == '"' || b[-1] == '\r'))
+                b--;
+
+            csv->names[j] = grid_malloc(b - a + 1);
+            memcpy(csv->names[j], a, b - a);
+            csv->names[j][b - a] = '\0';
+
+            p = field_end + 1;
+        }
+
+        p = line_end + 1;
+    }
+
+    if (p > end)
+        p = end;
+
+    // split the data into ranges of whole lines
+    long bytes = end - p;
+    if (n_threads <= 0) {
+        n_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+        if (n_threads > bytes / GRID_CSV_CHUNK_MIN)
+            n_threads = (int)(bytes / GRID_CSV_CHUNK_MIN);
+    }
+    if (n_threads > bytes)
+        n_threads = (int)bytes;
+    if (n_threads < 1)
+        n_threads = 1;
+
+    grid_csv_work_t *work = grid_malloc(n_threads * sizeof(grid_csv_work_t));
+    const char *begin = p;
+    int t;
+    for (t = 0; t < n_threads; t++) {
+        const char *range_end = end;
+        if (t < n_threads - 1) {
+            range_end = p + bytes * (t + 1) / n_threads;
+            if (range_end < begin)
+                range_end = begin;
+            range_end = grid_csv_line_end(range_end, end);
+            if (range_end < end)
+                range_end++;
+        }
+
+        work[t] = (grid_csv_work_t){
+            .csv = csv, .begin = begin, .end = range_end, .delim = delim
+        };
+        begin = range_end;
+    }
+
+    grid_csv_run(grid_csv_count, work, n_threads);
+
+    for (t = 0; t < n_threads; t++) {
+        work[t].first_row = csv->n_rows;
+        csv->n_rows += work[t].rows;
+    }
+
+    csv->columns = grid_malloc(csv->n_columns * sizeof(double*));
+    int j;
+    for (j = 0; j < csv->n_columns; j++)
+        csv->columns[j] = grid_malloc(csv->n_rows * sizeof(double));
+
+    grid_csv_run(grid_csv_parse, work, n_threads);
+
+    grid_free(work, n_threads * sizeof(grid_csv_work_t));
+    if (map)
+        munmap((void*)map, size);
+
+    csv->seconds = grid_csv_now() - start;
+    csv->rows_per_second = csv->seconds > 0 ? csv->n_rows / csv->seconds : 0;
+
+    return csv;
+}
+
+/**
+ * Deallocate a \ref grid_csv_t and its columns.
+ */
+void
+free_grid_csv(grid_csv_t *csv) {
+    int j;
+    for (j = 0; j < csv->n_columns; j++) {
+        grid_free(csv->columns[j], csv->n_rows * sizeof(double));
+        if (csv->names)
+            grid_free_string(csv->names[j]);
+    }
+
+    grid_free(csv->columns, csv->n_columns * sizeof(double*));
+    if (csv->names)
+        grid_free(csv->names, csv->n_columns * sizeof(char*));
+    grid_free(csv, sizeof(grid_csv_t));
+}
+
+/**
+ * Find a column by its name in the header.
+ *
+ * \return The column's index, or -1 if there is no such column.
+ */
+int
+grid_csv_column(const grid_csv_t *csv, const char *name) {
+    if (!csv->names)
+        return -1;
+
+    int j;
+    for (j = 0; j < csv->n_columns; j++)
+        if (strcmp(csv->names[j], name) == 0)
+            return j;
+
+    return -1;
+}
+
+/**
+ * View a column as a \ref unit_array_t of the given unit type, without
+ * copying. The view is valid until the columns are freed and must not be
+ * passed to `free_unit_array`.
+ */
+unit_array_t
+grid_csv_array(const grid_csv_t *csv, int column, char *type) {
+    if (column < 0 || column >= csv->n_columns) {
+        fprintf(stderr, "Warning: no column %d\n", column);
+        return UnitArray(0, NULL, type);
+    }
+
+    return UnitArray(csv->n_rows, csv->columns[column], type);
+}
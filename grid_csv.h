@@ -0,0 +1,31 @@
+#ifndef GridCsv_h
+#define GridCsv_h
+
+#include "griddle.h"
+
+/**
+ * Numeric columns parsed from a delimited text file. See \ref new_grid_csv.
+ */
+typedef struct {
+    int n_columns;
+    long n_rows;
+    char **names;            /**< Column names from the header, or `NULL`. */
+    double **columns;        /**< One buffer of `n_rows` values per column. */
+    long bytes;              /**< Size of the file. */
+    double seconds;          /**< Wall-clock time spent loading the file. */
+    double rows_per_second;
+} grid_csv_t;
+
+grid_csv_t*
+new_grid_csv(const char*, char, bool, int);
+
+void
+free_grid_csv(grid_csv_t*);
+
+int
+grid_csv_column(const grid_csv_t*, const char*);
+
+unit_array_t
+grid_csv_array(const grid_csv_t*, int, char*);
+
+#endif
@@ -0,0 +1,392 @@
+#include "grid_facet.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define GRID_STRIP_LINES 1.5
+
+/**
+ * Allocate a new \ref grid_facet_t from `size` samples, where sample `i`
+ * belongs to group `groups[i]`, which should be in `[0, n_groups)`. Samples
+ * with other groups are dropped. Panels are laid out in `ncol` columns, or
+ * in a roughly square grid if `ncol` is not positive. Per-panel and shared
+ * ranges are computed in a single pass over the data; non-finite samples don't
+ * contribute to them.
+ */
+grid_facet_t*
+new_grid_facet(int size, const double *xs, const double *ys, const int *groups,
+               int n_groups, int ncol, grid_scales_t scales)
+{
+    if (n_groups < 1) {
+        fprintf(stderr, "Warning: can't facet data into %d groups\n", n_groups);
+        return NULL;
+    }
+
+    grid_facet_t *facet = grid_malloc(sizeof(grid_facet_t));
+    facet->n_groups = n_groups;
+    facet->scales = scales;
+    facet->offsets = grid_calloc(n_groups + 1, sizeof(int));
+
+    grid_range_t *ranges = grid_malloc(2 * n_groups * sizeof(grid_range_t));
+    grid_range_t *x_ranges = ranges, *y_ranges = ranges + n_groups;
+
+    int g, i;
+    for (g = 0; g < 2 * n_groups; g++)
+        grid_range_init(ranges + g);
+
+    // count the groups and find their ranges
+    int dropped = 0;
+    for (i = 0; i < size; i++) {
+        g = groups[i];
+        if (g < 0 || g >= n_groups) {
+            dropped++;
+            continue;
+        }
+
+        facet->offsets[g + 1]++;
+        grid_range_add(x_ranges + g, xs[i]);
+        grid_range_add(y_ranges + g, ys[i]);
+    }
+
+    if (dropped)
+        fprintf(stderr, "Warning: dropped %d samples outside the groups\n",
+                dropped);
+
+    for (g = 0; g < n_groups; g++)
+        facet->offsets[g + 1] += facet->offsets[g];
+
+    // store each group's samples contiguously
+    facet->size = size - dropped;
+    facet->xs = grid_malloc(facet->size * sizeof(double));
+    facet->ys = grid_malloc(facet->size * sizeof(double));
+
+    int *next = grid_malloc(n_groups * sizeof(int));
+    memcpy(next, facet->offsets, n_groups * sizeof(int));
+
+    for (i = 0; i < size; i++) {
+        g = groups[i];
+        if (g < 0 || g >= n_groups)
+            continue;
+
+        facet->xs[next[g]] = xs[i];
+        facet->ys[next[g]] = ys[i];
+        next[g]++;
+    }
+
+    grid_free(next, n_groups * sizeof(int));
+
+    // merge the ranges of shared scales
+    bool free_x = scales == GRID_SCALES_FREE_X || scales == GRID_SCALES_FREE;
+    bool free_y = scales == GRID_SCALES_FREE_Y || scales == GRID_SCALES_FREE;
+
+    grid_range_t shared_x, shared_y;
+    grid_range_init(&shared_x);
+    grid_range_init(&shared_y);
+    for (g = 0; g < n_groups; g++) {
+        grid_range_merge(&shared_x, x_ranges + g);
+        grid_range_merge(&shared_y, y_ranges + g);
+    }
+
+    facet->x_ntv = grid_malloc(2 * n_groups * sizeof(double));
+    facet->y_ntv = grid_malloc(2 * n_groups * sizeof(double));
+
+    for (g = 0; g < n_groups; g++) {
+        grid_range_pad(free_x ? x_ranges + g : &shared_x, 
+                       facet->x_ntv + 2 * g, facet->x_ntv + 2 * g + 1);
+        grid_range_pad(free_y ? y_ranges + g : &shared_y, 
+                       facet->y_ntv + 2 * g, facet->y_ntv + 2 * g + 1);
+    }
+
+    grid_free(ranges, 2 * n_groups * sizeof(grid_range_t));
+
+    // each row of panels is a strip, the panels, and a gap for axes; each
+    // column is the panels and a gap
+    facet->ncol = ncol > 0 ? ncol : (int)ceil(sqrt(n_groups));
+    if (facet->ncol > n_groups)
+        facet->ncol = n_groups;
+    facet->nrow = (n_groups + facet->ncol - 1) / facet->ncol;
+
+    int n_heights = 3 * facet->nrow - 1, n_widths = 2 * facet->ncol - 1;
+    const unit_t **heights = grid_malloc(n_heights * sizeof(unit_t*));
+    const unit_t **widths = grid_malloc(n_widths * sizeof(unit_t*));
+
+    unit_t strip = Unit(GRID_STRIP_LINES, "lines");
+    unit_t x_gap = Unit(free_x ? 2.5 : 0.5, "lines");
+    unit_t y_gap = Unit(free_y ? 4 : 0.5, "em");
+
+    for (i = 0; i < n_heights; i++)
+        heights[i] = i % 3 == 0 ? &strip : i % 3 == 1 ? NULL : &x_gap;
+
+    for (i = 0; i < n_widths; i++)
+        widths[i] = i % 2 == 0 ? NULL : &y_gap;
+
+    facet->layout = new_grid_layout(n_heights, heights, n_widths, widths);
+
+    grid_free(heights, n_heights * sizeof(unit_t*));
+    grid_free(widths, n_widths * sizeof(unit_t*));
+
+    return facet;
+}
+
+/**
+ * Deallocate a \ref grid_facet_t.
+ */
+void
+free_grid_facet(grid_facet_t *facet) {
+    int n_groups = facet->n_groups;
+    grid_free(facet->xs, facet->size * sizeof(double));
+    grid_free(facet->ys, facet->size * sizeof(double));
+    grid_free(facet->offsets, (n_groups + 1) * sizeof(int));
+    grid_free(facet->x_ntv, 2 * n_groups * sizeof(double));
+    grid_free(facet->y_ntv, 2 * n_groups * sizeof(double));
+    free_grid_layout(facet->layout);
+    grid_free(facet, sizeof(grid_facet_t));
+}
+
+/**
+ * Work shared by the threads drawing a facet's panels. Thread `t` draws the
+ * panels `t`, `t + stride`, ...
+ */
+typedef struct {
+    const grid_facet_t *facet;
+    grid_context_t **panels;
+    grid_panel_fn draw;
+    void *data;
+    const grid_par_t *par;
+    int first, stride;
+} grid_facet_work_t;
+
+static void*
+grid_draw_panels(void *arg) {
+    grid_facet_work_t *work = arg;
+    const grid_facet_t *facet = work->facet;
+
+    int g;
+    for (g = work->first; g < facet->n_groups; g += work->stride) {
+        grid_context_t *gr = work->panels[g];
+        if (!gr)
+            continue;
+
+        grid_viewport_t *vp = new_grid_default_viewport();
+        vp->has_ntv = true;
+        vp->x_ntv = facet->x_ntv[2 * g];
+        vp->w_ntv = facet->x_ntv[2 * g + 1];
+        vp->y_ntv = facet->y_ntv[2 * g];
+        vp->h_ntv = facet->y_ntv[2 * g + 1];
+        grid_push_named_viewport(gr, "panel", vp);
+        free_grid_viewport(vp);
+
+        int offset = facet->offsets[g];
+        int size = facet->offsets[g + 1] - offset;
+        double *xs = facet->xs + offset, *ys = facet->ys + offset;
+
+        if (gr->tracer) {
+            char group[16];
+            snprintf(group, sizeof(group), "%d", g);
+            grid_trace_begin(gr->tracer, "grid_facet_panel", "group", group);
+        }
+
+        if (work->draw) {
+            work->draw(gr, facet, g, size, xs, ys, work->data);
+        } else if (size > 0) {
+            unit_array_t x_units = UnitArray(size, xs, "native");
+            unit_array_t y_units = UnitArray(size, ys, "native");
+            grid_lines(gr, &x_units, &y_units, work->par);
+        }
+
+        if (gr->tracer)
+            grid_trace_end(gr->tracer, NULL, NULL);
+    }
+
+    return NULL;
+}
+
+/**
+ * Draw a facet in the current viewport, which should leave margins for the
+ * axes (see \ref new_grid_plot_viewport). Each panel is drawn by `draw`, or as
+ * lines with parameters `par` if `draw` is `NULL`, into a context of its own;
+ * panels are drawn by `n_threads` threads and then composited into their
+ * cells. Panels start with the default parameters. Strips above the panels
+ * show `labels[g]`, or the group number if `labels` is `NULL`. Ticks are
+ * computed once per scale; shared axes are drawn only along the bottom and
+ * left of the page. If `gr` has a tracer, each panel is traced as a thread of
+ * its own in it.
+ */
+void
+grid_facet(grid_context_t *gr, grid_facet_t *facet, const char **labels,
+           grid_panel_fn draw, void *data, int n_threads,
+           const grid_par_t *par)
+{
+    int n_groups = facet->n_groups, ncol = facet->ncol, g;
+    bool free_x = facet->scales == GRID_SCALES_FREE_X ||
+                  facet->scales == GRID_SCALES_FREE;
+    bool free_y = facet->scales == GRID_SCALES_FREE_Y ||
+                  facet->scales == GRID_SCALES_FREE;
+
+    if (gr->tracer)
+        grid_trace_begin(gr->tracer, "grid_facet", NULL, NULL);
+
+    // create one context per panel, sized to its cell in whole pixels and
+    // allocating through the facet's context's allocator
+    grid_context_t **panels = grid_malloc(n_groups * sizeof(grid_context_t*));
+    int *origins = grid_malloc(2 * n_groups * sizeof(int));
+
+    for (g = 0; g < n_groups; g++) {
+        grid_push_layout_viewport(gr, facet->layout, 3 * (g / ncol) + 1,
+                                                     2 * (g % ncol));
+        cairo_matrix_t *m = &gr->current_node->npc_to_dev;
+        int x0 = (int)round(m->x0), x1 = (int)round(m->x0 + m->xx);
+        int y0 = (int)round(m->y0), y1 = (int)round(m->y0 + m->yy);
+        grid_pop_viewport_1(gr);
+
+        origins[2 * g] = x0;
+        origins[2 * g + 1] = y1;
+        panels[g] = x1 > x0 && y1 > y0 ?
+            new_grid_context_with_allocator(x1 - x0, y1 - y0, gr->allocator) :
+            NULL;
+    }
+
+    // draw the panels
+    if (n_threads > n_groups)
+        n_threads = n_groups;
+    if (n_threads < 1)
+        n_threads = 1;
+
+    // panels record into tracers of their own, with one thread id per
+    // drawing thread
+    if (gr->tracer)
+        for (g = 0; g < n_groups; g++)
+            if (panels[g])
+                grid_set_tracer(panels[g], 
+                    new_grid_tracer(gr->tracer->tid + 1 + g % n_threads));
+
+    grid_facet_work_t *work = grid_malloc(n_threads * 
+                                          sizeof(grid_facet_work_t));
+    pthread_t *threads = grid_malloc(n_threads * sizeof(pthread_t));
+    bool *started = grid_calloc(n_threads, sizeof(bool));
+
+    int t;
+    for (t = 0; t < n_threads; t++) {
+        work[t] = (grid_facet_work_t){
+            .facet = facet, .panels = panels, .draw = draw, .data = data,
+            .par = par, .first = t, .stride = n_threads
+        };
+
+        if (t > 0)
+            started[t] = pthread_create(threads + t, NULL,
+                                        grid_draw_panels, work + t) == 0;
+    }
+
+    // the calling thread draws its share, and the share of any thread that
+    // couldn't be started
+    for (t = 0; t < n_threads; t++)
+        if (!started[t])
+            grid_draw_panels(work + t);
+
+    for (t = 1; t < n_threads; t++)
+        if (started[t])
+            pthread_join(threads[t], NULL);
+
+    grid_free(work, n_threads * sizeof(grid_facet_work_t));
+    grid_free(threads, n_threads * sizeof(pthread_t));
+    grid_free(started, n_threads * sizeof(bool));
+
+    // compute the ticks of shared scales once
+    grid_ticks_t *x_ticks = NULL, *y_ticks = NULL;
+    if (!free_x)
+        x_ticks = new_grid_ticks(gr, facet->x_ntv[0], facet->x_ntv[1], par);
+    if (!free_y)
+        y_ticks = new_grid_ticks(gr, facet->y_ntv[0], facet->y_ntv[1], par);
+
+    cairo_t *cr = gr->cr;
+    cairo_matrix_t flip, id = { .xx = 1, .yy = 1 };
+    cairo_get_matrix(cr, &flip);
+
+    rgba_t strip_fill = { 0.85, 0.85, 0.85, 1 };
+    grid_par_t strip_par = par ? *par : (grid_par_t){ 0 };
+    strip_par.fill = &strip_fill;
+    strip_par.just = "center";
+    strip_par.vjust = "middle";
+
+    char label[32];
+
+    for (g = 0; g < n_groups; g++) {
+        int row = g / ncol, col = g % ncol;
+
+        // composite the panel into its cell
+        if (panels[g]) {
+            cairo_surface_t *s = panels[g]->surface;
+            cairo_surface_flush(s);
+            cairo_save(cr);
+            cairo_set_matrix(cr, &id);
+            cairo_set_source_surface(cr, s, origins[2 * g],
+                                     flip.y0 - origins[2 * g + 1]);
+            cairo_rectangle(cr, origins[2 * g], flip.y0 - origins[2 * g + 1],
+                            cairo_image_surface_get_width(s),
+                            cairo_image_surface_get_height(s));
+            cairo_fill(cr);
+            cairo_restore(cr);
+
+            if (panels[g]->tracer) {
+                grid_trace_merge(gr->tracer, panels[g]->tracer);
+                free_grid_tracer(panels[g]->tracer);
+            }
+            free_grid_context(panels[g]);
+        }
+
+        grid_push_layout_viewport(gr, facet->layout, 3 * row, 2 * col);
+        grid_full_rect(gr, &strip_par);
+        if (labels)
+            snprintf(label, sizeof(label), "%s", labels[g]);
+        else
+            snprintf(label, sizeof(label), "%d", g);
+        grid_text(gr, label, NULL, NULL, &strip_par);
+        grid_pop_viewport_1(gr);
+
+        // shared axes go on the outside of the page only
+        bool bottom = row == facet->nrow - 1 || g + ncol >= n_groups;
+        bool left = col == 0;
+
+        if (!(free_x || bottom) && !(free_y || left))
+            continue;
+
+        grid_viewport_t *vp = new_grid_default_viewport();
+        vp->has_ntv = true;
+        vp->x_ntv = facet->x_ntv[2 * g];
+        vp->w_ntv = facet->x_ntv[2 * g + 1];
+        vp->y_ntv = facet->y_ntv[2 * g];
+        vp->h_ntv = facet->y_ntv[2 * g + 1];
+
+        grid_push_layout_viewport(gr, facet->layout, 3 * row + 1, 2 * col);
+        grid_push_viewport(gr, vp);
+        free_grid_viewport(vp);
+
+        if (free_x) {
+            grid_xaxis(gr, par);
+        } else if (bottom) {
+            grid_xaxis_ticks(gr, x_ticks, par);
+        }
+
+        if (free_y) {
+            grid_yaxis(gr, par);
+        } else if (left) {
+            grid_yaxis_ticks(gr, y_ticks, par);
+        }
+
+        grid_pop_viewport(gr, 2);
+    }
+
+    if (x_ticks)
+        free_grid_ticks(x_ticks);
+    if (y_ticks)
+        free_grid_ticks(y_ticks);
+
+    grid_free(panels, n_groups * sizeof(grid_context_t*));
+    grid_free(origins, 2 * n_groups * sizeof(int));
+
+    if (gr->tracer)
+        grid_trace_end(gr->tracer, NULL, NULL);
+}
@@ -0,0 +1,52 @@
+#ifndef GridFacet_h
+#define GridFacet_h
+
+#include "griddle.h"
+
+/**
+ * Which axes of a \ref grid_facet_t each panel scales independently.
+ */
+typedef enum {
+    GRID_SCALES_FIXED,
+    GRID_SCALES_FREE_X,
+    GRID_SCALES_FREE_Y,
+    GRID_SCALES_FREE
+} grid_scales_t;
+
+/**
+ * A dataset split into panels by a grouping column, laid out as small
+ * multiples. The samples of each group are stored contiguously, and each
+ * panel's native range is computed when the facet is created.
+ */
+typedef struct {
+    int size;               /**< Number of samples kept. */
+    double *xs, *ys;        /**< Samples, ordered by group. */
+    int n_groups;
+    int *offsets;           /**< Group `g` is `[offsets[g], offsets[g + 1])`. */
+    double *x_ntv, *y_ntv;  /**< Origin and size of each panel's range. */
+    grid_scales_t scales;
+    int nrow, ncol;
+    grid_layout_t *layout;  /**< Strip, panel, and gap rows and columns. */
+} grid_facet_t;
+
+/**
+ * Draws one panel of a facet. The panel's viewport, with the panel's native
+ * range, is current. Panels may be drawn concurrently, each in its own
+ * context.
+ */
+typedef void (*grid_panel_fn)(grid_context_t *gr, const grid_facet_t *facet,
+                              int group, int size,
+                              const double *xs, const double *ys, void *data);
+
+grid_facet_t*
+new_grid_facet(int, const double*, const double*, const int*, int, int,
+               grid_scales_t);
+
+void
+free_grid_facet(grid_facet_t*);
+
+void
+grid_facet(grid_context_t*, grid_facet_t*, const char**, grid_panel_fn,
+           void*, int, const grid_par_t*);
+
+#endif
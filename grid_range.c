@@ -0,0 +1,190 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include "grid_range.h"
+#include "grid_alloc.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define GRID_RANGE_LANES 4
+#define GRID_RANGE_CHUNK_MIN (1L << 18)
+
+/**
+ * Reset a \ref grid_range_t to the empty range.
+ */
+void
+grid_range_init(grid_range_t *r) {
+    r->min = INFINITY;
+    r->max = -INFINITY;
+    r->count = 0;
+}
+
+/**
+ * Add a value to a range, unless it is `NaN` or infinite.
+ */
+void
+grid_range_add(grid_range_t *r, double v) {
+    if (!isfinite(v))
+        return;
+
+    if (v < r->min)
+        r->min = v;
+    if (v > r->max)
+        r->max = v;
+    r->count++;
+}
+
+/**
+ * Add the finite values of an array to a range. The loop is branch-free and
+ * keeps independent minima and maxima in several lanes, so the compiler can
+ * vectorize it.
+ */
+void
+grid_range_add_array(grid_range_t *r, long n, const double *xs) {
+    double lo[GRID_RANGE_LANES], hi[GRID_RANGE_LANES];
+    long count[GRID_RANGE_LANES];
+
+    int k;
+    for (k = 0; k < GRID_RANGE_LANES; k++) {
+        lo[k] = INFINITY;
+        hi[k] = -INFINITY;
+        count[k] = 0;
+    }
+
+    long i;
+    for (i = 0; i + GRID_RANGE_LANES <= n; i += GRID_RANGE_LANES) {
+        for (k = 0; k < GRID_RANGE_LANES; k++) {
+            double v = xs[i + k];
+
+            // v - v is zero for finite v and NaN otherwise
+            bool finite = v - v == 0;
+            lo[k] = finite && v < lo[k] ? v : lo[k];
+            hi[k] = finite && v > hi[k] ? v : hi[k];
+            count[k] += finite;
+        }
+    }
+
+    for (; i < n; i++)
+        grid_range_add(r, xs[i]);
+
+    for (k = 0; k < GRID_RANGE_LANES; k++) {
+        grid_range_t lane = { .min = lo[k], .max = hi[k], .count = count[k] };
+        grid_range_merge(r, &lane);
+    }
+}
+
+typedef struct {
+    grid_range_t range;
+    long n;
+    const double *xs;
+} grid_range_work_t;
+
+static void*
+grid_range_worker(void *arg) {
+    grid_range_work_t *work = arg;
+    grid_range_add_array(&work->range, work->n, work->xs);
+    return NULL;
+}
+
+/**
+ * Add the finite values of an array to a range, splitting large arrays
+ * across `n_threads` threads, or one thread per online processor if
+ * `n_threads` is not positive. Arrays too small to benefit are scanned by the
+ * calling thread.
+ */
+void
+grid_range_add_array_parallel(grid_range_t *r, long n, const double *xs,
+                              int n_threads)
+{
+    if (n_threads <= 0)
+        n_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (n_threads > n / GRID_RANGE_CHUNK_MIN)
+        n_threads = (int)(n / GRID_RANGE_CHUNK_MIN);
+
+    if (n_threads <= 1) {
+        grid_range_add_array(r, n, xs);
+        return;
+    }
+
+    grid_range_work_t *work = grid_malloc(n_threads * 
+                                          sizeof(grid_range_work_t));
+    pthread_t *threads = grid_malloc(n_threads * sizeof(pthread_t));
+    bool *started = grid_calloc(n_threads, sizeof(bool));
+
+    long chunk = n / n_threads;
+    int t;
+    for (t = 0; t < n_threads; t++) {
+        grid_range_init(&work[t].range);
+        work[t].xs = xs + t * chunk;
+        work[t].n = t == n_threads - 1 ? n - t * chunk : chunk;
+
+        if (t > 0)
+            started[t] = pthread_create(threads + t, NULL, 
+                                        grid_range_worker, work + t) == 0;
+    }
+
+    // the calling thread scans its own chunk, and those of any threads that
+    // couldn't be started
+    for (t = 0; t < n_threads; t++)
+        if (!started[t])
+            grid_range_worker(work + t);
+
+    for (t = 0; t < n_threads; t++) {
+        if (started[t])
+            pthread_join(threads[t], NULL);
+        grid_range_merge(r, &work[t].range);
+    }
+
+    grid_free(work, n_threads * sizeof(grid_range_work_t));
+    grid_free(threads, n_threads * sizeof(pthread_t));
+    grid_free(started, n_threads * sizeof(bool));
+}
+
+/**
+ * Add the finite values of several arrays to a range; array `i` holds
+ * `sizes[i]` values. See \ref grid_range_add_array_parallel.
+ */
+void
+grid_range_add_arrays(grid_range_t *r, int n_arrays, const long *sizes,
+                      const double **arrays, int n_threads)
+{
+    int i;
+    for (i = 0; i < n_arrays; i++)
+        grid_range_add_array_parallel(r, sizes[i], arrays[i], n_threads);
+}
+
+/**
+ * Merge the range `other` into `r`.
+ */
+void
+grid_range_merge(grid_range_t *r, const grid_range_t *other) {
+    if (other->min < r->min)
+        r->min = other->min;
+    if (other->max > r->max)
+        r->max = other->max;
+    r->count += other->count;
+}
+
+/**
+ * Compute a native origin and size that cover a range with a margin of 1/18
+ * of its width on either side. A range holding a single value is given a
+ * width of one, centered on the value, and an empty range is mapped to
+ * `[0, 1]`.
+ */
+void
+grid_range_pad(const grid_range_t *r, double *origin, double *size) {
+    if (r->count == 0) {
+        *origin = 0;
+        *size = 1;
+    } else if (r->max > r->min) {
+        double pad = 0.1 * (r->max - r->min) / 1.8;
+        *origin = r->min - pad;
+        *size = r->max - r->min + 2 * pad;
+    } else {
+        *origin = r->min - 0.5;
+        *size = 1;
+    }
+}
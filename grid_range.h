@@ -0,0 +1,35 @@
+#ifndef GridRange_h
+#define GridRange_h
+
+/**
+ * The range of the finite values seen so far. `NaN` and infinite values are
+ * skipped. Ranges of disjoint parts of the data can be computed separately
+ * and merged with \ref grid_range_merge.
+ */
+typedef struct {
+    double min, max;
+    long count;        /**< Number of finite values seen. */
+} grid_range_t;
+
+void
+grid_range_init(grid_range_t*);
+
+void
+grid_range_add(grid_range_t*, double);
+
+void
+grid_range_add_array(grid_range_t*, long, const double*);
+
+void
+grid_range_add_array_parallel(grid_range_t*, long, const double*, int);
+
+void
+grid_range_add_arrays(grid_range_t*, int, const long*, const double**, int);
+
+void
+grid_range_merge(grid_range_t*, const grid_range_t*);
+
+void
+grid_range_pad(const grid_range_t*, double*, double*);
+
+#endif
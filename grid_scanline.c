@@ -0,0 +1,235 @@
+#include "grid_scanline.h"
+
+#include <math.h>
+#include <stdbool.h>
+
+#define GRID_SCANLINE_JOINT_PIXELS 32
+
+/**
+ * A pixel near a joint of a polyline, whose coverage by the segments on
+ * either side is summed before it's composited.
+ */
+typedef struct {
+    int x, y;
+    double coverage;
+    long segment;        /**< Last segment that covered the pixel. */
+} grid_scanline_pixel_t;
+
+/**
+ * A polyline being rasterized: the target pixels, the clip in pixels, the
+ * width of the lines, their color, and the pixels around the last joint.
+ */
+typedef struct {
+    unsigned char *data;
+    int stride;
+    int x0, y0, x1, y1;  /**< Clip, as half-open pixel ranges. */
+    double width;
+    uint32_t a, r, g, b; /**< Color channels, not premultiplied. */
+    grid_scanline_pixel_t joint[GRID_SCANLINE_JOINT_PIXELS];
+    int joint_size;
+    long segment;
+} grid_scanline_t;
+
+/**
+ * Divide by 255, rounding to the nearest integer, for `x` up to 255 * 255.
+ */
+static inline uint32_t
+grid_div255(uint32_t x) {
+    x += 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+/**
+ * Composite the line's color, with `coverage` of a pixel covered, over the
+ * premultiplied pixel at `x`, `y`, as cairo's OVER operator does.
+ */
+static inline void
+grid_scanline_blend(const grid_scanline_t *s, int x, int y, double coverage) {
+    uint32_t a = (uint32_t)(coverage * s->a + 0.5);
+    if (a == 0)
+        return;
+
+    uint32_t *pixel = (uint32_t*)(s->data + (long)y * s->stride) + x;
+    uint32_t dst = *pixel, inv = 255 - a;
+    *pixel = (a + grid_div255((dst >> 24) * inv)) << 24 |
+             (grid_div255(s->r * a) + grid_div255((dst >> 16 & 0xff) * inv)) << 16 |
+             (grid_div255(s->g * a) + grid_div255((dst >> 8 & 0xff) * inv)) << 8 |
+             (grid_div255(s->b * a) + grid_div255((dst & 0xff) * inv));
+}
+
+/**
+ * Cover a pixel near either end of a segment. Consecutive segments split the
+ * pixels around their joint between them, so their coverages are summed;
+ * compositing them one after the other would leave the joint lighter.
+ */
+static void
+grid_scanline_cover_joint(grid_scanline_t *s, int x, int y, double coverage) {
+    int i;
+    for (i = 0; i < s->joint_size; i++) {
+        grid_scanline_pixel_t *p = s->joint + i;
+        if (p->x == x && p->y == y) {
+            p->coverage += coverage;
+            p->segment = s->segment;
+            return;
+        }
+    }
+
+    if (s->joint_size == GRID_SCANLINE_JOINT_PIXELS) {
+        grid_scanline_blend(s, x, y, coverage);
+        return;
+    }
+
+    s->joint[s->joint_size++] = (grid_scanline_pixel_t){
+        x, y, coverage, s->segment
+    };
+}
+
+/**
+ * Composite the joint pixels that the current segment didn't cover, or all
+ * of them once the polyline ends.
+ */
+static void
+grid_scanline_flush_joint(grid_scanline_t *s, bool all) {
+    int i, kept = 0;
+    for (i = 0; i < s->joint_size; i++) {
+        grid_scanline_pixel_t *p = s->joint + i;
+        if (!all && p->segment == s->segment)
+            s->joint[kept++] = *p;
+        else
+            grid_scanline_blend(s, p->x, p->y, fmin(p->coverage, 1));
+    }
+    s->joint_size = kept;
+}
+
+/**
+ * Rasterize one segment, Wu-style: step along its major axis one pixel at a
+ * time and cover the two to four pixels that the line's band crosses on the
+ * minor axis, in proportion to the area of each pixel under the band. The
+ * ends cover partial pixels too, so consecutive segments of a polyline share
+ * their joint's pixels between them.
+ */
+static void
+grid_scanline_segment(grid_scanline_t *s, double x0, double y0,
+                      double x1, double y1)
+{
+    if (!isfinite(x0) || !isfinite(y0) || !isfinite(x1) || !isfinite(y1))
+        return;
+
+    // work in the segment's axes: u along it, v across it
+    double t, du = x1 - x0, dv = y1 - y0;
+    bool steep = fabs(dv) > fabs(du);
+    int u_min = s->x0, u_max = s->x1, v_min = s->y0, v_max = s->y1;
+    if (steep) {
+        t = x0; x0 = y0; y0 = t;
+        t = x1; x1 = y1; y1 = t;
+        t = du; du = dv; dv = t;
+        u_min = s->y0; u_max = s->y1; v_min = s->x0; v_max = s->x1;
+    }
+
+    // like cairo's butt caps, a segment of length 0 covers nothing
+    if (du == 0)
+        return;
+
+    if (du < 0) {
+        t = x0; x0 = x1; x1 = t;
+        t = y0; y0 = y1; y1 = t;
+        du = -du;
+        dv = -dv;
+    }
+
+    double slope = dv / du;
+    double half = 0.5 * s->width * sqrt(du * du + dv * dv) / du;
+
+    // skip the stretches of the segment whose band misses the clip, so that
+    // long segments mostly outside it cost no more than the part inside
+    double lo = fmax(x0, u_min), hi = fmin(x1, u_max);
+    if (slope != 0) {
+        double a = x0 + (v_min - half - 1 - y0) / slope;
+        double b = x0 + (v_max + half + 1 - y0) / slope;
+        lo = fmax(lo, fmin(a, b));
+        hi = fmin(hi, fmax(a, b));
+    } else if (y0 + half <= v_min || y0 - half >= v_max) {
+        return;
+    }
+
+    if (lo >= hi)
+        return;
+
+    // the pixels within a pixel of either end may be shared with the
+    // neighboring segments
+    double joint_lo = floor(x0) + 1, joint_hi = ceil(x1) - 2;
+
+    int u, u_end = (int)ceil(hi);
+    for (u = (int)floor(lo); u < u_end; u++) {
+        double a = fmax(x0, u), b = fmin(x1, u + 1);
+        if (b <= a)
+            continue;
+
+        double center = y0 + slope * (0.5 * (a + b) - x0);
+        double top = center - half, bottom = center + half;
+        int v = (int)fmax(floor(top), v_min);
+        int v_end = (int)fmin(ceil(bottom), v_max);
+        bool joint = u <= joint_lo || u >= joint_hi;
+        for (; v < v_end; v++) {
+            double coverage = (b - a) * (fmin(bottom, v + 1) - fmax(top, v));
+            if (coverage <= 0)
+                continue;
+
+            int x = steep ? v : u, y = steep ? u : v;
+            if (joint)
+                grid_scanline_cover_joint(s, x, y, coverage);
+            else
+                grid_scanline_blend(s, x, y, coverage);
+        }
+    }
+}
+
+/**
+ * Draw a polyline of `n` vertices into the pixels of a cairo image surface in
+ * the ARGB32 or RGB24 format, without going through cairo's stroker. Vertices
+ * are in pixels, with `y` growing downward; `width` is the line width in
+ * pixels, and `color` is packed as by `grid_pack_color`. Pixels outside
+ * `clip` are left alone, as are segments with a non-finite end.
+ *
+ * Each pixel is covered in proportion to its area under the line, as cairo
+ * covers it, with two approximations: segments end square to their major
+ * axis, so joints where the line turns between mostly horizontal and mostly
+ * vertical are off by up to half a pixel's coverage, and segments that don't
+ * share a joint are composited one after another, so where the line crosses
+ * itself a translucent color is composited twice. Both are small for lines
+ * up to \ref GRID_SCANLINE_MAX_WIDTH pixels wide.
+ *
+ * The caller flushes the surface before and marks it dirty after.
+ */
+void
+grid_scanline_lines(unsigned char *data, int stride,
+                    const cairo_rectangle_int_t *clip, long n,
+                    const double *xs, const double *ys, double width,
+                    uint32_t color)
+{
+    grid_scanline_t s = {
+        .data = data,
+        .stride = stride,
+        .x0 = clip->x,
+        .y0 = clip->y,
+        .x1 = clip->x + clip->width,
+        .y1 = clip->y + clip->height,
+        .width = width,
+        .a = color >> 24,
+        .r = color >> 16 & 0xff,
+        .g = color >> 8 & 0xff,
+        .b = color & 0xff,
+        .joint_size = 0
+    };
+
+    if (s.a == 0 || !(width > 0) || s.x1 <= s.x0 || s.y1 <= s.y0)
+        return;
+
+    for (s.segment = 1; s.segment < n; s.segment++) {
+        long i = s.segment;
+        grid_scanline_segment(&s, xs[i - 1], ys[i - 1], xs[i], ys[i]);
+        grid_scanline_flush_joint(&s, false);
+    }
+
+    grid_scanline_flush_joint(&s, true);
+}
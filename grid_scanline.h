@@ -0,0 +1,16 @@
+#ifndef GridScanline_h
+#define GridScanline_h
+
+#include <cairo.h>
+#include <stdint.h>
+
+/**
+ * The widest line, in pixels, that \ref grid_scanline_lines draws.
+ */
+#define GRID_SCANLINE_MAX_WIDTH 2.0
+
+void
+grid_scanline_lines(unsigned char*, int, const cairo_rectangle_int_t*, long,
+                    const double*, const double*, double, uint32_t);
+
+#endif
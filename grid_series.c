@@ -0,0 +1,357 @@
+#include "grid_series.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/**
+ * Allocate a new \ref grid_series_t that holds at most `capacity` samples. If
+ * `span` is positive, only samples whose `x` is within `span` of the most
+ * recent sample are visible.
+ */
+grid_series_t*
+new_grid_series(int capacity, double span) {
+    grid_series_t *s = grid_malloc(sizeof(grid_series_t));
+    s->capacity = capacity > 0 ? capacity : 1;
+    s->span = span;
+    s->count = s->first = 0;
+
+    s->xs = grid_malloc(2 * s->capacity * sizeof(double));
+    s->ys = grid_malloc(2 * s->capacity * sizeof(double));
+    s->min_q = grid_malloc(s->capacity * sizeof(long));
+    s->max_q = grid_malloc(s->capacity * sizeof(long));
+    s->min_head = s->min_tail = s->max_head = s->max_tail = 0;
+
+    s->drawn = false;
+
+    return s;
+}
+
+/**
+ * Deallocate a \ref grid_series_t.
+ */
+void
+free_grid_series(grid_series_t *s) {
+    grid_free(s->xs, 2 * s->capacity * sizeof(double));
+    grid_free(s->ys, 2 * s->capacity * sizeof(double));
+    grid_free(s->min_q, s->capacity * sizeof(long));
+    grid_free(s->max_q, s->capacity * sizeof(long));
+    grid_free(s, sizeof(grid_series_t));
+}
+
+#define SeriesX(S,I) ((S)->xs[(I) % (S)->capacity])
+#define SeriesY(S,I) ((S)->ys[(I) % (S)->capacity])
+#define QueueAt(Q,S,I) ((Q)[(I) % (S)->capacity])
+
+/**
+ * Append a sample. The oldest sample is dropped if the buffer is full, and
+ * samples older than `span` leave the visible window. `NaN` values of `y` are
+ * kept (they break the line when drawn) but don't contribute to the range.
+ * Runs in amortized constant time.
+ */
+void
+grid_series_append(grid_series_t *s, double x, double y) {
+    long seq = s->count++;
+    int i = seq % s->capacity;
+    s->xs[i] = s->xs[i + s->capacity] = x;
+    s->ys[i] = s->ys[i + s->capacity] = y;
+
+    if (s->first < s->count - s->capacity)
+        s->first = s->count - s->capacity;
+
+    if (s->span > 0) {
+        while (s->first < seq && SeriesX(s, s->first) < x - s->span)
+            s->first++;
+    }
+
+    while (s->min_head < s->min_tail &&
+           QueueAt(s->min_q, s, s->min_head) < s->first)
+        s->min_head++;
+    while (s->max_head < s->max_tail &&
+           QueueAt(s->max_q, s, s->max_head) < s->first)
+        s->max_head++;
+
+    if (isnan(y))
+        return;
+
+    // keep the queues monotonic: the front holds the extremum of the window
+    while (s->min_head < s->min_tail &&
+           SeriesY(s, QueueAt(s->min_q, s, s->min_tail - 1)) >= y)
+        s->min_tail--;
+    QueueAt(s->min_q, s, s->min_tail++) = seq;
+
+    while (s->max_head < s->max_tail &&
+           SeriesY(s, QueueAt(s->max_q, s, s->max_tail - 1)) <= y)
+        s->max_tail--;
+    QueueAt(s->max_q, s, s->max_tail++) = seq;
+}
+
+/**
+ * \return The number of visible samples.
+ */
+int
+grid_series_size(const grid_series_t *s) {
+    return s->count - s->first;
+}
+
+/**
+ * Find the minimum and maximum `y` over the visible window.
+ *
+ * \return `false` if the window holds no non-`NaN` values.
+ */
+bool
+grid_series_range(const grid_series_t *s, double *min, double *max) {
+    if (s->min_head == s->min_tail)
+        return false;
+
+    *min = SeriesY(s, QueueAt(s->min_q, s, s->min_head));
+    *max = SeriesY(s, QueueAt(s->max_q, s, s->max_head));
+    return true;
+}
+
+/**
+ * Allocate a \ref grid_viewport_t whose native x-range scrolls with the
+ * series: it covers `span` up to the most recent sample, or the visible
+ * samples if the series has no span. The native y-range is padded from the
+ * range of the visible window, as in \ref new_grid_data_viewport.
+ */
+grid_viewport_t*
+new_grid_series_viewport(const grid_series_t *s) {
+    grid_viewport_t *vp = new_grid_default_viewport();
+    vp->has_ntv = true;
+    vp->x_ntv = vp->y_ntv = 0;
+    vp->w_ntv = vp->h_ntv = 1;
+
+    if (s->count == s->first)
+        return vp;
+
+    double last = SeriesX(s, s->count - 1);
+    if (s->span > 0) {
+        vp->x_ntv = last - s->span;
+        vp->w_ntv = s->span;
+    } else if (last > SeriesX(s, s->first)) {
+        vp->x_ntv = SeriesX(s, s->first);
+        vp->w_ntv = last - vp->x_ntv;
+    } else {
+        vp->x_ntv = last - 0.5;
+    }
+
+    grid_range_t range = { .count = 1 };
+    if (grid_series_range(s, &range.min, &range.max))
+        grid_range_pad(&range, &vp->y_ntv, &vp->h_ntv);
+
+    return vp;
+}
+
+/**
+ * Compute the integer device-space rectangle inside the current viewport,
+ * clamped to the surface.
+ */
+static void
+grid_series_device_rect(grid_context_t *gr, cairo_surface_t *target,
+                        int *rx, int *ry, int *rw, int *rh)
+{
+    double x1 = 0, y1 = 0, x2 = 1, y2 = 1;
+    cairo_matrix_transform_point(&gr->current_node->npc_to_dev, &x1, &y1);
+    cairo_matrix_transform_point(&gr->current_node->npc_to_dev, &x2, &y2);
+    cairo_user_to_device(gr->cr, &x1, &y1);
+    cairo_user_to_device(gr->cr, &x2, &y2);
+
+    int left = (int)ceil(fmin(x1, x2));
+    int top = (int)ceil(fmin(y1, y2));
+    int right = (int)floor(fmax(x1, x2));
+    int bottom = (int)floor(fmax(y1, y2));
+
+    if (left < 0)
+        left = 0;
+    if (top < 0)
+        top = 0;
+    if (right > cairo_image_surface_get_width(target))
+        right = cairo_image_surface_get_width(target);
+    if (bottom > cairo_image_surface_get_height(target))
+        bottom = cairo_image_surface_get_height(target);
+
+    *rx = left;
+    *ry = top;
+    *rw = right > left ? right - left : 0;
+    *rh = bottom > top ? bottom - top : 0;
+}
+
+/**
+ * Fill a device-space rectangle with the fill color in effect, or clear it to
+ * transparent if there is none, then clip to it.
+ */
+static void
+grid_series_clear_and_clip(grid_context_t *gr, const grid_par_t *par,
+                           int x, int y, int w, int h)
+{
+    cairo_t *cr = gr->cr;
+    cairo_matrix_t m;
+    cairo_get_matrix(cr, &m);
+    cairo_identity_matrix(cr);
+    cairo_new_path(cr);
+    cairo_rectangle(cr, x, y, w, h);
+    cairo_clip(cr);
+
+    rgba_t *fill = par && par->fill ? par->fill :
+                   gr->current_node->par && gr->current_node->par->fill ?
+                   gr->current_node->par->fill : gr->par->fill;
+    if (fill) {
+        cairo_set_source_rgba(cr, fill->red, fill->green, fill->blue, fill->alpha);
+        cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+    } else {
+        cairo_set_operator(cr, CAIRO_OPERATOR_CLEAR);
+    }
+
+    cairo_paint(cr);
+    cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
+    cairo_set_matrix(cr, &m);
+    grid_invalidate_cairo_state(gr);
+}
+
+/**
+ * Draw samples `from` through the most recent one as a line.
+ */
+static void
+grid_series_draw_from(grid_context_t *gr, grid_series_t *s, long from,
+                      const grid_par_t *par)
+{
+    int n = s->count - from;
+    if (n <= 0)
+        return;
+
+    int start = from % s->capacity;
+    unit_array_t xs = UnitArray(n, s->xs + start, "native");
+    unit_array_t ys = UnitArray(n, s->ys + start, "native");
+    grid_lines(gr, &xs, &ys, par);
+}
+
+/**
+ * Remember the geometry the series was drawn with.
+ */
+static void
+grid_series_mark_drawn(grid_context_t *gr, grid_series_t *s, double x0) {
+    s->drawn = true;
+    s->drawn_count = s->count;
+    s->drawn_x0 = x0;
+    s->drawn_npc_to_dev = gr->current_node->npc_to_dev;
+    s->drawn_npc_to_ntv = gr->current_node->npc_to_ntv;
+}
+
+/**
+ * Draw the visible window of the series as a line in the current viewport.
+ */
+void
+grid_series_lines(grid_context_t *gr, grid_series_t *s, const grid_par_t *par) {
+    grid_series_draw_from(gr, s, s->first, par);
+
+    double x0 = 0, y0 = 0;
+    cairo_matrix_transform_point(&gr->current_node->npc_to_ntv, &x0, &y0);
+    grid_series_mark_drawn(gr, s, x0);
+}
+
+/**
+ * Update a series drawn in the current viewport, typically one created by
+ * \ref new_grid_series_viewport, by scrolling the pixels already drawn and
+ * drawing only the new strip. The series owns the viewport's pixels: the
+ * viewport is painted with the fill color in effect (or cleared) before
+ * drawing. The fast path applies when the image surface is drawn to directly
+ * and only the native x-origin changed since the last draw; otherwise the
+ * viewport is redrawn in full. Scrolling is done in whole pixels, so the
+ * retained pixels may lag the viewport's native coordinates by less than a
+ * pixel.
+ *
+ * \return `true` if the pixels were scrolled, `false` if the viewport was
+ * redrawn.
+ */
+bool
+grid_series_scroll(grid_context_t *gr, grid_series_t *s, const grid_par_t *par) {
+    grid_viewport_node_t *node = gr->current_node;
+    cairo_t *cr = gr->cr;
+    cairo_surface_t *target = cairo_get_group_target(cr);
+
+    double x0 = 0, y0 = 0;
+    cairo_matrix_transform_point(&node->npc_to_ntv, &x0, &y0);
+
+    if (cairo_surface_get_type(target) != CAIRO_SURFACE_TYPE_IMAGE ||
+        cairo_image_surface_get_format(target) != CAIRO_FORMAT_ARGB32)
+    {
+        grid_series_lines(gr, s, par);
+        return false;
+    }
+
+    int rx, ry, rw, rh;
+    grid_series_device_rect(gr, target, &rx, &ry, &rw, &rh);
+
+    // device pixels per native unit along x
+    double dx = 1, dy = 0;
+    cairo_matrix_transform_distance(&node->npc_to_dev, &dx, &dy);
+    cairo_user_to_device_distance(cr, &dx, &dy);
+    double px_per_ntv = fabs(dx) / node->npc_to_ntv.xx;
+
+    const cairo_matrix_t *a = &s->drawn_npc_to_ntv, *b = &node->npc_to_ntv;
+    int shift = (int)floor((x0 - s->drawn_x0) * px_per_ntv);
+
+    bool scroll = s->drawn && target == gr->surface &&
+                  memcmp(&s->drawn_npc_to_dev, &node->npc_to_dev,
+                         sizeof(cairo_matrix_t)) == 0 &&
+                  a->xx == b->xx && a->yy == b->yy && a->y0 == b->y0 &&
+                  s->drawn_count > s->first && shift >= 0 && shift < rw;
+
+    cairo_save(cr);
+
+    if (!scroll) {
+        grid_series_clear_and_clip(gr, par, rx, ry, rw, rh);
+        grid_series_draw_from(gr, s, s->first, par);
+        cairo_restore(cr);
+        grid_invalidate_cairo_state(gr);
+        grid_series_mark_drawn(gr, s, x0);
+        return false;
+    }
+
+    if (shift > 0) {
+        cairo_surface_flush(target);
+        unsigned char *data = cairo_image_surface_get_data(target);
+        int stride = cairo_image_surface_get_stride(target);
+        int row;
+        for (row = ry; row < ry + rh; row++) {
+            unsigned char *p = data + row * stride + rx * 4;
+            memmove(p, p + shift * 4, (rw - shift) * 4);
+        }
+        cairo_surface_mark_dirty_rectangle(target, rx, ry, rw, rh);
+    }
+
+    double retained_x0 = s->drawn_x0 + shift / px_per_ntv;
+
+    // redraw from just before the last drawn sample to the right edge, with
+    // a margin for the width of the line about to be drawn and its end cap
+    double lwd = grid_resolved_line_width(gr, par), lwd_y = 0;
+    cairo_user_to_device_distance(cr, &lwd, &lwd_y);
+    double margin = fabs(lwd) + 2;
+    double last_px = rx + (SeriesX(s, s->drawn_count - 1) - retained_x0) *
+                          px_per_ntv;
+    int strip = (int)floor(fmin(last_px - margin, rx + rw - shift));
+    if (strip < rx)
+        strip = rx;
+
+    // the segment entering the strip starts at the last sample left of it
+    double strip_ntv = x0 + (strip - rx) / px_per_ntv;
+    long lo = s->first, hi = s->count - 1;
+    while (lo < hi) {
+        long mid = lo + (hi - lo) / 2;
+        if (SeriesX(s, mid) < strip_ntv)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    grid_series_clear_and_clip(gr, par, strip, ry, rx + rw - strip, rh);
+    grid_series_draw_from(gr, s, lo > s->first ? lo - 1 : lo, par);
+    cairo_restore(cr);
+    grid_invalidate_cairo_state(gr);
+
+    s->drawn_count = s->count;
+    s->drawn_x0 = retained_x0;
+    return true;
+}
@@ -0,0 +1,55 @@
+#ifndef GridSeries_h
+#define GridSeries_h
+
+#include "griddle.h"
+
+/**
+ * A fixed-capacity ring buffer of `(x, y)` samples for live data. `x` values
+ * are expected to be non-decreasing. The window of visible samples is the
+ * most recent `capacity` samples, further limited to those with
+ * `x >= x_last - span` when `span` is positive. The minimum and maximum `y`
+ * over the window are maintained incrementally.
+ */
+typedef struct {
+    double *xs, *ys;   /**< Each sample is stored twice, at `i` and
+                            `i + capacity`, so every window is contiguous. */
+    int capacity;
+    double span;
+    long count;        /**< Number of samples ever appended. */
+    long first;        /**< Sequence number of the oldest visible sample. */
+
+    long *min_q, *max_q; /**< Monotonic queues of sequence numbers. */
+    long min_head, min_tail, max_head, max_tail;
+
+    // state of the last drawing, used to scroll instead of redraw
+    bool drawn;
+    long drawn_count;
+    double drawn_x0;
+    cairo_matrix_t drawn_npc_to_dev, drawn_npc_to_ntv;
+} grid_series_t;
+
+grid_series_t*
+new_grid_series(int, double);
+
+void
+free_grid_series(grid_series_t*);
+
+void
+grid_series_append(grid_series_t*, double, double);
+
+int
+grid_series_size(const grid_series_t*);
+
+bool
+grid_series_range(const grid_series_t*, double*, double*);
+
+grid_viewport_t*
+new_grid_series_viewport(const grid_series_t*);
+
+void
+grid_series_lines(grid_context_t*, grid_series_t*, const grid_par_t*);
+
+bool
+grid_series_scroll(grid_context_t*, grid_series_t*, const grid_par_t*);
+
+#endif
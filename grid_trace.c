@@ -0,0 +1,206 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include "grid_trace.h"
+#include "grid_alloc.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double
+grid_trace_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+/**
+ * Allocate a new tracer whose events are given the thread id `tid`. Times are
+ * written relative to the tracer's creation.
+ */
+grid_tracer_t*
+new_grid_tracer(int tid) {
+    grid_tracer_t *tracer = grid_malloc(sizeof(grid_tracer_t));
+    tracer->capacity = 1024;
+    tracer->events = grid_malloc(tracer->capacity * 
+                                 sizeof(grid_trace_event_t));
+    tracer->strings_capacity = 4096;
+    tracer->strings = grid_malloc(tracer->strings_capacity);
+    tracer->tid = tid;
+    grid_trace_clear(tracer);
+    return tracer;
+}
+
+/**
+ * Deallocate a \ref grid_tracer_t.
+ */
+void
+free_grid_tracer(grid_tracer_t *tracer) {
+    grid_free(tracer->events, tracer->capacity * sizeof(grid_trace_event_t));
+    grid_free(tracer->strings, tracer->strings_capacity);
+    grid_free(tracer, sizeof(grid_tracer_t));
+}
+
+/**
+ * Discard the recorded events, and write times relative to now.
+ */
+void
+grid_trace_clear(grid_tracer_t *tracer) {
+    tracer->size = 0;
+    tracer->strings_size = 0;
+    tracer->last_value = -1;
+    tracer->origin = grid_trace_now();
+}
+
+/**
+ * Copy an annotation to the tracer's strings, reusing the last copy if the
+ * annotation repeats, as the current viewport's name usually does.
+ *
+ * \return The annotation's offset, or -1 if `value` is `NULL`.
+ */
+static long
+grid_trace_string(grid_tracer_t *tracer, const char *value) {
+    if (!value)
+        return -1;
+
+    if (tracer->last_value >= 0 &&
+        strcmp(tracer->strings + tracer->last_value, value) == 0)
+        return tracer->last_value;
+
+    size_t len = strlen(value) + 1;
+    if (tracer->strings_size + len > tracer->strings_capacity) {
+        size_t capacity = tracer->strings_capacity;
+        while (tracer->strings_size + len > tracer->strings_capacity)
+            tracer->strings_capacity *= 2;
+        tracer->strings = grid_realloc(tracer->strings, capacity,
+                                       tracer->strings_capacity);
+    }
+
+    tracer->last_value = tracer->strings_size;
+    memcpy(tracer->strings + tracer->strings_size, value, len);
+    tracer->strings_size += len;
+    return tracer->last_value;
+}
+
+static void
+grid_trace_add(grid_tracer_t *tracer, char phase, const char *name,
+               const char *key, const char *value, double time, int tid)
+{
+    if (tracer->size == tracer->capacity) {
+        tracer->capacity *= 2;
+        tracer->events = grid_realloc(tracer->events,
+            tracer->size * sizeof(grid_trace_event_t),
+            tracer->capacity * sizeof(grid_trace_event_t));
+    }
+
+    grid_trace_event_t *event = tracer->events + tracer->size++;
+    event->name = name;
+    event->key = value ? key : NULL;
+    event->value = event->key ? grid_trace_string(tracer, value) : -1;
+    event->time = time;
+    event->tid = tid;
+    event->phase = phase;
+}
+
+/**
+ * Record the beginning of `name`, annotated with `key` and `value` if neither
+ * is `NULL`. `name` and `key` aren't copied, so they should be literals;
+ * `value` is copied.
+ */
+void
+grid_trace_begin(grid_tracer_t *tracer, const char *name, const char *key,
+                 const char *value)
+{
+    grid_trace_add(tracer, 'B', name, key, value, grid_trace_now(),
+                   tracer->tid);
+}
+
+/**
+ * Record the end of the innermost event that hasn't ended. The annotation is
+ * added to the event's, so an event can be annotated with what it produced.
+ */
+void
+grid_trace_end(grid_tracer_t *tracer, const char *key, const char *value) {
+    grid_trace_add(tracer, 'E', NULL, key, value, grid_trace_now(),
+                   tracer->tid);
+}
+
+/**
+ * Append the events of `src`, such as those recorded by another thread, to
+ * `dst`. Their times remain comparable, since both tracers use the same clock.
+ */
+void
+grid_trace_merge(grid_tracer_t *dst, const grid_tracer_t *src) {
+    int i;
+    for (i = 0; i < src->size; i++) {
+        const grid_trace_event_t *e = src->events + i;
+        grid_trace_add(dst, e->phase, e->name, e->key,
+                       e->value >= 0 ? src->strings + e->value : NULL,
+                       e->time, e->tid);
+    }
+}
+
+static void
+grid_write_json_string(FILE *f, const char *s) {
+    fputc('"', f);
+    for (; *s; s++) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\')
+            fprintf(f, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(f, "\\u%04x", c);
+        else
+            fputc(c, f);
+    }
+    fputc('"', f);
+}
+
+/**
+ * Write the recorded events to `path` in the Chrome trace-event format, which
+ * trace viewers such as Perfetto and `chrome://tracing` open.
+ *
+ * \return `true` on success. On failure, a warning is printed.
+ */
+bool
+grid_write_trace(const grid_tracer_t *tracer, const char *path) {
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        fprintf(stderr, "Warning: can't write trace '%s'\n", path);
+        return false;
+    }
+
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+    int i;
+    for (i = 0; i < tracer->size; i++) {
+        const grid_trace_event_t *e = tracer->events + i;
+        fprintf(f, "%s\n{\"ph\":\"%c\",\"pid\":1,\"tid\":%d,\"ts\":%.3f",
+                i > 0 ? "," : "", e->phase, e->tid,
+                1e6 * (e->time - tracer->origin));
+
+        if (e->name) {
+            fprintf(f, ",\"cat\":\"griddle\",\"name\":");
+            grid_write_json_string(f, e->name);
+        }
+
+        if (e->key) {
+            fprintf(f, ",\"args\":{");
+            grid_write_json_string(f, e->key);
+            fputc(':', f);
+            grid_write_json_string(f, tracer->strings + e->value);
+            fputc('}', f);
+        }
+
+        fputc('}', f);
+    }
+
+    fprintf(f, "\n]}\n");
+
+    if (fclose(f) != 0) {
+        fprintf(stderr, "Warning: can't write trace '%s'\n", path);
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,59 @@
+#ifndef GridTrace_h
+#define GridTrace_h
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * One begin (`'B'`) or end (`'E'`) event of a trace. Events of a thread nest
+ * like the calls they record.
+ */
+typedef struct {
+    const char *name;  /**< A string that outlives the tracer. */
+    const char *key;   /**< Name of the event's annotation, or `NULL`. Like
+                            `name`, it isn't copied. */
+    long value;        /**< Offset of the annotation in the tracer's strings,
+                            or -1. */
+    double time;       /**< Monotonic time in seconds. */
+    int tid;
+    char phase;
+} grid_trace_event_t;
+
+/**
+ * Records a timeline of begin and end events that can be written as Chrome
+ * trace-event JSON and opened in a trace viewer. A tracer isn't thread-safe;
+ * threads record into tracers of their own, which are then merged with
+ * \ref grid_trace_merge.
+ */
+typedef struct {
+    grid_trace_event_t *events;
+    int size, capacity;
+    char *strings;     /**< Copied annotations, each null-terminated. */
+    size_t strings_size, strings_capacity;
+    long last_value;   /**< Offset of the last annotation copied, or -1. */
+    double origin;     /**< Time written as zero. */
+    int tid;           /**< Thread id given to recorded events. */
+} grid_tracer_t;
+
+grid_tracer_t*
+new_grid_tracer(int);
+
+void
+free_grid_tracer(grid_tracer_t*);
+
+void
+grid_trace_clear(grid_tracer_t*);
+
+void
+grid_trace_begin(grid_tracer_t*, const char*, const char*, const char*);
+
+void
+grid_trace_end(grid_tracer_t*, const char*, const char*);
+
+void
+grid_trace_merge(grid_tracer_t*, const grid_tracer_t*);
+
+bool
+grid_write_trace(const grid_tracer_t*, const char*);
+
+#endif
@@ -1,4 +1,5 @@
 #include "grid_units.h"
+#include "grid_alloc.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -6,14 +7,13 @@
 
 /**
  * Allocate a new \ref unit_t with the given type. Currently supported unit types
- * are "px" and "line".
+ * are "px" and "line". The unit owns a copy of `type`.
  */
 unit_t*
 unit(double value, const char *type) {
-    unit_t *u = malloc(sizeof(unit_t));
+    unit_t *u = grid_malloc(sizeof(unit_t));
     u->value = value;
-    u->type = malloc(strlen(type) + 1);
-    strcpy(u->type, type);
+    u->type = grid_strdup(type);
 
     u->arg1 = NULL;
     u->arg2 = NULL;
@@ -22,7 +22,8 @@ unit(double value, const char *type) {
 }
 
 /**
- * Allocate a new \ref unit_t representing the sum of its arguments.
+ * Allocate a new \ref unit_t representing the sum of its arguments, which it
+ * takes ownership of.
  *
  * \return A unit representing arg1 + arg2.
  */
@@ -36,7 +37,8 @@ unit_add(unit_t *arg1, unit_t *arg2) {
 }
 
 /**
- * Allocate a new \ref unit_t representing the difference of its arguments.
+ * Allocate a new \ref unit_t representing the difference of its arguments,
+ * which it takes ownership of.
  *
  * \return A unit representing arg1 - arg2.
  */
@@ -51,7 +53,7 @@ unit_sub(unit_t *arg1, unit_t *arg2) {
 
 /**
  * Allocate a new \ref unit_t representing the value of `u` multiplied by
- * a scalar.
+ * a scalar. The new unit takes ownership of `u`.
  * 
  * \return A unit representing u * x.
  */
@@ -65,7 +67,7 @@ unit_mul(unit_t* u, double x) {
 
 /**
  * Allocate a new \ref unit_t representing the value of `u` divided by
- * a scalar.
+ * a scalar. The new unit takes ownership of `u`.
  * 
  * \return A unit representing u / x.
  */
@@ -78,8 +80,9 @@ unit_div(unit_t* u, double x) {
 }
 
 /**
- * Deallocate a \ref unit_t. Don't try to free `*type` since the most common
- * use is to construct a unit using a string literal.
+ * Deallocate a \ref unit_t allocated by \ref unit or the functions combining
+ * units, along with its type and arguments. Units made with `Unit` live on the
+ * stack and borrow their type, so they must not be freed.
  */
 void
 free_unit(unit_t *u) {
@@ -88,7 +91,56 @@ free_unit(unit_t *u) {
     if (u->arg2)
         free_unit(u->arg2);
 
-    free(u);
+    grid_free_string(u->type);
+    grid_free(u, sizeof(unit_t));
+}
+
+/**
+ * Add `scale` times the linear form of `u` to `c`.
+ */
+static bool
+unit_compile_helper(const unit_t *u, double scale, compiled_unit_t *c) {
+    if (strcmp(u->type, "+") == 0) {
+        return unit_compile_helper(u->arg1, scale, c) &
+               unit_compile_helper(u->arg2, scale, c);
+    } else if (strcmp(u->type, "-") == 0) {
+        return unit_compile_helper(u->arg1, scale, c) &
+               unit_compile_helper(u->arg2, -scale, c);
+    } else if (strcmp(u->type, "*") == 0) {
+        return unit_compile_helper(u->arg1, scale * u->value, c);
+    } else if (strcmp(u->type, "/") == 0) {
+        return unit_compile_helper(u->arg1, scale / u->value, c);
+    } else if (strcmp(u->type, "npc") == 0) {
+        c->npc += scale * u->value;
+    } else if (strcmp(u->type, "px") == 0) {
+        c->px += scale * u->value;
+    } else if (strncmp(u->type, "line", 4) == 0) {
+        c->lines += scale * u->value;
+    } else if (strcmp(u->type, "em") == 0) {
+        c->em += scale * u->value;
+    } else if (strcmp(u->type, "native") == 0) {
+        c->native += scale * u->value;
+        c->native_weight += scale;
+    } else if (strcmp(u->type, "null") == 0) {
+        c->null += scale * u->value;
+    } else {
+        fprintf(stderr, "Warning: can't convert unit '%s' to npc\n", u->type);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Reduce a unit expression to a \ref compiled_unit_t. Terms with unknown
+ * unit types are treated as 0 and a warning is printed.
+ *
+ * \return `false` if the expression contained an unknown unit type.
+ */
+bool
+unit_compile(const unit_t *u, compiled_unit_t *c) {
+    *c = (compiled_unit_t){ 0 };
+    return unit_compile_helper(u, 1.0, c);
 }
 
 /**
@@ -96,31 +148,29 @@ free_unit(unit_t *u) {
  */
 int
 unit_array_size(const unit_array_t *u) {
-    if (u->size > 0)
-        return u->size;
-    else if (u->arg1)
+    if (u->arg1)
         return unit_array_size(u->arg1);
     else
-        return 0;
+        return u->size;
 }
 
 /**
- * Allocate a new \ref unit_array_t with the given type.
+ * Allocate a new \ref unit_array_t with the given type. The array owns copies
+ * of `values` and `type`.
  */
 unit_array_t*
 unit_array(int size, const double *values, const char *type) {
-    unit_array_t *u = malloc(sizeof(unit_array_t));
+    unit_array_t *u = grid_malloc(sizeof(unit_array_t));
     u->size = size;
 
-    double *my_values = malloc(size * sizeof(double));
+    double *my_values = grid_malloc(size * sizeof(double));
     int i;
     for (i = 0; i < size; i++) {
         my_values[i] = values[i];
     }
     u->values = my_values;
 
-    u->type = malloc(strlen(type) + 1);
-    strcpy(u->type, type);
+    u->type = grid_strdup(type);
 
     u->arg1 = NULL;
     u->arg2 = NULL;
@@ -131,21 +181,22 @@ unit_array(int size, const double *values, const char *type) {
 /**
  * Allocate a new \ref unit_array_t representing the sum of its arguments.
  *
- * \return A unit representing arg1 + arg2. Returns `NULL` if arg1 and arg2
- * have different lengths.
+ * \return A unit representing arg1 + arg2, which takes ownership of the
+ * arguments. Returns `NULL` if arg1 and arg2 have different lengths.
  */
 unit_array_t*
 unit_array_add(unit_array_t *arg1, unit_array_t *arg2) {
-    if (arg1->size != arg2->size) {
+    int size1 = unit_array_size(arg1), size2 = unit_array_size(arg2);
+    if (size1 != size2) {
         fprintf(stderr, "Warning: can't add arrays of different lengths "
-                        "(%d and %d).\n", arg1->size, arg2->size);
+                        "(%d and %d).\n", size1, size2);
         return NULL;
     }
 
-    unit_array_t *u = malloc(sizeof(unit_array_t));
+    unit_array_t *u = grid_malloc(sizeof(unit_array_t));
     u->size = 0;
     u->values = NULL;
-    u->type = "+";
+    u->type = grid_strdup("+");
     u->arg1 = arg1;
     u->arg2 = arg2;
 
@@ -155,21 +206,22 @@ unit_array_add(unit_array_t *arg1, unit_array_t *arg2) {
 /**
  * Allocate a new \ref unit_array_t representing the difference of its arguments.
  *
- * \return A unit representing arg1 - arg2. Returns `NULL` if arg1 and arg2
- * have different lengths.
+ * \return A unit representing arg1 - arg2, which takes ownership of the
+ * arguments. Returns `NULL` if arg1 and arg2 have different lengths.
  */
 unit_array_t*
 unit_array_sub(unit_array_t *arg1, unit_array_t *arg2) {
-    if (arg1->size != arg2->size) {
+    int size1 = unit_array_size(arg1), size2 = unit_array_size(arg2);
+    if (size1 != size2) {
         fprintf(stderr, "Warning: can't difference arrays of different lengths "
-                        "(%d and %d).\n", arg1->size, arg2->size);
+                        "(%d and %d).\n", size1, size2);
         return NULL;
     }
 
-    unit_array_t *u = malloc(sizeof(unit_array_t));
+    unit_array_t *u = grid_malloc(sizeof(unit_array_t));
     u->size = 0;
     u->values = NULL;
-    u->type = "-";
+    u->type = grid_strdup("-");
     u->arg1 = arg1;
     u->arg2 = arg2;
 
@@ -178,16 +230,13 @@ unit_array_sub(unit_array_t *arg1, unit_array_t *arg2) {
 
 /**
  * Allocate a new \ref unit_array_t representing the value of `u` multiplied by
- * a scalar.
+ * a scalar. The new array takes ownership of `u`.
  * 
  * \return A unit representing u * x.
  */
 unit_array_t*
 unit_array_mul(unit_array_t* u, double x) {
-    double *value = malloc(sizeof(double));
-    *value = x;
-
-    unit_array_t *v = unit_array(1, value, "*");
+    unit_array_t *v = unit_array(1, &x, "*");
     v->arg1 = u;
 
     return v;
@@ -195,23 +244,22 @@ unit_array_mul(unit_array_t* u, double x) {
 
 /**
  * Allocate a new \ref unit_array_t representing the value of `u` divided by
- * a scalar.
+ * a scalar. The new array takes ownership of `u`.
  * 
  * \return A unit representing u / x.
  */
 unit_array_t*
 unit_array_div(unit_array_t* u, double x) {
-    double *value = malloc(sizeof(double));
-    *value = x;
-
-    unit_array_t *v = unit_array(1, value, "/");
+    unit_array_t *v = unit_array(1, &x, "/");
     v->arg1 = u;
 
     return v;
 }
 
 /**
- * Deallocate a \ref unit_t. Doesn't free underlying data.
+ * Deallocate a \ref unit_array_t allocated by \ref unit_array or the
+ * functions combining arrays, along with its values, type, and arguments.
+ * Arrays made with `UnitArray` borrow their values and must not be freed.
  */
 void
 free_unit_array(unit_array_t *u) {
@@ -220,5 +268,7 @@ free_unit_array(unit_array_t *u) {
     if (u->arg2)
         free_unit_array(u->arg2);
 
-    free(u);
+    grid_free(u->values, u->size * sizeof(double));
+    grid_free_string(u->type);
+    grid_free(u, sizeof(unit_array_t));
 }
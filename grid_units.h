@@ -1,6 +1,8 @@
 #ifndef GridUnits_h
 #define GridUnits_h
 
+#include <stdbool.h>
+
 typedef struct __unit_t {
     double value;
     char *type;
@@ -14,6 +16,21 @@ typedef struct __unit_array_t {
     struct __unit_array_t *arg1, *arg2;
 } unit_array_t;
 
+/**
+ * A unit expression reduced to a linear combination of base units. Every
+ * expression built from `unit`, `unit_add`, `unit_sub`, `unit_mul`, and
+ * `unit_div` has this form, so it can be evaluated without walking the tree.
+ * A native term `k * (v - origin) / size` contributes `k * v` to `native` and
+ * `k` to `native_weight`. `null` units are relative weights that only have
+ * meaning in a \ref grid_layout_t; elsewhere they evaluate to zero.
+ */
+typedef struct {
+    double npc, px, lines, em, native, native_weight, null;
+} compiled_unit_t;
+
+/**
+ * A unit on the stack, borrowing its type. Don't pass it to `free_unit`.
+ */
 #define Unit(X,T) ((unit_t){.value = X, .type = T})
 
 unit_t*
@@ -34,6 +51,13 @@ unit_div(unit_t*, double);
 void
 free_unit(unit_t*);
 
+bool
+unit_compile(const unit_t*, compiled_unit_t*);
+
+/**
+ * A unit array on the stack, borrowing its values and type. Don't pass it to
+ * `free_unit_array`.
+ */
 #define UnitArray(N,A,T) ((unit_array_t){.size = N, .values = A, .type = T})
 
 int
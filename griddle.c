@@ -5,17 +5,283 @@
  * for R as a C library using cairo.
  */
 
+#define _POSIX_C_SOURCE 200112L
+
 #include "griddle.h"
+#include "grid_scanline.h"
 
 #include <math.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 
 #ifndef M_PI
 #define M_PI 3.14159265358979323846 
 #endif
 
+//
+// statistics
+//
+
+/**
+ * Add `n` to a counter of the context's \ref grid_stats_t if statistics are
+ * enabled.
+ */
+#define GridCount(gr, counter, n) \
+    do { if ((gr)->stats_enabled) (gr)->stats.counter += (n); } while (0)
+
+/**
+ * A call of a counted function.
+ */
+typedef struct {
+    grid_op_t op;
+    bool timed;   /**< The call is counted in the context's statistics. */
+    double start;
+} grid_phase_t;
+
+static double
+grid_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+/**
+ * Record the beginning of an event in the context's tracer, if it has one,
+ * annotated with the current viewport's name.
+ */
+static inline void
+grid_trace_begin_node(grid_context_t *gr, const char *name) {
+    if (gr->tracer)
+        grid_trace_begin(gr->tracer, name, "viewport", gr->current_node->name);
+}
+
+static inline void
+grid_trace_end_node(grid_context_t *gr) {
+    if (gr->tracer)
+        grid_trace_end(gr->tracer, NULL, NULL);
+}
+
+/**
+ * Record the end of a push, annotated with the pushed viewport's name.
+ */
+static inline void
+grid_trace_end_pushed(grid_context_t *gr) {
+    if (gr->tracer)
+        grid_trace_end(gr->tracer, "pushed", gr->current_node->name);
+}
+
+/**
+ * Start measuring a call of the function `op`. Calls made while another
+ * counted function is running are attributed to that function, so each
+ * second is counted once; the tracer records every call. When statistics and
+ * tracing are disabled this costs two branches.
+ */
+static inline grid_phase_t
+grid_begin_phase(grid_context_t *gr, grid_op_t op) {
+    grid_phase_t phase = { op, false, 0.0 };
+    if (gr->stats_enabled && !gr->in_phase) {
+        gr->in_phase = true;
+        phase.timed = true;
+        phase.start = grid_now();
+    }
+    grid_trace_begin_node(gr, grid_op_name(op));
+    return phase;
+}
+
+static inline void
+grid_end_phase(grid_context_t *gr, grid_phase_t phase) {
+    grid_trace_end_node(gr);
+    if (!phase.timed)
+        return;
+
+    gr->stats.ops[phase.op].calls++;
+    gr->stats.ops[phase.op].seconds += grid_now() - phase.start;
+    gr->in_phase = false;
+}
+
+//
+// memory
+//
+
+/**
+ * Count an allocation of `size` bytes in the context's memory statistics.
+ */
+static void
+grid_context_count(grid_context_t *gr, size_t size) {
+    grid_memory_stats_t *m = &gr->memory;
+    m->live_bytes += size;
+    if (m->live_bytes > m->high_water)
+        m->high_water = m->live_bytes;
+    m->allocations++;
+}
+
+/**
+ * Allocate `size` bytes through the context's allocator, and count them in
+ * the context's memory statistics.
+ */
+static void*
+grid_context_malloc(grid_context_t *gr, size_t size) {
+    grid_context_count(gr, size);
+    return grid_allocator_malloc(gr->allocator, size);
+}
+
+/**
+ * Allocate `n` zeroed elements of `size` bytes as \ref grid_context_malloc
+ * does. Like \ref grid_allocator_calloc, this aborts if their total size
+ * overflows.
+ */
+static void*
+grid_context_calloc(grid_context_t *gr, size_t n, size_t size) {
+    void *ptr = grid_allocator_calloc(gr->allocator, n, size);
+    grid_context_count(gr, n * size);
+    return ptr;
+}
+
+/**
+ * Release an allocation of `size` bytes made by \ref grid_context_malloc.
+ * `ptr` may be `NULL`.
+ */
+static void
+grid_context_free(grid_context_t *gr, void *ptr, size_t size) {
+    if (!ptr)
+        return;
+
+    gr->memory.live_bytes -= size;
+    gr->memory.frees++;
+    grid_allocator_free(gr->allocator, ptr, size);
+}
+
+/**
+ * Copy the counters of the memory the context has allocated through its
+ * allocator: its default parameters, viewport nodes, indexes, and drawing
+ * buffers. Parameters, units, and other objects created on their own are
+ * counted only by the allocators they were allocated through.
+ */
+void
+grid_get_memory_stats(const grid_context_t *gr, grid_memory_stats_t *stats) {
+    *stats = gr->memory;
+}
+
+/**
+ * Return the context's scratch buffer, grown to hold at least `n` doubles.
+ * Growth is counted in the context's \ref grid_stats_t. The buffer is reused
+ * by the next call, so a draw function asks for all the space it needs at
+ * once; after the first drawing of a scene, redrawing it allocates nothing.
+ */
+static double*
+grid_scratch(grid_context_t *gr, size_t n) {
+    if (n > gr->scratch_size) {
+        size_t size = 2 * gr->scratch_size;
+        if (size < n)
+            size = n;
+
+        grid_context_free(gr, gr->scratch, gr->scratch_size * sizeof(double));
+        GridCount(gr, allocations, 1);
+        GridCount(gr, bytes_allocated, (long)(size * sizeof(double)));
+        gr->scratch = grid_context_malloc(gr, size * sizeof(double));
+        gr->scratch_size = size;
+    }
+
+    return gr->scratch;
+}
+
+/**
+ * The size of the allocation holding the arrays of a \ref grid_ticks_t.
+ */
+static size_t
+grid_ticks_bytes(int n) {
+    return n * (3 * sizeof(double) + GRID_TICK_LABEL_SIZE);
+}
+
+static void
+grid_font_extents(grid_context_t *gr, cairo_font_extents_t *extents) {
+    GridCount(gr, font_extents, 1);
+    grid_trace_begin_node(gr, "cairo_font_extents");
+    cairo_font_extents(gr->cr, extents);
+    grid_trace_end_node(gr);
+}
+
+static void
+grid_text_extents(grid_context_t *gr, const char *text, 
+                  cairo_text_extents_t *extents)
+{
+    GridCount(gr, text_extents, 1);
+    grid_trace_begin_node(gr, "cairo_text_extents");
+    cairo_text_extents(gr->cr, text, extents);
+    grid_trace_end_node(gr);
+}
+
+static void
+grid_stroke(grid_context_t *gr) {
+    GridCount(gr, strokes, 1);
+    cairo_stroke(gr->cr);
+}
+
+static void
+grid_fill(grid_context_t *gr) {
+    GridCount(gr, fills, 1);
+    cairo_fill(gr->cr);
+}
+
+static void
+grid_fill_preserve(grid_context_t *gr) {
+    GridCount(gr, fills, 1);
+    cairo_fill_preserve(gr->cr);
+}
+
+/**
+ * Start counting and timing the context's work, or stop. Statistics are
+ * disabled in new contexts; while they are disabled, each counted function
+ * costs a branch.
+ */
+void
+grid_enable_stats(grid_context_t *gr, bool enabled) {
+    gr->stats_enabled = enabled;
+}
+
+/**
+ * Copy the statistics collected since the context was created or
+ * \ref grid_reset_stats was last called.
+ */
+void
+grid_get_stats(const grid_context_t *gr, grid_stats_t *stats) {
+    *stats = gr->stats;
+}
+
+/**
+ * Zero the context's statistics.
+ */
+void
+grid_reset_stats(grid_context_t *gr) {
+    memset(&gr->stats, 0, sizeof(grid_stats_t));
+}
+
+/**
+ * Record the context's work in `tracer` until another tracer, or `NULL`, is
+ * set. The tracer isn't owned by the context. Contexts drawn on different
+ * threads need tracers of their own; see \ref grid_trace_merge.
+ */
+void
+grid_set_tracer(grid_context_t *gr, grid_tracer_t *tracer) {
+    gr->tracer = tracer;
+}
+
+/**
+ * \return The name of the function counted as `op`, for reports and traces.
+ */
+const char*
+grid_op_name(grid_op_t op) {
+    static const char *names[GRID_OP_COUNT] = {
+        "grid_line", "grid_lines", "grid_point", "grid_points",
+        "grid_styled_points", "grid_stream_lines", "grid_stream_points",
+        "grid_rect", "grid_polygon", "grid_raster", "grid_text",
+        "new_grid_ticks", "grid_axis", "grid_write_png"
+    };
+    return op >= 0 && op < GRID_OP_COUNT ? names[op] : "unknown";
+}
+
 /**
  * NOTE: this function assumes device coordinates are pixels.
  */
@@ -67,20 +333,20 @@ unit_to_npc(grid_context_t *gr, char dim, const unit_t *u) {
     grid_viewport_node_t *node = gr->current_node;
     double dev_x_per_npc, dev_y_per_npc;
     dev_x_per_npc = dev_y_per_npc = 1.0;
-    cairo_matrix_transform_distance(node->npc_to_dev, &dev_x_per_npc, 
+    cairo_matrix_transform_distance(&node->npc_to_dev, &dev_x_per_npc, 
                                                       &dev_y_per_npc);
 
     double x_ntv, y_ntv, w_ntv, h_ntv;
     x_ntv = y_ntv = 0.0;
     w_ntv = h_ntv = 1.0;
-    cairo_matrix_transform_point(node->npc_to_ntv, &x_ntv, &y_ntv);
-    cairo_matrix_transform_distance(node->npc_to_ntv, &w_ntv, &h_ntv);
+    cairo_matrix_transform_point(&node->npc_to_ntv, &x_ntv, &y_ntv);
+    cairo_matrix_transform_distance(&node->npc_to_ntv, &w_ntv, &h_ntv);
 
     cairo_font_extents_t font_extents;
-    cairo_font_extents(gr->cr, &font_extents);
+    grid_font_extents(gr, &font_extents);
 
     cairo_text_extents_t em_extents;
-    cairo_text_extents(gr->cr, "m", &em_extents);
+    grid_text_extents(gr, "m", &em_extents);
 
     double dev_per_npc, o_ntv, size_ntv;  
     dev_per_npc = o_ntv = size_ntv = 0.0;
@@ -97,6 +363,7 @@ unit_to_npc(grid_context_t *gr, char dim, const unit_t *u) {
         fprintf(stderr, "Warning: unknown dimension '%c'\n", dim);
     }
 
+    GridCount(gr, unit_conversions, 1);
     double result = unit_to_npc_helper(dev_per_npc, font_extents.height,
                                        em_extents.width, o_ntv, size_ntv, u);
 
@@ -104,61 +371,65 @@ unit_to_npc(grid_context_t *gr, char dim, const unit_t *u) {
 }
 
 /**
- * NOTE: this function assumes device coordinates are pixels.
+ * The number of doubles of scratch space \ref unit_array_to_npc_helper needs
+ * to convert `u`, beyond the result.
+ */
+static size_t
+unit_array_scratch_size(const unit_array_t *u, int size) {
+    if (strcmp(u->type, "+") == 0 || strcmp(u->type, "-") == 0) {
+        size_t a = unit_array_scratch_size(u->arg1, size);
+        size_t b = size + unit_array_scratch_size(u->arg2, size);
+        return a > b ? a : b;
+    } else if (strcmp(u->type, "*") == 0 || strcmp(u->type, "/") == 0) {
+        return unit_array_scratch_size(u->arg1, size);
+    }
+
+    return 0;
+}
+
+/**
+ * NOTE: this function assumes device coordinates are pixels. Composite arrays
+ * are converted in place, with `scratch` holding the second operand of sums
+ * and differences; see \ref unit_array_scratch_size.
  */
 static void
-unit_array_to_npc_helper(double *result, double dev_per_npc, 
+unit_array_to_npc_helper(double *result, double *scratch, double dev_per_npc, 
                          double dev_per_line, double dev_per_em, 
                          double o_ntv, double size_ntv,
                          int size, const unit_array_t *u) 
 {
     int i;
-    double *xs, *ys;
 
     if (strcmp(u->type, "+") == 0) {
-        xs = malloc(size * sizeof(double));
-        ys = malloc(size * sizeof(double));
-        unit_array_to_npc_helper(xs, dev_per_npc, dev_per_line, dev_per_em, 
-                                 o_ntv, size_ntv, size, u->arg1);
-        unit_array_to_npc_helper(ys, dev_per_npc, dev_per_line, dev_per_em, 
-                                 o_ntv, size_ntv, size, u->arg1);
+        unit_array_to_npc_helper(result, scratch, dev_per_npc, dev_per_line, 
+                                 dev_per_em, o_ntv, size_ntv, size, u->arg1);
+        unit_array_to_npc_helper(scratch, scratch + size, dev_per_npc, 
+                                 dev_per_line, dev_per_em, o_ntv, size_ntv, 
+                                 size, u->arg2);
 
         for (i = 0; i < size; i++)
-            result[i] = xs[i] + ys[i];
-
-        free(xs);
-        free(ys);
+            result[i] += scratch[i];
     } else if (strcmp(u->type, "-") == 0) {
-        xs = malloc(size * sizeof(double));
-        ys = malloc(size * sizeof(double));
-        unit_array_to_npc_helper(xs, dev_per_npc, dev_per_line, dev_per_em, 
-                                 o_ntv, size_ntv, size, u->arg1);
-        unit_array_to_npc_helper(ys, dev_per_npc, dev_per_line, dev_per_em, 
-                                 o_ntv, size_ntv, size, u->arg1);
+        unit_array_to_npc_helper(result, scratch, dev_per_npc, dev_per_line, 
+                                 dev_per_em, o_ntv, size_ntv, size, u->arg1);
+        unit_array_to_npc_helper(scratch, scratch + size, dev_per_npc, 
+                                 dev_per_line, dev_per_em, o_ntv, size_ntv, 
+                                 size, u->arg2);
 
         for (i = 0; i < size; i++)
-            result[i] = xs[i] - ys[i];
-
-        free(xs);
-        free(ys);
+            result[i] -= scratch[i];
     } else if (strcmp(u->type, "*") == 0) {
-        xs = malloc(size * sizeof(double));
-        unit_array_to_npc_helper(xs, dev_per_npc, dev_per_line, dev_per_em, 
-                                 o_ntv, size_ntv, size, u->arg1);
+        unit_array_to_npc_helper(result, scratch, dev_per_npc, dev_per_line, 
+                                 dev_per_em, o_ntv, size_ntv, size, u->arg1);
 
         for (i = 0; i < size; i++)
-            result[i] = xs[i] * u->values[0];
-
-        free(xs);
+            result[i] *= u->values[0];
     } else if (strcmp(u->type, "/") == 0) {
-        xs = malloc(size * sizeof(double));
-        unit_array_to_npc_helper(xs, dev_per_npc, dev_per_line, dev_per_em, 
-                                 o_ntv, size_ntv, size, u->arg1);
+        unit_array_to_npc_helper(result, scratch, dev_per_npc, dev_per_line, 
+                                 dev_per_em, o_ntv, size_ntv, size, u->arg1);
 
         for (i = 0; i < size; i++)
-            result[i] = xs[i] * u->values[0];
-
-        free(xs);
+            result[i] /= u->values[0];
     } else if (strcmp(u->type, "npc") == 0) {
         for (i = 0; i < size; i++)
             result[i] = u->values[i];
@@ -183,28 +454,29 @@ unit_array_to_npc_helper(double *result, double dev_per_npc,
 
 /**
  * Convert a unit array to a C array of doubles representing NPC values.
+ * `scratch` must hold \ref unit_array_scratch_size doubles.
  */
 static void
-unit_array_to_npc(double *result, grid_context_t *gr, char dim, 
-                  const unit_array_t *u) 
+unit_array_to_npc(double *result, double *scratch, grid_context_t *gr, 
+                  char dim, const unit_array_t *u) 
 {
     grid_viewport_node_t *node = gr->current_node;
     double dev_x_per_npc, dev_y_per_npc;
     dev_x_per_npc = dev_y_per_npc = 1.0;
-    cairo_matrix_transform_distance(node->npc_to_dev, &dev_x_per_npc, 
+    cairo_matrix_transform_distance(&node->npc_to_dev, &dev_x_per_npc, 
                                                       &dev_y_per_npc);
 
     double x_ntv, y_ntv, w_ntv, h_ntv;
     x_ntv = y_ntv = 0.0;
     w_ntv = h_ntv = 1.0;
-    cairo_matrix_transform_point(node->npc_to_ntv, &x_ntv, &y_ntv);
-    cairo_matrix_transform_distance(node->npc_to_ntv, &w_ntv, &h_ntv);
+    cairo_matrix_transform_point(&node->npc_to_ntv, &x_ntv, &y_ntv);
+    cairo_matrix_transform_distance(&node->npc_to_ntv, &w_ntv, &h_ntv);
 
     cairo_font_extents_t font_extents;
-    cairo_font_extents(gr->cr, &font_extents);
+    grid_font_extents(gr, &font_extents);
 
     cairo_text_extents_t em_extents;
-    cairo_text_extents(gr->cr, "m", &em_extents);
+    grid_text_extents(gr, "m", &em_extents);
 
     double dev_per_npc, o_ntv, size_ntv;
     dev_per_npc = o_ntv = size_ntv = 0.0;
@@ -221,9 +493,54 @@ unit_array_to_npc(double *result, grid_context_t *gr, char dim,
         fprintf(stderr, "Warning: unknown dimension '%c'\n", dim);
     }
 
-    unit_array_to_npc_helper(result, dev_per_npc, font_extents.height,
-                             em_extents.width, o_ntv, size_ntv, 
-                             unit_array_size(u), u);
+    int size = unit_array_size(u);
+    GridCount(gr, unit_conversions, size);
+    unit_array_to_npc_helper(result, scratch, dev_per_npc, font_extents.height,
+                             em_extents.width, o_ntv, size_ntv, size, u);
+}
+
+/**
+ * Convert a pair of unit arrays of length `size` to NPC values, held in the
+ * context's scratch buffer.
+ */
+static void
+grid_unit_arrays_to_npc(grid_context_t *gr, const unit_array_t *xs, 
+                        const unit_array_t *ys, int size, 
+                        double **xs_npc, double **ys_npc)
+{
+    size_t x_extra = unit_array_scratch_size(xs, size);
+    size_t y_extra = unit_array_scratch_size(ys, size);
+    double *scratch = grid_scratch(gr, 2 * (size_t)size + 
+                                   (x_extra > y_extra ? x_extra : y_extra));
+
+    *xs_npc = scratch;
+    *ys_npc = scratch + size;
+    unit_array_to_npc(*xs_npc, scratch + 2 * size, gr, 'x', xs);
+    unit_array_to_npc(*ys_npc, scratch + 2 * size, gr, 'y', ys);
+}
+
+//
+// hashing
+//
+
+#define GRID_FNV_OFFSET 14695981039346656037ULL
+#define GRID_FNV_PRIME 1099511628211ULL
+
+static uint64_t
+grid_hash_bytes(uint64_t h, const void *data, size_t n) {
+    const unsigned char *p = data;
+    size_t i;
+    for (i = 0; i < n; i++) {
+        h ^= p[i];
+        h *= GRID_FNV_PRIME;
+    }
+
+    return h;
+}
+
+static uint64_t
+grid_hash_string(uint64_t h, const char *s) {
+    return s ? grid_hash_bytes(h, s, strlen(s) + 1) : grid_hash_bytes(h, "", 0);
 }
 
 //
@@ -236,7 +553,7 @@ unit_array_to_npc(double *result, grid_context_t *gr, char dim,
  */
 rgba_t*
 rgb(double red, double green, double blue) {
-    rgba_t *color = malloc(sizeof(rgba_t));
+    rgba_t *color = grid_malloc(sizeof(rgba_t));
     color->red = red;
     color->green = green;
     color->blue = blue;
@@ -250,7 +567,7 @@ rgb(double red, double green, double blue) {
  */
 rgba_t*
 rgba(double red, double green, double blue, double alpha) {
-    rgba_t *color = malloc(sizeof(rgba_t));
+    rgba_t *color = grid_malloc(sizeof(rgba_t));
     color->red = red;
     color->green = green;
     color->blue = blue;
@@ -260,53 +577,147 @@ rgba(double red, double green, double blue, double alpha) {
 }
 
 /**
- * Allocate a new parameter struct with parameters set to default values.
+ * Pack a color as `0xAARRGGBB`. Channels are clamped to [0, 1] and kept to 8
+ * bits, the precision of the ARGB32 surfaces contexts draw to.
  */
-grid_par_t*
-new_grid_default_par(void) {
-    grid_par_t *par = malloc(sizeof(grid_par_t));
+uint32_t
+grid_pack_color(const rgba_t *color) {
+    double channels[4] = { color->alpha, color->red, color->green, color->blue };
+    uint32_t packed = 0;
+    int i;
+    for (i = 0; i < 4; i++) {
+        double c = channels[i] > 0 ? (channels[i] < 1 ? channels[i] : 1) : 0;
+        packed = packed << 8 | (uint32_t)(255 * c + 0.5);
+    }
+    return packed;
+}
 
-    par->color = rgba(0, 0, 0, 1);
-    par->fill = NULL;
+//
+// parameter structs
+//
 
-    char *line_type = "solid";
-    par->line_type = malloc(strlen(line_type) + 1);
-    strcpy(par->line_type, line_type);
+// A context allocates its default parameters through its own allocator, and
+// other parameter structs are allocated through the allocator in effect; the
+// helpers below take the context, or `NULL` for the allocator in effect.
 
-    char *point_type = "round";
-    par->point_type = malloc(strlen(point_type) + 1);
-    strcpy(par->point_type, point_type);
+static void*
+grid_par_malloc(grid_context_t *gr, size_t size) {
+    return gr ? grid_context_malloc(gr, size) : grid_malloc(size);
+}
+
+static void
+grid_par_free(grid_context_t *gr, void *ptr, size_t size) {
+    if (gr)
+        grid_context_free(gr, ptr, size);
+    else
+        grid_free(ptr, size);
+}
 
-    char *just = "center";
-    par->just = malloc(strlen(just) + 1);
-    strcpy(par->just, just);
+static char*
+grid_par_strdup(grid_context_t *gr, const char *s) {
+    size_t len = strlen(s) + 1;
+    return memcpy(grid_par_malloc(gr, len), s, len);
+}
 
-    char *vjust = "top";
-    par->vjust = malloc(strlen(vjust) + 1);
-    strcpy(par->vjust, vjust);
+static void
+grid_par_free_string(grid_context_t *gr, char *s) {
+    if (s)
+        grid_par_free(gr, s, strlen(s) + 1);
+}
 
-    par->line_width = unit(2, "px");
-    par->point_size = unit(4, "px");
-    par->font_size = unit(20, "px");
+static unit_t*
+grid_par_unit(grid_context_t *gr, double value, const char *type) {
+    unit_t *u = grid_par_malloc(gr, sizeof(unit_t));
+    *u = (unit_t){ .value = value, .type = grid_par_strdup(gr, type) };
+    return u;
+}
 
-    return par;
+static void
+grid_par_free_unit(grid_context_t *gr, unit_t *u) {
+    if (!u)
+        return;
+
+    grid_par_free_unit(gr, u->arg1);
+    grid_par_free_unit(gr, u->arg2);
+    grid_par_free_string(gr, u->type);
+    grid_par_free(gr, u, sizeof(unit_t));
+}
+
+static bool*
+grid_par_flag(grid_context_t *gr, bool value) {
+    bool *flag = grid_par_malloc(gr, sizeof(bool));
+    *flag = value;
+    return flag;
 }
 
 /**
- * Deallocate a parameter struct.
+ * Allocate a parameter struct set to the defaults, with its fields, through
+ * the allocator of `gr`, or through the allocator in effect if `gr` is
+ * `NULL`.
  */
-void
-free_grid_par(grid_par_t *par) {
-    if (par->color)
-        free(par->color);
+static grid_par_t*
+grid_new_default_par(grid_context_t *gr) {
+    grid_par_t *par = grid_par_malloc(gr, sizeof(grid_par_t));
 
-    if (par->line_type)
-        free(par->line_type);
+    par->color = grid_par_malloc(gr, sizeof(rgba_t));
+    *par->color = (rgba_t){ 0, 0, 0, 1 };
+    par->fill = NULL;
 
-    if (par->line_width)
-        free(par->line_width);
+    par->line_type = grid_par_strdup(gr, "solid");
+    par->point_type = grid_par_strdup(gr, "round");
+    par->just = grid_par_strdup(gr, "center");
+    par->vjust = grid_par_strdup(gr, "top");
+
+    par->line_width = grid_par_unit(gr, 2, "px");
+    par->point_size = grid_par_unit(gr, 4, "px");
+    par->font_size = grid_par_unit(gr, 20, "px");
+
+    par->antialias = grid_par_strdup(gr, "default");
+    par->hairline = grid_par_flag(gr, false);
+    par->fast_lines = grid_par_flag(gr, false);
+
+    return par;
+}
+
+/**
+ * Deallocate a parameter struct and its fields through the allocator they
+ * were allocated through, as for \ref grid_new_default_par.
+ */
+static void
+grid_free_par(grid_context_t *gr, grid_par_t *par) {
+    grid_par_free(gr, par->color, sizeof(rgba_t));
+    grid_par_free(gr, par->fill, sizeof(rgba_t));
+    grid_par_free_string(gr, par->line_type);
+    grid_par_free_string(gr, par->point_type);
+    grid_par_free_string(gr, par->just);
+    grid_par_free_string(gr, par->vjust);
+    grid_par_free_unit(gr, par->line_width);
+    grid_par_free_unit(gr, par->point_size);
+    grid_par_free_unit(gr, par->font_size);
+    grid_par_free_string(gr, par->antialias);
+    grid_par_free(gr, par->hairline, sizeof(bool));
+    grid_par_free(gr, par->fast_lines, sizeof(bool));
+    grid_par_free(gr, par, sizeof(grid_par_t));
+}
+
+/**
+ * Allocate a new parameter struct with parameters set to default values. The
+ * struct owns its fields; see \ref free_grid_par.
+ */
+grid_par_t*
+new_grid_default_par(void) {
+    return grid_new_default_par(NULL);
+}
 
-    free(par);
+/**
+ * Deallocate a parameter struct and all of its fields, which must have been
+ * allocated with \ref rgba, \ref grid_strdup, \ref unit, and so on, as
+ * \ref new_grid_default_par allocates them. Structs whose fields point at
+ * literals or stack values aren't freed; they are usually on the stack too.
+ */
+void
+free_grid_par(grid_par_t *par) {
+    grid_free_par(NULL, par);
 }
 
 //
@@ -320,11 +731,12 @@ free_grid_par(grid_par_t *par) {
  * \param y The y coordinate of the center of the new viewport.
  * \param width The width of the new viewport.
  * \param height The height of the new viewport.
- * \return A pointer to the newly allocated \ref grid_viewport_t.
+ * \return A pointer to the newly allocated \ref grid_viewport_t, which takes
+ *   ownership of the units.
  */
 grid_viewport_t*
 new_grid_viewport(unit_t *x, unit_t *y, unit_t *width, unit_t *height) {
-    grid_viewport_t *vp = malloc(sizeof(grid_viewport_t));
+    grid_viewport_t *vp = grid_malloc(sizeof(grid_viewport_t));
     vp->x = x;
     vp->y = y;
     vp->w = width;
@@ -348,44 +760,34 @@ new_grid_default_viewport() {
 }
 
 /**
- * Allocate a new \ref grid_viewport_t whose native coordinate system is
- * calculated from the given data.
+ * Allocate a new \ref grid_viewport_t whose native coordinate system covers
+ * the given ranges, padded by \ref grid_range_pad. Ranges accumulated from
+ * several series give a viewport that fits all of them.
  */
 grid_viewport_t*
-new_grid_data_viewport(int data_size, const double *xs, const double *ys) {
+new_grid_range_viewport(const grid_range_t *x, const grid_range_t *y) {
     grid_viewport_t *vp = new_grid_default_viewport();
     vp->has_ntv = true;
+    grid_range_pad(x, &vp->x_ntv, &vp->w_ntv);
+    grid_range_pad(y, &vp->y_ntv, &vp->h_ntv);
 
-    if (data_size > 0) {
-        double min, max, pad;
-        min = max = xs[0];
-
-        int i;
-        for (i = 1; i < data_size; i++) {
-            if (xs[i] > max)
-                max = xs[i];
-            else if (xs[i] < min)
-                min = xs[i];
-        }
-
-        pad = 0.1 * (max - min) / 1.8;
-        vp->x_ntv = min - pad;
-        vp->w_ntv = max - min + 2 * pad;
-
-        min = max = ys[0];
-        for (i = 1; i < data_size; i++) {
-            if (ys[i] > max)
-                max = ys[i];
-            else if (ys[i] < min)
-                min = ys[i];
-        }
+    return vp;
+}
 
-        pad = 0.1 * (max - min) / 1.8;
-        vp->y_ntv = min - pad;
-        vp->h_ntv = max - min + 2 * pad;
-    }
+/**
+ * Allocate a new \ref grid_viewport_t whose native coordinate system is
+ * calculated from the given data. `NaN` and infinite values are ignored;
+ * large arrays are scanned in parallel.
+ */
+grid_viewport_t*
+new_grid_data_viewport(int data_size, const double *xs, const double *ys) {
+    grid_range_t x, y;
+    grid_range_init(&x);
+    grid_range_init(&y);
+    grid_range_add_array_parallel(&x, data_size, xs, 0);
+    grid_range_add_array_parallel(&y, data_size, ys, 0);
 
-    return vp;
+    return new_grid_range_viewport(&x, &y);
 }
 
 /**
@@ -410,7 +812,7 @@ new_grid_plot_viewport(grid_context_t *gr,
 }
 
 /**
- * Deallocate a \ref grid_viewport_t.
+ * Deallocate a \ref grid_viewport_t and its units.
  *
  * \param vp A viewport.
  */
@@ -425,102 +827,506 @@ free_grid_viewport(grid_viewport_t *vp) {
     if (vp->h)
         free_unit(vp->h);
 
-    free(vp);
+    grid_free(vp, sizeof(grid_viewport_t));
 }
 
 /**
- * Allocate a new \ref grid_viewport_node_t.
+ * Number of nodes in the first block allocated by a context. Each further
+ * block is twice as large as the previous one, up to
+ * \ref GRID_NODE_BLOCK_MAX.
+ */
+#define GRID_NODE_BLOCK_MIN 16
+#define GRID_NODE_BLOCK_MAX 4096
+
+/**
+ * A contiguous block of viewport nodes owned by a grid context.
+ */
+struct __grid_node_block_t {
+    struct __grid_node_block_t *next;
+    int size;
+    grid_viewport_node_t nodes[];
+};
+
+/**
+ * Take a \ref grid_viewport_node_t from the context's node pool. Nodes live in
+ * contiguous blocks owned by the context, so their addresses are stable and
+ * pushing a viewport doesn't allocate once the pool has warmed up.
  */
 static grid_viewport_node_t*
-new_grid_viewport_node(void) {
-    grid_viewport_node_t *node = malloc(sizeof(grid_viewport_node_t));
+new_grid_viewport_node(grid_context_t *gr) {
+    if (!gr->free_nodes) {
+        int size = gr->node_blocks ? 2 * gr->node_blocks->size : GRID_NODE_BLOCK_MIN;
+        if (size > GRID_NODE_BLOCK_MAX)
+            size = GRID_NODE_BLOCK_MAX;
+
+        struct __grid_node_block_t *block = 
+            grid_context_malloc(gr, sizeof(struct __grid_node_block_t) + 
+                                    size * sizeof(grid_viewport_node_t));
+        block->size = size;
+        block->next = gr->node_blocks;
+        gr->node_blocks = block;
+
+        // thread the block onto the free list in address order
+        int i;
+        for (i = 0; i < size; i++)
+            block->nodes[i].parent = i + 1 < size ? block->nodes + i + 1 : NULL;
+        gr->free_nodes = block->nodes;
+    }
+
+    grid_viewport_node_t *node = gr->free_nodes;
+    gr->free_nodes = node->parent;
+
     node->parent = node->gege = node->didi = node->child = NULL;
+    node->next_named = NULL;
     node->name = NULL;
-    node->npc_to_dev = malloc(sizeof(cairo_matrix_t));
-    node->npc_to_ntv = malloc(sizeof(cairo_matrix_t));
     node->par = NULL;
+    node->rest_x = node->rest_y = (compiled_unit_t){ 0 };
+    node->depth = 0;
+    node->seq = 0;
 
-    cairo_matrix_init_identity(node->npc_to_ntv);
-    cairo_matrix_init_identity(node->npc_to_dev);
+    cairo_matrix_init_identity(&node->npc_to_ntv);
+    cairo_matrix_init_identity(&node->npc_to_dev);
 
     return node;
 }
 
 /**
- * Deallocate a \ref grid_viewport_node_t.
+ * Copy `name` into a node, using the node's inline buffer when it fits.
  */
 static void
-free_grid_viewport_node(grid_viewport_node_t *node) {
-    if (node->npc_to_ntv)
-        free(node->npc_to_ntv);
-    if (node->npc_to_dev)
-        free(node->npc_to_dev);
-    if (node->name)
-        free(node->name);
-    if (node->par)
-        free(node->par);
-
-    free(node);
+grid_set_node_name(grid_context_t *gr, grid_viewport_node_t *node, 
+                   const char *name)
+{
+    size_t len = strlen(name) + 1;
+    node->name = len <= sizeof(node->name_buf) ? node->name_buf 
+                                               : grid_context_malloc(gr, len);
+    memcpy(node->name, name, len);
 }
 
-void
-grid_push_named_viewport(grid_context_t *gr, 
-                         const char *name, const grid_viewport_t *vp)
-{
-    double x = unit_to_npc(gr, 'x', vp->x);
-    double y = unit_to_npc(gr, 'y', vp->y);
-    double w = unit_to_npc(gr, 'x', vp->w);
-    double h = unit_to_npc(gr, 'y', vp->h);
+/**
+ * Release the resources a node holds outside the node pool.
+ */
+static void
+grid_clear_viewport_node(grid_context_t *gr, grid_viewport_node_t *node) {
+    if (node->name && node->name != node->name_buf)
+        grid_context_free(gr, node->name, strlen(node->name) + 1);
+    grid_context_free(gr, node->par, sizeof(grid_par_t));
 
-    cairo_matrix_t vp_mtx, temp_mtx;
-    cairo_matrix_init(&vp_mtx, w, 0, 0, h, x, y);
-    cairo_matrix_init(&temp_mtx, w, 0, 0, h, x, y);
-    cairo_status_t status = cairo_matrix_invert(&temp_mtx);
+    node->name = NULL;
+    node->par = NULL;
+}
 
-    if (status == CAIRO_STATUS_SUCCESS) {
-        grid_viewport_node_t *node = new_grid_viewport_node();
-        cairo_matrix_multiply(node->npc_to_dev, &vp_mtx, gr->current_node->npc_to_dev);
+/**
+ * Hash bucket of a viewport name in the context's name index.
+ */
+static int
+grid_name_bucket(const grid_context_t *gr, const char *name) {
+    return grid_hash_string(GRID_FNV_OFFSET, name) % gr->name_index_size;
+}
 
-        if (vp->has_ntv) {
-            cairo_matrix_init(node->npc_to_ntv, vp->w_ntv, 0, 0, vp->h_ntv, 
-                                                vp->x_ntv, vp->y_ntv);
-        } else {
-            // inherit native coordinates from parent
-            cairo_matrix_multiply(node->npc_to_ntv, 
-                                  &vp_mtx, gr->current_node->npc_to_ntv);
-        }
+/**
+ * Add a named node to the context's name index, growing the index when the
+ * load factor exceeds one.
+ */
+static void
+grid_index_viewport_node(grid_context_t *gr, grid_viewport_node_t *node) {
+    if (gr->name_count >= gr->name_index_size) {
+        int old_size = gr->name_index_size;
+        grid_viewport_node_t **old = gr->name_index;
 
-        if (name) {
-            node->name = malloc(strlen(name) + 1);
-            strcpy(node->name, name);
-        }
+        gr->name_index_size = 2 * old_size;
+        gr->name_index = grid_context_calloc(gr, gr->name_index_size, 
+                                             sizeof(grid_viewport_node_t*));
 
-        if (gr->current_node->child) {
-            gr->current_node->child->didi = node;
-            node->gege = gr->current_node->child;
+        int i;
+        grid_viewport_node_t *this, *next;
+        for (i = 0; i < old_size; i++) {
+            for (this = old[i]; this; this = next) {
+                next = this->next_named;
+                int b = grid_name_bucket(gr, this->name);
+                this->next_named = gr->name_index[b];
+                gr->name_index[b] = this;
+            }
         }
 
-        gr->current_node->child = node;
-        node->parent = gr->current_node;
-        gr->current_node = node;
-    } else {
-        fprintf(stderr, "Warning: can't create singular viewport\n");
+        grid_context_free(gr, old, old_size * sizeof(grid_viewport_node_t*));
     }
+
+    int b = grid_name_bucket(gr, node->name);
+    node->next_named = gr->name_index[b];
+    gr->name_index[b] = node;
+    gr->name_count++;
 }
 
 /**
- * Push a viewport onto the tree. The viewport becomes a leaf of the current
- * viewport and becomes the new current viewport. This function acts
- * destructively on `vp->x`, `vp->y`, `vp->w`, and `vp->h`.
+ * Remove a named node from the context's name index.
  */
-void
-grid_push_viewport(grid_context_t *gr, const grid_viewport_t *vp) {
-    grid_push_named_viewport(gr, NULL, vp);
+static void
+grid_unindex_viewport_node(grid_context_t *gr, grid_viewport_node_t *node) {
+    grid_viewport_node_t **link = gr->name_index + grid_name_bucket(gr, node->name);
+
+    while (*link) {
+        if (*link == node) {
+            *link = node->next_named;
+            node->next_named = NULL;
+            gr->name_count--;
+            return;
+        }
+
+        link = &(*link)->next_named;
+    }
 }
 
 /**
- * Pop and deallocate the current viewport node from the tree; its parent
- * becomes the new current viewport.
+ * Test whether `a` comes before `b` in a depth-first search of the viewport
+ * tree. The search visits a node before its descendants and visits younger
+ * siblings before older ones.
+ */
+static bool
+grid_dfs_precedes(const grid_viewport_node_t *a, const grid_viewport_node_t *b) {
+    while (a->depth > b->depth) {
+        a = a->parent;
+        if (a == b)
+            return false;
+    }
+
+    while (b->depth > a->depth) {
+        b = b->parent;
+        if (a == b)
+            return true;
+    }
+
+    while (a->parent != b->parent) {
+        a = a->parent;
+        b = b->parent;
+    }
+
+    return a->seq > b->seq;
+}
+
+/**
+ * Find the first viewport named `name`, in depth-first order, among `start`
+ * and its descendants. This gives the same result as a depth-first search but
+ * only examines nodes with a matching hash.
+ *
+ * \return The matching node, or `NULL` if there is none.
+ */
+static grid_viewport_node_t*
+grid_find_viewport(grid_context_t *gr, grid_viewport_node_t *start,
+                   const char *name)
+{
+    grid_viewport_node_t *this, *up, *best = NULL;
+
+    for (this = gr->name_index[grid_name_bucket(gr, name)]; this;
+         this = this->next_named)
+    {
+        if (strcmp(this->name, name) != 0 || this->depth < start->depth)
+            continue;
+
+        for (up = this; up->depth > start->depth; up = up->parent)
+            ;
+
+        if (up == start && (!best || grid_dfs_precedes(this, best)))
+            best = this;
+    }
+
+    return best;
+}
+
+/**
+ * Return a node to the context's free list, releasing its name and
+ * parameters.
+ */
+static void
+grid_release_viewport_node(grid_context_t *gr, grid_viewport_node_t *node) {
+    if (node->name)
+        grid_unindex_viewport_node(gr, node);
+
+    grid_clear_viewport_node(gr, node);
+    gr->tree_generation++;
+    node->gege = node->didi = node->child = NULL;
+
+    node->parent = gr->free_nodes;
+    gr->free_nodes = node;
+}
+
+/**
+ * Recursively return a viewport subtree and the older siblings of its root to
+ * the context's free list.
+ */
+static void
+grid_release_viewport_tree(grid_context_t *gr, grid_viewport_node_t *root) {
+    if (root->gege)
+        grid_release_viewport_tree(gr, root->gege);
+
+    if (root->child)
+        grid_release_viewport_tree(gr, root->child);
+
+    grid_release_viewport_node(gr, root);
+}
+
+/**
+ * Detach a node from its parent and siblings. The node keeps its own children.
+ */
+static void
+grid_unlink_viewport_node(grid_viewport_node_t *node) {
+    if (node->didi)
+        node->didi->gege = node->gege;
+    else if (node->parent)
+        node->parent->child = node->gege;
+
+    if (node->gege)
+        node->gege->didi = node->didi;
+
+    node->gege = node->didi = NULL;
+}
+
+/**
+ * Evaluate a compiled unit as an NPC value. The arguments are as for
+ * `unit_to_npc_helper`.
+ */
+static double
+compiled_unit_to_npc(const compiled_unit_t *c, double dev_per_npc, 
+                     double dev_per_line, double dev_per_em,
+                     double o_ntv, double size_ntv)
+{
+    return c->npc + (c->px + c->lines * dev_per_line + c->em * dev_per_em) / 
+                    dev_per_npc +
+           (c->native - c->native_weight * o_ntv) / size_ntv;
+}
+
+/**
+ * Scale factors from a node's NPC to device space along each axis.
+ */
+static void
+grid_dev_per_npc(const grid_viewport_node_t *node, double *x, double *y) {
+    *x = *y = 1.0;
+    cairo_matrix_transform_distance(&node->npc_to_dev, x, y);
+}
+
+/**
+ * Origin and size of a node's native coordinates.
+ */
+static void
+grid_node_ntv(const grid_viewport_node_t *node, 
+              double *x, double *y, double *w, double *h)
+{
+    *x = *y = 0.0;
+    *w = *h = 1.0;
+    cairo_matrix_transform_point(&node->npc_to_ntv, x, y);
+    cairo_matrix_transform_distance(&node->npc_to_ntv, w, h);
+}
+
+/**
+ * Set a node's transforms from its rectangle in its parent's NPC.
+ *
+ * \return `false` if the node would be singular.
+ */
+static bool
+grid_place_viewport_node(grid_viewport_node_t *node, 
+                         const grid_viewport_node_t *parent,
+                         double x, double y, double w, double h)
+{
+    cairo_matrix_t vp_mtx, temp_mtx;
+    cairo_matrix_init(&vp_mtx, w, 0, 0, h, x, y);
+    temp_mtx = vp_mtx;
+    if (cairo_matrix_invert(&temp_mtx) != CAIRO_STATUS_SUCCESS)
+        return false;
+
+    cairo_matrix_multiply(&node->npc_to_dev, &vp_mtx, &parent->npc_to_dev);
+
+    if (node->has_ntv) {
+        cairo_matrix_init(&node->npc_to_ntv, node->w_ntv, 0, 0, node->h_ntv, 
+                                             node->x_ntv, node->y_ntv);
+    } else {
+        // inherit native coordinates from parent
+        cairo_matrix_multiply(&node->npc_to_ntv, &vp_mtx, &parent->npc_to_ntv);
+    }
+
+    return true;
+}
+
+/**
+ * Compute a node's transforms from its compiled geometry and its parent's
+ * transforms.
+ *
+ * \return `false` if the node would be singular.
+ */
+static bool
+grid_layout_viewport_node(grid_viewport_node_t *node, 
+                          const grid_viewport_node_t *parent)
+{
+    double dev_x_per_npc, dev_y_per_npc;
+    grid_dev_per_npc(parent, &dev_x_per_npc, &dev_y_per_npc);
+
+    double x_ntv, y_ntv, w_ntv, h_ntv;
+    grid_node_ntv(parent, &x_ntv, &y_ntv, &w_ntv, &h_ntv);
+
+    double x = compiled_unit_to_npc(&node->x, dev_x_per_npc, node->dev_per_line,
+                                    node->dev_per_em, x_ntv, w_ntv);
+    double y = compiled_unit_to_npc(&node->y, dev_y_per_npc, node->dev_per_line,
+                                    node->dev_per_em, y_ntv, h_ntv);
+    double w = compiled_unit_to_npc(&node->w, dev_x_per_npc, node->dev_per_line,
+                                    node->dev_per_em, 0, w_ntv);
+    double h = compiled_unit_to_npc(&node->h, dev_y_per_npc, node->dev_per_line,
+                                    node->dev_per_em, 0, h_ntv);
+
+    // a layout's null units get no space where its fixed ones overflow it
+    double rest_x = compiled_unit_to_npc(&node->rest_x, dev_x_per_npc, 
+                                         node->dev_per_line, node->dev_per_em,
+                                         0, w_ntv);
+    double rest_y = compiled_unit_to_npc(&node->rest_y, dev_y_per_npc, 
+                                         node->dev_per_line, node->dev_per_em,
+                                         0, h_ntv);
+    if (rest_x < 0) {
+        x -= node->x.null * rest_x;
+        w -= node->w.null * rest_x;
+    }
+    if (rest_y < 0) {
+        y -= node->y.null * rest_y;
+        h -= node->h.null * rest_y;
+    }
+
+    return grid_place_viewport_node(node, parent, x, y, w, h);
+}
+
+/**
+ * Bring a node's transforms up to date with the context's layout generation,
+ * updating its ancestors first. Nodes are laid out again only when they are
+ * visited after the context is resized.
+ */
+static void
+grid_update_viewport_node(grid_context_t *gr, grid_viewport_node_t *node) {
+    if (node->layout_generation == gr->layout_generation)
+        return;
+
+    grid_update_viewport_node(gr, node->parent);
+
+    if (!grid_layout_viewport_node(node, node->parent))
+        fprintf(stderr, "Warning: viewport '%s' is singular at this size\n",
+                node->name ? node->name : "");
+
+    node->layout_generation = gr->layout_generation;
+}
+
+/**
+ * Make `node` the current viewport, laying it out if necessary.
+ */
+static void
+grid_set_current_node(grid_context_t *gr, grid_viewport_node_t *node) {
+    grid_update_viewport_node(gr, node);
+    gr->current_node = node;
+}
+
+/**
+ * Record the current font's line height and em width with a node, for
+ * evaluating its units in lines and ems.
+ */
+static void
+grid_set_node_font_metrics(grid_context_t *gr, grid_viewport_node_t *node) {
+    cairo_font_extents_t font_extents;
+    grid_font_extents(gr, &font_extents);
+    cairo_text_extents_t em_extents;
+    grid_text_extents(gr, "m", &em_extents);
+    node->dev_per_line = font_extents.height;
+    node->dev_per_em = em_extents.width;
+}
+
+/**
+ * Make a laid out node the youngest child of the current viewport, and the
+ * new current viewport.
+ */
+static void
+grid_link_viewport_node(grid_context_t *gr, const char *name, 
+                        grid_viewport_node_t *node)
+{
+    grid_viewport_node_t *parent = gr->current_node;
+    node->layout_generation = gr->layout_generation;
+
+    if (parent->child) {
+        parent->child->didi = node;
+        node->gege = parent->child;
+    }
+
+    parent->child = node;
+    node->parent = parent;
+    node->depth = parent->depth + 1;
+    node->seq = gr->node_seq++;
+    gr->tree_generation++;
+    gr->current_node = node;
+
+    if (name) {
+        grid_set_node_name(gr, node, name);
+        grid_index_viewport_node(gr, node);
+    }
+}
+
+/**
+ * Push a named viewport onto the tree. The viewport's units are compiled and
+ * kept with the new node, which lets \ref grid_context_resize lay the tree out
+ * again; `vp` is not referenced after the call. Units measured in lines or ems
+ * use the font in effect when the viewport is pushed.
+ */
+void
+grid_push_named_viewport(grid_context_t *gr, 
+                         const char *name, const grid_viewport_t *vp)
+{
+    grid_trace_begin_node(gr, "grid_push_viewport");
+    grid_viewport_node_t *node = new_grid_viewport_node(gr);
+
+    unit_compile(vp->x, &node->x);
+    unit_compile(vp->y, &node->y);
+    unit_compile(vp->w, &node->w);
+    unit_compile(vp->h, &node->h);
+
+    node->has_ntv = vp->has_ntv;
+    node->x_ntv = vp->x_ntv;
+    node->y_ntv = vp->y_ntv;
+    node->w_ntv = vp->w_ntv;
+    node->h_ntv = vp->h_ntv;
+
+    grid_set_node_font_metrics(gr, node);
+
+    if (!grid_layout_viewport_node(node, gr->current_node)) {
+        fprintf(stderr, "Warning: can't create singular viewport\n");
+        node->parent = gr->free_nodes;
+        gr->free_nodes = node;
+        grid_trace_end_node(gr);
+        return;
+    }
+
+    grid_link_viewport_node(gr, name, node);
+    grid_trace_end_pushed(gr);
+}
+
+/**
+ * Push a viewport onto the tree. The viewport becomes a leaf of the current
+ * viewport and becomes the new current viewport. `vp` is borrowed; see
+ * \ref grid_push_named_viewport.
+ */
+void
+grid_push_viewport(grid_context_t *gr, const grid_viewport_t *vp) {
+    grid_push_named_viewport(gr, NULL, vp);
+}
+
+/**
+ * Push a viewport onto the tree and free it, which suits a viewport
+ * constructed in the call:
+ *
+ *     grid_push_new_viewport(gr, new_grid_plot_viewport(gr, 4, 1, 3, 3));
+ *
+ * See \ref grid_push_viewport.
+ */
+void
+grid_push_new_viewport(grid_context_t *gr, grid_viewport_t *vp) {
+    grid_push_named_viewport(gr, NULL, vp);
+    free_grid_viewport(vp);
+}
+
+/**
+ * Pop and deallocate the current viewport node, along with any viewports
+ * beneath it, from the tree; its parent becomes the new current viewport.
+ * Released nodes are kept on the context's free list for reuse.
  *
  * \return True if successful, false otherwise.
  */
@@ -530,22 +1336,17 @@ grid_pop_viewport_1(grid_context_t *gr) {
         fprintf(stderr, "Warning: attempted to pop root viewport from the stack.\n");
         return false;
     } else {
+        grid_trace_begin_node(gr, "grid_pop_viewport");
         grid_viewport_node_t *node = gr->current_node;
-        gr->current_node = node->parent;
-
-        if (node->gege) {
-            if (node->didi) {
-                node->didi->gege = node->gege;
-                node->gege->didi = node->didi;
-                node->didi = node->gege = NULL;
-            } else {
-                node->parent->child = node->gege;
-                node->gege->didi = NULL;
-                node->gege = NULL;
-            }
-        }
+        grid_set_current_node(gr, node->parent);
+
+        grid_unlink_viewport_node(node);
 
-        free_grid_viewport_node(node);
+        if (node->child)
+            grid_release_viewport_tree(gr, node->child);
+
+        grid_release_viewport_node(gr, node);
+        grid_trace_end_node(gr);
         return true;
     }
 }
@@ -585,7 +1386,7 @@ grid_up_viewport_1(grid_context_t *gr) {
         return false;
     }
 
-    gr->current_node = gr->current_node->parent;
+    grid_set_current_node(gr, gr->current_node->parent);
     return true;
 }
 
@@ -608,588 +1409,2292 @@ grid_up_viewport(grid_context_t *gr, int n) {
 }
 
 /**
- * Perform a depth first search for a viewport with the given name. `*plevel`
- * is incremented each time the algorithm recurses on a child viewport and is
- * set to -1 if no matching viewport is found. `path` is a list of nodes
- * traversed to find the target. If the return value is NULL, then the value of
- * `*path` is undefined and `*plevel` is set to -1.
+ * Separator between viewport names in a viewport path, as in R's grid.
+ */
+#define GRID_PATH_SEP "::"
+#define GRID_PATH_SEP_LEN 2
+
+/**
+ * Number of entries in a context's path cache, and the longest path that is
+ * cached.
+ */
+#define GRID_PATH_CACHE_SIZE 64
+#define GRID_PATH_CACHE_MAX_LEN 64
+
+/**
+ * A resolved viewport path. Entries are valid while the tree generation they
+ * were resolved in is current.
+ */
+struct __grid_path_cache_entry_t {
+    const grid_viewport_node_t *start;
+    grid_viewport_node_t *node;
+    unsigned long generation;
+    char path[GRID_PATH_CACHE_MAX_LEN];
+};
+
+/**
+ * Test whether `node` is named by the `len` characters at `name`.
+ */
+static bool
+grid_node_name_equals(const grid_viewport_node_t *node, const char *name, size_t len) {
+    return node->name && strncmp(node->name, name, len) == 0 && 
+           node->name[len] == '\0';
+}
+
+/**
+ * Find the first viewport, in depth-first order, among `start` and its
+ * descendants that matches the viewport path `path`. A path such as
+ * "row3::col5::plot" matches a viewport named "plot" whose parent is named
+ * "col5" and whose grandparent is named "row3"; the first component may be
+ * `start` itself or any of its descendants.
  */
 static grid_viewport_node_t*
-grid_viewport_dfs(grid_viewport_node_t *this, const char *name, int *plevel) 
+grid_find_viewport_path(grid_context_t *gr, grid_viewport_node_t *start,
+                        const char *path)
 {
-    if (this->name && strcmp(this->name, name) == 0) {
-        return this;
-    }
-    
-    grid_viewport_node_t *node;
-    grid_viewport_node_t *this_child = this->child;
-    int temp_level;
+    const char *last = path, *sep;
+    while ((sep = strstr(last, GRID_PATH_SEP)))
+        last = sep + GRID_PATH_SEP_LEN;
 
-    while (this_child != NULL) {
-        temp_level = *plevel + 1;
-        node = grid_viewport_dfs(this_child, name, &temp_level);
+    grid_viewport_node_t *this, *up, *best = NULL;
 
-        if (node) {
-            *plevel = temp_level;
-            return node;
-        } else {
-            this_child = this_child->gege;
+    for (this = gr->name_index[grid_name_bucket(gr, last)]; this;
+         this = this->next_named)
+    {
+        if (strcmp(this->name, last) != 0 || this->depth < start->depth)
+            continue;
+
+        // match the remaining components against the ancestors, right to left
+        const char *begin = last, *end;
+        up = this;
+        bool match = true;
+
+        while (match && begin > path) {
+            end = begin - GRID_PATH_SEP_LEN;
+            for (begin = end; begin - path >= GRID_PATH_SEP_LEN && 
+                 strncmp(begin - GRID_PATH_SEP_LEN, GRID_PATH_SEP, GRID_PATH_SEP_LEN) != 0;
+                 begin--)
+                ;
+            if (begin - path < GRID_PATH_SEP_LEN)
+                begin = path;
+
+            up = up->parent;
+            match = up && up->depth >= start->depth &&
+                    grid_node_name_equals(up, begin, end - begin);
         }
+
+        if (!match)
+            continue;
+
+        while (up->depth > start->depth)
+            up = up->parent;
+
+        if (up == start && (!best || grid_dfs_precedes(this, best)))
+            best = this;
     }
 
-    *plevel = -1;
-    return NULL;
+    return best;
+}
+
+/**
+ * Resolve a viewport name or path relative to `start`. Resolved paths are
+ * cached until the viewport tree next changes, so repeated navigation to the
+ * same path takes constant time.
+ */
+static grid_viewport_node_t*
+grid_resolve_viewport(grid_context_t *gr, grid_viewport_node_t *start,
+                      const char *name)
+{
+    if (!strstr(name, GRID_PATH_SEP))
+        return grid_find_viewport(gr, start, name);
+
+    size_t len = strlen(name);
+    if (len >= GRID_PATH_CACHE_MAX_LEN)
+        return grid_find_viewport_path(gr, start, name);
+
+    uint64_t h = grid_hash_bytes(GRID_FNV_OFFSET, &start, sizeof(start));
+    h = grid_hash_string(h, name);
+    struct __grid_path_cache_entry_t *entry = 
+        gr->path_cache + h % GRID_PATH_CACHE_SIZE;
+
+    if (entry->generation == gr->tree_generation && entry->start == start &&
+        strcmp(entry->path, name) == 0)
+        return entry->node;
+
+    entry->start = start;
+    entry->node = grid_find_viewport_path(gr, start, name);
+    entry->generation = gr->tree_generation;
+    memcpy(entry->path, name, len + 1);
+
+    return entry->node;
 }
 
 /**
  * Move down the tree to the viewport with the given name. Prints a warning if
  * no viewport is found. If the name matches the name of the current node, then
- * the current viewport doesn't change.
+ * the current viewport doesn't change. `name` may also be a viewport path such
+ * as "row3::col5::plot", which names a chain of nested viewports.
  *
  * \return The number of levels traversed, -1 if no viewport found.
  */
 int
 grid_down_viewport(grid_context_t *gr, const char *name) {
-    int n = 0;
-    grid_viewport_node_t *node = grid_viewport_dfs(gr->current_node, name, &n);
+    grid_viewport_node_t *node = grid_resolve_viewport(gr, gr->current_node, name);
 
-    if (node)
-        gr->current_node = node;
-    else
+    if (!node) {
         fprintf(stderr, "Warning: didn't find viewport with name '%s'\n", name);
+        return -1;
+    }
 
+    int n = node->depth - gr->current_node->depth;
+    grid_set_current_node(gr, node);
     return n;
 }
 
 /**
- * Perform a depth-first search for a viewport named `name` in the viewport
- * tree, starting from the root.  Prints a warning if no viewport is found.
+ * Find the first viewport named `name` in a depth-first search of the viewport
+ * tree, starting from the root. The search is answered from the context's
+ * name index. `name` may also be a viewport path, see
+ * \ref grid_down_viewport. Prints a warning if no viewport is found.
  *
  * \return The new level in the viewport tree, -1 if no viewport found.
  */
 int
 grid_seek_viewport(grid_context_t *gr, const char *name) {
-    int level = 0;
-    grid_viewport_node_t *node = grid_viewport_dfs(gr->root_node, name, &level);
+    grid_viewport_node_t *node = grid_resolve_viewport(gr, gr->root_node, name);
 
-    if (node)
-        gr->current_node = node;
-    else
+    if (!node) {
         fprintf(stderr, "Warning: didn't find viewport with name '%s'\n", name);
+        return -1;
+    }
 
-    return level;
+    grid_set_current_node(gr, node);
+    return node->depth;
 }
 
 //
-// draw functions
+// layouts
 //
 
-static void
-grid_apply_color(grid_context_t *gr, const rgba_t *color) {
-    cairo_set_source_rgba(gr->cr, color->red, color->green, color->blue, color->alpha);
-}
-
 /**
- * Set the global (foreground) color.
- *
- * \return The old color.
+ * Add `a` times `x` to `y`, term by term.
  */
-rgba_t*
-grid_set_color(grid_context_t *gr, rgba_t *color) {
-    rgba_t *old = gr->par->color;
-    gr->par->color = color;
-    grid_apply_color(gr, color);
-    return old;
+static void
+compiled_unit_axpy(compiled_unit_t *y, double a, const compiled_unit_t *x) {
+    y->npc += a * x->npc;
+    y->px += a * x->px;
+    y->lines += a * x->lines;
+    y->em += a * x->em;
+    y->native += a * x->native;
+    y->native_weight += a * x->native_weight;
+    y->null += a * x->null;
 }
 
 /**
- * Set the global fill color.
- *
- * \return The old color.
+ * Solve the sizes of a layout's rows or columns into edges and sizes, and the
+ * space `rest` that the fixed sizes leave. Null units share `rest`: the
+ * `null` term of each edge and size is left holding the multiple of `rest` it
+ * includes, so that it can be taken out where `rest` is negative. Missing
+ * sizes count as one null unit. Rows are stacked from the top, columns from
+ * the left.
  */
-rgba_t*
-grid_set_fill(grid_context_t *gr, rgba_t *fill) {
-    rgba_t *old = gr->par->color;
-    gr->par->fill = fill;
-    return old;
-}
+static void
+grid_solve_layout_axis(int n, const unit_t **units, bool top_down,
+                       compiled_unit_t *edge, compiled_unit_t *size,
+                       compiled_unit_t *rest)
+{
+    compiled_unit_t fixed = { 0 };
+    int i;
+    for (i = 0; i < n; i++) {
+        if (units && units[i])
+            unit_compile(units[i], &size[i]);
+        else
+            size[i] = (compiled_unit_t){ .null = 1 };
 
-static double *grid_dash_pattern1_px = (double[]){10, 5};
-static int grid_dash_pattern1_len = 2;
+        compiled_unit_axpy(&fixed, 1, &size[i]);
+    }
 
-static double *grid_dash_pattern2_px = (double[]){3, 4};
-static int grid_dash_pattern2_len = 2;
+    // null units share the space the other units leave
+    double nulls = fixed.null;
+    *rest = (compiled_unit_t){ .npc = 1 };
+    compiled_unit_axpy(rest, -1, &fixed);
+    rest->null = 0;
 
-static double *grid_dash_pattern3_px = (double[]){3, 5, 10, 5};
-static int grid_dash_pattern3_len = 4;
+    compiled_unit_t at = { .npc = top_down ? 1 : 0 };
+    for (i = 0; i < n; i++) {
+        double share = nulls > 0 ? size[i].null / nulls : 0;
+        compiled_unit_axpy(&size[i], share, rest);
+        size[i].null = share;
 
-static void
-grid_apply_line_type(grid_context_t *gr, const char *line_type) {
-    double *dash_pattern_px, *dash_pattern_dev;
-    dash_pattern_px = dash_pattern_dev = NULL;
-    int dash_pattern_len = 0;
-
-    if (strcmp(line_type, "solid") == 0) {
-        // do nothing (and don't print a warning)
-    } else if (strcmp(line_type, "dotdash") == 0) {
-        dash_pattern_px = grid_dash_pattern3_px;
-        dash_pattern_len = grid_dash_pattern3_len;
-    } else if (strncmp(line_type, "dash", 4) == 0) {
-        dash_pattern_px = grid_dash_pattern1_px;
-        dash_pattern_len = grid_dash_pattern1_len;
-    } else if (strncmp(line_type, "dot", 3) == 0) {
-        dash_pattern_px = grid_dash_pattern2_px;
-        dash_pattern_len = grid_dash_pattern2_len;
-    } else {
-        fprintf(stderr, "Unknown line type: '%s'\n", line_type);
+        if (top_down) {
+            compiled_unit_axpy(&at, -1, &size[i]);
+            edge[i] = at;
+        } else {
+            edge[i] = at;
+            compiled_unit_axpy(&at, 1, &size[i]);
+        }
     }
+}
 
-    if (dash_pattern_px) {
-        dash_pattern_dev = malloc(dash_pattern_len * sizeof(double));
-        int i;
-        double temp;
-        unit_t this_unit;
-        for (i = 0; i < dash_pattern_len; i++) {
-            this_unit = Unit(dash_pattern_px[i], "px");
-            dash_pattern_dev[i] = unit_to_npc(gr, 'x', &this_unit);
-            temp = 0;
-            cairo_matrix_transform_distance(gr->current_node->npc_to_dev,
-                                            dash_pattern_dev + i, &temp);
-        }
+/**
+ * Allocate a new \ref grid_layout_t with the given row heights and column
+ * widths, listed from the top and from the left. Either array may be `NULL`,
+ * and so may any of its elements, for rows or columns of one null unit. The
+ * units are compiled and not referenced after the call.
+ */
+grid_layout_t*
+new_grid_layout(int nrow, const unit_t **heights, 
+                int ncol, const unit_t **widths) 
+{
+    if (nrow < 1 || ncol < 1) {
+        fprintf(stderr, "Warning: can't create a layout with %d rows and %d "
+                        "columns\n", nrow, ncol);
+        return NULL;
     }
 
-    cairo_set_dash(gr->cr, dash_pattern_dev, dash_pattern_len, 0);
+    grid_layout_t *layout = grid_malloc(sizeof(grid_layout_t));
+    layout->nrow = nrow;
+    layout->ncol = ncol;
 
-    if (dash_pattern_dev)
-        free(dash_pattern_dev);
+    layout->row_y = grid_malloc(2 * (nrow + ncol) * sizeof(compiled_unit_t));
+    layout->row_h = layout->row_y + nrow;
+    layout->col_x = layout->row_h + nrow;
+    layout->col_w = layout->col_x + ncol;
+
+    grid_solve_layout_axis(nrow, heights, true, layout->row_y, layout->row_h,
+                           &layout->row_rest);
+    grid_solve_layout_axis(ncol, widths, false, layout->col_x, layout->col_w,
+                           &layout->col_rest);
+
+    layout->cached = false;
+    layout->row_npc = grid_malloc(2 * (nrow + ncol) * sizeof(double));
+    layout->col_npc = layout->row_npc + 2 * nrow;
+
+    return layout;
 }
 
 /**
- * Set the global line type.
+ * Deallocate a \ref grid_layout_t. Viewports already pushed from the layout
+ * are unaffected.
  */
-char*
-grid_set_line_type(grid_context_t *gr, char *line_type) {
-    char *old = gr->par->line_type;
-    gr->par->line_type = line_type;
-    grid_apply_line_type(gr, line_type);
-    return old;
+void
+free_grid_layout(grid_layout_t *layout) {
+    int n = layout->nrow + layout->ncol;
+    grid_free(layout->row_y, 2 * n * sizeof(compiled_unit_t));
+    grid_free(layout->row_npc, 2 * n * sizeof(double));
+    grid_free(layout, sizeof(grid_layout_t));
 }
 
 /**
- * Set the global point type.
+ * Evaluate a layout's edges in NPC for a parent geometry, unless they are
+ * cached. The key holds the parent's device units per NPC along x and y, the
+ * device units per line and em, and the parent's native origin and size.
  */
-char*
-grid_set_point_type(grid_context_t *gr, char *pty) {
-    char *old = gr->par->point_type;
-    gr->par->point_type = pty;
-    return old;
+static void
+grid_evaluate_layout(grid_layout_t *layout, const double key[8]) {
+    if (layout->cached && 
+        memcmp(key, layout->cache_key, sizeof(layout->cache_key)) == 0)
+        return;
+
+    // where the fixed rows or columns overflow the parent, the null ones get
+    // no space rather than negative space
+    double row_rest = fmin(0, compiled_unit_to_npc(&layout->row_rest, key[1], 
+                                                   key[2], key[3], 0, key[7]));
+    double col_rest = fmin(0, compiled_unit_to_npc(&layout->col_rest, key[0], 
+                                                   key[2], key[3], 0, key[6]));
+
+    int i;
+    for (i = 0; i < layout->nrow; i++) {
+        layout->row_npc[2 * i] = 
+            compiled_unit_to_npc(&layout->row_y[i], key[1], key[2], key[3], 
+                                 key[5], key[7]) - 
+            layout->row_y[i].null * row_rest;
+        layout->row_npc[2 * i + 1] = 
+            compiled_unit_to_npc(&layout->row_h[i], key[1], key[2], key[3], 
+                                 0, key[7]) - 
+            layout->row_h[i].null * row_rest;
+    }
+
+    for (i = 0; i < layout->ncol; i++) {
+        layout->col_npc[2 * i] = 
+            compiled_unit_to_npc(&layout->col_x[i], key[0], key[2], key[3], 
+                                 key[4], key[6]) - 
+            layout->col_x[i].null * col_rest;
+        layout->col_npc[2 * i + 1] = 
+            compiled_unit_to_npc(&layout->col_w[i], key[0], key[2], key[3], 
+                                 0, key[6]) - 
+            layout->col_w[i].null * col_rest;
+    }
+
+    memcpy(layout->cache_key, key, sizeof(layout->cache_key));
+    layout->cached = true;
 }
 
 /**
- * Set the global horizontal justification.
+ * Push a viewport covering `nrows` rows and `ncols` columns of a layout,
+ * starting from cell (`row`, `col`), into the current viewport. Rows and
+ * columns are numbered from zero, from the top left. The viewport inherits
+ * native coordinates from its parent and can be named like any other; its
+ * geometry is kept in compiled form, so it follows the layout when the
+ * context is resized.
  */
-char*
+void
+grid_push_layout_span(grid_context_t *gr, const char *name, 
+                      grid_layout_t *layout, int row, int col, 
+                      int nrows, int ncols)
+{
+    if (row < 0 || col < 0 || nrows < 1 || ncols < 1 ||
+        row + nrows > layout->nrow || col + ncols > layout->ncol)
+    {
+        fprintf(stderr, "Warning: cells (%d, %d) to (%d, %d) are outside the "
+                        "layout\n", row, col, row + nrows - 1, col + ncols - 1);
+        return;
+    }
+
+    grid_trace_begin_node(gr, "grid_push_layout_viewport");
+    grid_viewport_node_t *parent = gr->current_node;
+    grid_viewport_node_t *node = new_grid_viewport_node(gr);
+    int last_row = row + nrows - 1, last_col = col + ncols - 1;
+
+    node->x = layout->col_x[col];
+    node->w = layout->col_x[last_col];
+    compiled_unit_axpy(&node->w, 1, &layout->col_w[last_col]);
+    compiled_unit_axpy(&node->w, -1, &layout->col_x[col]);
+
+    node->y = layout->row_y[last_row];
+    node->h = layout->row_y[row];
+    compiled_unit_axpy(&node->h, 1, &layout->row_h[row]);
+    compiled_unit_axpy(&node->h, -1, &layout->row_y[last_row]);
+    node->rest_x = layout->col_rest;
+    node->rest_y = layout->row_rest;
+
+    node->has_ntv = false;
+    grid_set_node_font_metrics(gr, node);
+
+    double key[8];
+    grid_dev_per_npc(parent, &key[0], &key[1]);
+    key[2] = node->dev_per_line;
+    key[3] = node->dev_per_em;
+    grid_node_ntv(parent, &key[4], &key[5], &key[6], &key[7]);
+    grid_evaluate_layout(layout, key);
+
+    const double *r = layout->row_npc, *c = layout->col_npc;
+    double x = c[2 * col], w = c[2 * last_col] + c[2 * last_col + 1] - x;
+    double y = r[2 * last_row], h = r[2 * row] + r[2 * row + 1] - y;
+
+    if (!grid_place_viewport_node(node, parent, x, y, w, h)) {
+        fprintf(stderr, "Warning: can't create singular viewport\n");
+        node->parent = gr->free_nodes;
+        gr->free_nodes = node;
+        grid_trace_end_node(gr);
+        return;
+    }
+
+    grid_link_viewport_node(gr, name, node);
+    grid_trace_end_pushed(gr);
+}
+
+/**
+ * Push a named viewport covering one cell of a layout. See
+ * \ref grid_push_layout_span.
+ */
+void
+grid_push_named_layout_viewport(grid_context_t *gr, const char *name,
+                                grid_layout_t *layout, int row, int col)
+{
+    grid_push_layout_span(gr, name, layout, row, col, 1, 1);
+}
+
+/**
+ * Push a viewport covering one cell of a layout. See
+ * \ref grid_push_layout_span.
+ */
+void
+grid_push_layout_viewport(grid_context_t *gr, grid_layout_t *layout, 
+                          int row, int col)
+{
+    grid_push_layout_span(gr, NULL, layout, row, col, 1, 1);
+}
+
+//
+// incremental redraw
+//
+
+/**
+ * Margin, in lines of the current font, added around a viewport's extent when
+ * it is invalidated or tested against the dirty region. This covers axis ticks
+ * and labels, which are drawn outside the viewport.
+ */
+#define GRID_DIRTY_MARGIN_LINES 4
+
+/**
+ * Compute the smallest integer device-space rectangle that covers `node`,
+ * padded by \ref GRID_DIRTY_MARGIN_LINES.
+ */
+static void
+grid_node_device_rect(grid_context_t *gr, const grid_viewport_node_t *node,
+                      cairo_rectangle_int_t *rect)
+{
+    double x1 = 0, y1 = 0, x2 = 1, y2 = 1;
+    cairo_matrix_transform_point(&node->npc_to_dev, &x1, &y1);
+    cairo_matrix_transform_point(&node->npc_to_dev, &x2, &y2);
+    cairo_user_to_device(gr->cr, &x1, &y1);
+    cairo_user_to_device(gr->cr, &x2, &y2);
+
+    cairo_font_extents_t font_extents;
+    grid_font_extents(gr, &font_extents);
+    double pad = GRID_DIRTY_MARGIN_LINES * font_extents.height;
+
+    rect->x = (int)floor(fmin(x1, x2) - pad);
+    rect->y = (int)floor(fmin(y1, y2) - pad);
+    rect->width = (int)ceil(fmax(x1, x2) + pad) - rect->x;
+    rect->height = (int)ceil(fmax(y1, y2) + pad) - rect->y;
+}
+
+/**
+ * Mark the area covered by the current viewport as dirty. The next call to
+ * \ref grid_begin_redraw will clear and redraw this area.
+ */
+void
+grid_invalidate_viewport(grid_context_t *gr) {
+    cairo_rectangle_int_t rect;
+    grid_node_device_rect(gr, gr->current_node, &rect);
+    cairo_region_union_rectangle(gr->dirty, &rect);
+}
+
+/**
+ * Start an incremental redraw. The dirty region is cleared to transparent and
+ * drawing is clipped to it. Until \ref grid_end_redraw is called, drawing
+ * commands issued in viewports that don't overlap the dirty region return
+ * without drawing, so the client can replay its whole frame and pay only for
+ * what changed.
+ *
+ * \return `false` if nothing has been invalidated, in which case there is
+ * nothing to redraw and \ref grid_end_redraw need not be called.
+ */
+bool
+grid_begin_redraw(grid_context_t *gr) {
+    if (cairo_region_is_empty(gr->dirty))
+        return false;
+
+    cairo_t *cr = gr->cr;
+    cairo_matrix_t m;
+    cairo_get_matrix(cr, &m);
+    cairo_identity_matrix(cr);
+
+    cairo_new_path(cr);
+    int i, n = cairo_region_num_rectangles(gr->dirty);
+    cairo_rectangle_int_t rect;
+    for (i = 0; i < n; i++) {
+        cairo_region_get_rectangle(gr->dirty, i, &rect);
+        cairo_rectangle(cr, rect.x, rect.y, rect.width, rect.height);
+    }
+
+    cairo_clip(cr);
+    cairo_set_operator(cr, CAIRO_OPERATOR_CLEAR);
+    cairo_paint(cr);
+    cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
+    cairo_set_matrix(cr, &m);
+
+    gr->redrawing = true;
+    return true;
+}
+
+/**
+ * Finish an incremental redraw: remove the clip and mark the whole surface
+ * clean.
+ */
+void
+grid_end_redraw(grid_context_t *gr) {
+    cairo_reset_clip(gr->cr);
+    cairo_region_subtract(gr->dirty, gr->dirty);
+    gr->redrawing = false;
+}
+
+/**
+ * During an incremental redraw, test whether the current viewport lies
+ * entirely outside the dirty region.
+ */
+static bool
+grid_is_culled(grid_context_t *gr) {
+    if (!gr->redrawing)
+        return false;
+
+    cairo_rectangle_int_t rect;
+    grid_node_device_rect(gr, gr->current_node, &rect);
+    return cairo_region_contains_rectangle(gr->dirty, &rect) ==
+           CAIRO_REGION_OVERLAP_OUT;
+}
+
+//
+// draw functions
+//
+
+static uint8_t
+grid_parse_line_type(const char *line_type) {
+    if (strcmp(line_type, "solid") == 0)
+        return GRID_LINE_SOLID;
+    else if (strcmp(line_type, "dotdash") == 0)
+        return GRID_LINE_DOTDASH;
+    else if (strncmp(line_type, "dash", 4) == 0)
+        return GRID_LINE_DASHED;
+    else if (strncmp(line_type, "dot", 3) == 0)
+        return GRID_LINE_DOTTED;
+
+    fprintf(stderr, "Unknown line type: '%s'\n", line_type);
+    return GRID_LINE_SOLID;
+}
+
+static uint8_t
+grid_parse_antialias(const char *antialias) {
+    if (strcmp(antialias, "default") == 0)
+        return CAIRO_ANTIALIAS_DEFAULT;
+    else if (strcmp(antialias, "none") == 0)
+        return CAIRO_ANTIALIAS_NONE;
+    else if (strcmp(antialias, "fast") == 0)
+        return CAIRO_ANTIALIAS_FAST;
+    else if (strcmp(antialias, "good") == 0)
+        return CAIRO_ANTIALIAS_GOOD;
+    else if (strcmp(antialias, "best") == 0)
+        return CAIRO_ANTIALIAS_BEST;
+
+    fprintf(stderr, "Unknown antialias mode: '%s'\n", antialias);
+    return CAIRO_ANTIALIAS_DEFAULT;
+}
+
+static uint8_t
+grid_parse_point_type(const char *point_type) {
+    if (strcmp(point_type, "round") == 0)
+        return GRID_POINT_ROUND;
+    else if (strcmp(point_type, "square") == 0)
+        return GRID_POINT_SQUARE;
+    else if (strcmp(point_type, "diamond") == 0)
+        return GRID_POINT_DIAMOND;
+
+    fprintf(stderr, "Unknown point type: '%s'\n", point_type);
+    return GRID_POINT_ROUND;
+}
+
+/**
+ * Justifications are recognized by their first letter.
+ */
+static uint8_t
+grid_parse_just(const char *just) {
+    switch (just[0]) {
+    case 'l': return GRID_JUST_LEFT;
+    case 'r': return GRID_JUST_RIGHT;
+    case 'c': return GRID_JUST_CENTER;
+    default:
+        fprintf(stderr, "Warning: unknown justification '%s'\n", just);
+        return GRID_JUST_NONE;
+    }
+}
+
+static uint8_t
+grid_parse_vjust(const char *vjust) {
+    switch (vjust[0]) {
+    case 't': return GRID_JUST_TOP;
+    case 'm': return GRID_JUST_MIDDLE;
+    case 'b': return GRID_JUST_BOTTOM;
+    default:
+        fprintf(stderr, "Warning: unknown vertical justification '%s'\n", 
+                vjust);
+        return GRID_JUST_NONE;
+    }
+}
+
+/**
+ * Overwrite the fields of `r` for which `par`, which may be `NULL`, has
+ * values.
+ */
+static void
+grid_resolve_par(grid_resolved_par_t *r, const grid_par_t *par) {
+    if (!par)
+        return;
+
+    if (par->color)
+        r->color = grid_pack_color(par->color);
+    if (par->fill)
+        r->fill = grid_pack_color(par->fill);
+    if (par->line_type)
+        r->line_type = grid_parse_line_type(par->line_type);
+    if (par->point_type)
+        r->point_type = grid_parse_point_type(par->point_type);
+    if (par->just)
+        r->just = grid_parse_just(par->just);
+    if (par->vjust)
+        r->vjust = grid_parse_vjust(par->vjust);
+    if (par->antialias)
+        r->antialias = grid_parse_antialias(par->antialias);
+    if (par->hairline)
+        r->hairline = *par->hairline;
+    if (par->fast_lines)
+        r->fast_lines = *par->fast_lines;
+    if (par->line_width)
+        unit_compile(par->line_width, &r->line_width);
+    if (par->point_size)
+        unit_compile(par->point_size, &r->point_size);
+    if (par->font_size)
+        unit_compile(par->font_size, &r->font_size);
+}
+
+/**
+ * Resolve the global parameters from scratch, as when they're all replaced.
+ */
+static void
+grid_resolve_global_par(grid_context_t *gr) {
+    gr->resolved = (grid_resolved_par_t){ 0 };
+    grid_resolve_par(&gr->resolved, gr->par);
+}
+
+/**
+ * Resolve the parameters in effect for a draw call: the fields of `par`,
+ * falling back on the current node's parameters and then on the global ones.
+ */
+static void
+grid_current_par(grid_context_t *gr, const grid_par_t *par, 
+                 grid_resolved_par_t *r)
+{
+    *r = gr->resolved;
+    grid_resolve_par(r, gr->current_node->par);
+    grid_resolve_par(r, par);
+}
+
+/**
+ * Evaluate a compiled size, such as a line width, in device units along the
+ * current viewport's x-axis. The font is only measured if the size has terms
+ * in lines or ems.
+ */
+static double
+grid_size_to_dev(grid_context_t *gr, const compiled_unit_t *c) {
+    grid_viewport_node_t *node = gr->current_node;
+    double dev_x_per_npc, dev_y_per_npc;
+    grid_dev_per_npc(node, &dev_x_per_npc, &dev_y_per_npc);
+
+    double dev_per_line = 0.0, dev_per_em = 0.0;
+    if (c->lines != 0 || c->em != 0) {
+        cairo_font_extents_t font_extents;
+        grid_font_extents(gr, &font_extents);
+        cairo_text_extents_t em_extents;
+        grid_text_extents(gr, "m", &em_extents);
+        dev_per_line = font_extents.height;
+        dev_per_em = em_extents.width;
+    }
+
+    double x_ntv = 0.0, w_ntv = 1.0;
+    if (c->native != 0 || c->native_weight != 0) {
+        double y_ntv, h_ntv;
+        grid_node_ntv(node, &x_ntv, &y_ntv, &w_ntv, &h_ntv);
+    }
+
+    GridCount(gr, unit_conversions, 1);
+    double size = compiled_unit_to_npc(c, dev_x_per_npc, dev_per_line, 
+                                       dev_per_em, x_ntv, w_ntv);
+    double temp = 0.0;
+    cairo_matrix_transform_distance(&node->npc_to_dev, &size, &temp);
+    return size;
+}
+
+/**
+ * Forget the state recorded for the context's cairo context, so that the
+ * parameters of the next draw call are all set again. Call this after
+ * changing the cairo context's source, dash, line width, or font size
+ * directly, or restoring a saved cairo state.
+ */
+void
+grid_invalidate_cairo_state(grid_context_t *gr) {
+    gr->cairo_state.valid = false;
+}
+
+/**
+ * The width, in device units, of the lines that a draw call passed `par` would
+ * stroke in the current viewport, whatever the cairo context is set to now.
+ */
+double
+grid_resolved_line_width(grid_context_t *gr, const grid_par_t *par) {
+    grid_resolved_par_t r;
+    grid_current_par(gr, par, &r);
+    return r.hairline ? 1.0 : grid_size_to_dev(gr, &r.line_width);
+}
+
+/**
+ * Set the cairo source to a packed color unless it's already set.
+ */
+static void
+grid_apply_color(grid_context_t *gr, uint32_t color) {
+    grid_cairo_state_t *state = &gr->cairo_state;
+    if (state->valid && state->color == color)
+        return;
+
+    state->color = color;
+    cairo_set_source_rgba(gr->cr, (color >> 16 & 0xff) / 255.0, 
+                          (color >> 8 & 0xff) / 255.0, (color & 0xff) / 255.0,
+                          (color >> 24) / 255.0);
+}
+
+/**
+ * Set the global (foreground) color. Like the other global parameters, the
+ * color is borrowed: it must outlive its use by the context, and the caller
+ * keeps ownership of it. Changes to the global parameters should go through
+ * the setters, which resolve them for drawing.
+ *
+ * \return The old color, which still belongs to whoever set it; the initial
+ *   defaults belong to the context.
+ */
+rgba_t*
+grid_set_color(grid_context_t *gr, rgba_t *color) {
+    rgba_t *old = gr->par->color;
+    gr->par->color = color;
+    grid_resolve_par(&gr->resolved, &(grid_par_t){ .color = color });
+    grid_apply_color(gr, gr->resolved.color);
+    return old;
+}
+
+/**
+ * Set the global fill color, or clear it if `fill` is `NULL`. See
+ * \ref grid_set_color.
+ *
+ * \return The old fill color.
+ */
+rgba_t*
+grid_set_fill(grid_context_t *gr, rgba_t *fill) {
+    rgba_t *old = gr->par->fill;
+    gr->par->fill = fill;
+    gr->resolved.fill = fill ? grid_pack_color(fill) : 0;
+    return old;
+}
+
+#define GRID_DASH_PATTERN_MAX 4
+
+/**
+ * Dash patterns in pixels, indexed by \ref grid_line_type_t.
+ */
+static const double grid_dash_patterns_px[][GRID_DASH_PATTERN_MAX] = {
+    [GRID_LINE_DASHED] = { 10, 5 },
+    [GRID_LINE_DOTTED] = { 3, 4 },
+    [GRID_LINE_DOTDASH] = { 3, 5, 10, 5 }
+};
+
+static const int grid_dash_pattern_lens[] = {
+    [GRID_LINE_SOLID] = 0,
+    [GRID_LINE_DASHED] = 2,
+    [GRID_LINE_DOTTED] = 2,
+    [GRID_LINE_DOTDASH] = 4
+};
+
+static void
+grid_apply_line_type(grid_context_t *gr, uint8_t line_type) {
+    double dash_scale = 0.0;
+    if (line_type != GRID_LINE_SOLID)
+        dash_scale = grid_size_to_dev(gr, &(compiled_unit_t){ .px = 1 });
+
+    grid_cairo_state_t *state = &gr->cairo_state;
+    if (state->valid && state->line_type == line_type &&
+        state->dash_scale == dash_scale)
+        return;
+
+    state->line_type = line_type;
+    state->dash_scale = dash_scale;
+
+    double dash_pattern_dev[GRID_DASH_PATTERN_MAX];
+    int dash_pattern_len = grid_dash_pattern_lens[line_type];
+    int i;
+    for (i = 0; i < dash_pattern_len; i++)
+        dash_pattern_dev[i] = grid_dash_patterns_px[line_type][i] * dash_scale;
+
+    cairo_set_dash(gr->cr, dash_pattern_dev, dash_pattern_len, 0);
+}
+
+/**
+ * Set the global line type. See \ref grid_set_color.
+ */
+char*
+grid_set_line_type(grid_context_t *gr, char *line_type) {
+    char *old = gr->par->line_type;
+    gr->par->line_type = line_type;
+    grid_resolve_par(&gr->resolved, &(grid_par_t){ .line_type = line_type });
+    grid_apply_line_type(gr, gr->resolved.line_type);
+    return old;
+}
+
+/**
+ * Set the global point type. See \ref grid_set_color.
+ */
+char*
+grid_set_point_type(grid_context_t *gr, char *pty) {
+    char *old = gr->par->point_type;
+    gr->par->point_type = pty;
+    grid_resolve_par(&gr->resolved, &(grid_par_t){ .point_type = pty });
+    return old;
+}
+
+/**
+ * Set the global horizontal justification. See \ref grid_set_color.
+ */
+char*
 grid_set_just(grid_context_t *gr, char *just) {
     char *old = gr->par->just;
     gr->par->just = just;
+    grid_resolve_par(&gr->resolved, &(grid_par_t){ .just = just });
+    return old;
+}
+
+/**
+ * Set the global vertical justification. See \ref grid_set_color.
+ */
+char*
+grid_set_vjust(grid_context_t *gr, char *vjust) {
+    char *old = gr->par->vjust;
+    gr->par->vjust = vjust;
+    grid_resolve_par(&gr->resolved, &(grid_par_t){ .vjust = vjust });
+    return old;
+}
+
+static void
+grid_apply_line_width(grid_context_t *gr, const compiled_unit_t *lwd, 
+                      bool hairline)
+{
+    double lwd_dev = hairline ? 1.0 : grid_size_to_dev(gr, lwd);
+
+    grid_cairo_state_t *state = &gr->cairo_state;
+    if (state->valid && state->line_width == lwd_dev)
+        return;
+
+    state->line_width = lwd_dev;
+    cairo_set_line_width(gr->cr, lwd_dev);
+}
+
+/**
+ * Set the global line width to the given value. See \ref grid_set_color.
+ *
+ * \return The old line width.
+ */
+unit_t*
+grid_set_line_width(grid_context_t *gr, unit_t *lwd) {
+    unit_t *old = gr->par->line_width;
+    gr->par->line_width = lwd;
+    grid_resolve_par(&gr->resolved, &(grid_par_t){ .line_width = lwd });
+    grid_apply_line_width(gr, &gr->resolved.line_width, 
+                          gr->resolved.hairline);
+    return old;
+}
+
+/**
+ * Set the global point size to the given value. See \ref grid_set_color.
+ *
+ * \return The old point size.
+ */
+unit_t*
+grid_set_point_size(grid_context_t *gr, unit_t *point_size) {
+    unit_t *old = gr->par->point_size;
+    gr->par->point_size = point_size;
+    grid_resolve_par(&gr->resolved, &(grid_par_t){ .point_size = point_size });
+    return old;
+}
+
+static void
+grid_apply_font_size(grid_context_t *gr, const compiled_unit_t *font_size) {
+    double size_dev = grid_size_to_dev(gr, font_size);
+
+    grid_cairo_state_t *state = &gr->cairo_state;
+    if (state->valid && state->font_size == size_dev)
+        return;
+
+    state->font_size = size_dev;
+    cairo_set_font_size(gr->cr, size_dev);
+}
+
+/**
+ * Set the global font size to the given value. See \ref grid_set_color.
+ *
+ * \return The old font size.
+ */
+unit_t*
+grid_set_font_size(grid_context_t *gr, unit_t *font_size) {
+    unit_t *old = gr->par->font_size;
+    gr->par->font_size = font_size;
+    grid_resolve_par(&gr->resolved, &(grid_par_t){ .font_size = font_size });
+    grid_apply_font_size(gr, &gr->resolved.font_size);
+    return old;
+}
+
+static void
+grid_apply_antialias(grid_context_t *gr, uint8_t antialias) {
+    grid_cairo_state_t *state = &gr->cairo_state;
+    if (state->valid && state->antialias == antialias)
+        return;
+
+    state->antialias = antialias;
+    cairo_set_antialias(gr->cr, antialias);
+}
+
+/**
+ * Set the global antialiasing mode. "none" and "fast" rasterize dense
+ * plots faster at some cost in quality. See \ref grid_set_color.
+ */
+char*
+grid_set_antialias(grid_context_t *gr, char *antialias) {
+    char *old = gr->par->antialias;
+    gr->par->antialias = antialias;
+    grid_resolve_par(&gr->resolved, &(grid_par_t){ .antialias = antialias });
+    grid_apply_antialias(gr, gr->resolved.antialias);
+    return old;
+}
+
+/**
+ * Turn global hairline mode on or off. In hairline mode, lines are stroked
+ * one device pixel wide whatever the line width, and their vertices are
+ * moved to the nearest pixel centers, so rules parallel to the axes stay
+ * crisp, and are as cheap to draw, with any antialiasing mode. See
+ * \ref grid_set_color.
+ */
+bool*
+grid_set_hairline(grid_context_t *gr, bool *hairline) {
+    bool *old = gr->par->hairline;
+    gr->par->hairline = hairline;
+    grid_resolve_par(&gr->resolved, &(grid_par_t){ .hairline = hairline });
+    grid_apply_line_width(gr, &gr->resolved.line_width, 
+                          gr->resolved.hairline);
+    return old;
+}
+
+/**
+ * Turn the direct line rasterizer on or off globally. See \ref grid_lines
+ * and \ref grid_set_color.
+ */
+bool*
+grid_set_fast_lines(grid_context_t *gr, bool *fast_lines) {
+    bool *old = gr->par->fast_lines;
+    gr->par->fast_lines = fast_lines;
+    grid_resolve_par(&gr->resolved, &(grid_par_t){ .fast_lines = fast_lines });
+    return old;
+}
+
+/**
+ * Set resolved parameters on the cairo context, skipping those that are
+ * already set. Line widths are evaluated with the font as it was before the
+ * font size is set.
+ */
+static void
+grid_apply_resolved(grid_context_t *gr, const grid_resolved_par_t *r) {
+    grid_apply_color(gr, r->color);
+    grid_apply_line_type(gr, r->line_type);
+    grid_apply_line_width(gr, &r->line_width, r->hairline);
+    grid_apply_font_size(gr, &r->font_size);
+    grid_apply_antialias(gr, r->antialias);
+    gr->cairo_state.valid = true;
+}
+
+/**
+ * Resolve the parameters of a draw call into `gr->drawing`, taking each first
+ * from the passed \ref grid_par_t, then from the current node parameters, and
+ * finally from the global parameters, and apply them. Sets the cairo source
+ * color to the foreground color.
+ */
+static void
+grid_apply_parameters(grid_context_t *gr, const grid_par_t *par) {
+    grid_trace_begin_node(gr, "grid_apply_parameters");
+    grid_current_par(gr, par, &gr->drawing);
+    grid_apply_resolved(gr, &gr->drawing);
+    grid_trace_end_node(gr);
+}
+
+/**
+ * After a draw call that passed `par`, set the cairo context back to the
+ * current node parameters where applicable, and the global defaults
+ * otherwise.
+ */
+static void
+grid_restore_parameters(grid_context_t *gr, const grid_par_t *par) {
+    if (par) {
+        grid_resolved_par_t r;
+        grid_current_par(gr, NULL, &r);
+        grid_apply_resolved(gr, &r);
+    }
+}
+
+//
+// surface pools
+//
+
+static grid_surface_pool_t *grid_default_surface_pool = NULL;
+
+/**
+ * Allocate a new \ref grid_surface_pool_t that holds at most `capacity` idle
+ * surfaces.
+ */
+grid_surface_pool_t*
+new_grid_surface_pool(int capacity) {
+    grid_surface_pool_t *pool = grid_malloc(sizeof(grid_surface_pool_t));
+    pool->capacity = capacity > 0 ? capacity : 1;
+    pool->size = 0;
+    pool->surfaces = grid_malloc(pool->capacity * sizeof(cairo_surface_t*));
+    pool->stats = (grid_surface_pool_stats_t){ 0 };
+    pthread_mutex_init(&pool->lock, NULL);
+
+    return pool;
+}
+
+/**
+ * Deallocate a \ref grid_surface_pool_t and destroy its idle surfaces.
+ * Surfaces still held by grid contexts are not affected, but the contexts must
+ * not outlive the pool. If the pool is the global default, the default is
+ * unset.
+ */
+void
+free_grid_surface_pool(grid_surface_pool_t *pool) {
+    int i;
+    for (i = 0; i < pool->size; i++)
+        cairo_surface_destroy(pool->surfaces[i]);
+
+    if (grid_default_surface_pool == pool)
+        grid_default_surface_pool = NULL;
+
+    pthread_mutex_destroy(&pool->lock);
+    grid_free(pool->surfaces, pool->capacity * sizeof(cairo_surface_t*));
+    grid_free(pool, sizeof(grid_surface_pool_t));
+}
+
+/**
+ * Take an image surface with the given format and size from the pool, or
+ * create one if no idle surface matches. A recycled surface is cleared to
+ * transparent, which touches memory that is already mapped instead of
+ * faulting in a fresh buffer.
+ *
+ * \return A surface owned by the caller. Return it with
+ * \ref grid_surface_pool_release.
+ */
+cairo_surface_t*
+grid_surface_pool_acquire(grid_surface_pool_t *pool, cairo_format_t format,
+                          int width, int height)
+{
+    int i;
+    cairo_surface_t *s = NULL;
+
+    // prefer the most recently released surface, its pages are likely warm
+    pthread_mutex_lock(&pool->lock);
+    for (i = pool->size - 1; i >= 0; i--) {
+        s = pool->surfaces[i];
+        if (cairo_image_surface_get_format(s) == format &&
+            cairo_image_surface_get_width(s) == width &&
+            cairo_image_surface_get_height(s) == height)
+        {
+            memmove(pool->surfaces + i, pool->surfaces + i + 1,
+                    (pool->size - i - 1) * sizeof(cairo_surface_t*));
+            pool->size--;
+            pool->stats.hits++;
+            break;
+        }
+        s = NULL;
+    }
+
+    if (!s)
+        pool->stats.misses++;
+    pthread_mutex_unlock(&pool->lock);
+
+    if (!s)
+        return cairo_image_surface_create(format, width, height);
+
+    // the surface is the caller's now, so it's cleared outside the lock
+    cairo_surface_flush(s);
+    memset(cairo_image_surface_get_data(s), 0,
+           (size_t)cairo_image_surface_get_stride(s) * height);
+    cairo_surface_mark_dirty(s);
+
+    return s;
+}
+
+/**
+ * Return an image surface to the pool. If the pool is full, the least recently
+ * released surface is destroyed to make room. A surface that is still
+ * referenced elsewhere, such as by a pattern the caller kept, isn't pooled,
+ * since recycling it would clear it under its other users; the caller's
+ * reference is dropped instead.
+ */
+void
+grid_surface_pool_release(grid_surface_pool_t *pool, cairo_surface_t *surface) {
+    if (cairo_surface_get_type(surface) != CAIRO_SURFACE_TYPE_IMAGE ||
+        cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS ||
+        cairo_surface_get_reference_count(surface) > 1)
+    {
+        cairo_surface_destroy(surface);
+        return;
+    }
+
+    cairo_surface_t *evicted = NULL;
+    pthread_mutex_lock(&pool->lock);
+    if (pool->size == pool->capacity) {
+        evicted = pool->surfaces[0];
+        memmove(pool->surfaces, pool->surfaces + 1,
+                (pool->size - 1) * sizeof(cairo_surface_t*));
+        pool->size--;
+        pool->stats.evictions++;
+    }
+
+    pool->surfaces[pool->size++] = surface;
+    pool->stats.releases++;
+    pthread_mutex_unlock(&pool->lock);
+
+    if (evicted)
+        cairo_surface_destroy(evicted);
+}
+
+/**
+ * Set the pool that \ref new_grid_context draws surfaces from. Pass `NULL` to
+ * allocate a fresh surface for every context. Set it while no other thread is
+ * creating contexts; the pool itself may then be shared by contexts on any
+ * thread.
+ *
+ * \return The previous pool.
+ */
+grid_surface_pool_t*
+grid_set_surface_pool(grid_surface_pool_t *pool) {
+    grid_surface_pool_t *old = grid_default_surface_pool;
+    grid_default_surface_pool = pool;
     return old;
 }
 
+//
+// cached layers
+//
+
+static uint64_t
+grid_hash_color(uint64_t h, const rgba_t *col) {
+    return col ? grid_hash_bytes(h, col, sizeof(rgba_t)) : h * GRID_FNV_PRIME;
+}
+
+static uint64_t
+grid_hash_unit(uint64_t h, const unit_t *u) {
+    if (!u)
+        return h * GRID_FNV_PRIME;
+
+    h = grid_hash_bytes(h, &u->value, sizeof(double));
+    h = grid_hash_string(h, u->type);
+    h = grid_hash_unit(h, u->arg1);
+    return grid_hash_unit(h, u->arg2);
+}
+
+/**
+ * Hash the values (not the addresses) of a parameter struct.
+ */
+static uint64_t
+grid_hash_par(uint64_t h, const grid_par_t *par) {
+    if (!par)
+        return h * GRID_FNV_PRIME;
+
+    h = grid_hash_color(h, par->color);
+    h = grid_hash_color(h, par->fill);
+    h = grid_hash_string(h, par->line_type);
+    h = grid_hash_string(h, par->point_type);
+    h = grid_hash_string(h, par->just);
+    h = grid_hash_string(h, par->vjust);
+    h = grid_hash_string(h, par->antialias);
+    h = par->hairline ? grid_hash_bytes(h, par->hairline, sizeof(bool)) :
+                        h * GRID_FNV_PRIME;
+    h = par->fast_lines ? grid_hash_bytes(h, par->fast_lines, sizeof(bool)) :
+                          h * GRID_FNV_PRIME;
+    h = grid_hash_unit(h, par->line_width);
+    h = grid_hash_unit(h, par->point_size);
+    return grid_hash_unit(h, par->font_size);
+}
+
+/**
+ * Allocate a new, empty \ref grid_layer_t.
+ */
+grid_layer_t*
+new_grid_layer(void) {
+    grid_layer_t *layer = grid_malloc(sizeof(grid_layer_t));
+    layer->pattern = NULL;
+    layer->par_hash = 0;
+
+    return layer;
+}
+
+/**
+ * Discard a layer's cached drawing so that it is rendered again by the next
+ * call to \ref grid_begin_layer.
+ */
+void
+grid_invalidate_layer(grid_layer_t *layer) {
+    if (layer->pattern)
+        cairo_pattern_destroy(layer->pattern);
+
+    layer->pattern = NULL;
+}
+
+/**
+ * Deallocate a \ref grid_layer_t and its cached drawing.
+ */
+void
+free_grid_layer(grid_layer_t *layer) {
+    grid_invalidate_layer(layer);
+    grid_free(layer, sizeof(grid_layer_t));
+}
+
+/**
+ * Start drawing a layer in the current viewport. If the layer holds a drawing
+ * made for the same viewport geometry and parameters, the drawing is
+ * composited onto the surface with a single paint and the function returns
+ * `false`; the client should skip its drawing commands. Otherwise the function
+ * returns `true` and subsequent drawing is captured until the matching call to
+ * \ref grid_end_layer, which caches and composites it. Typical use:
+ *
+ *     if (grid_begin_layer(gr, layer)) {
+ *         grid_full_rect(gr, &bg);
+ *         ...
+ *         grid_end_layer(gr, layer);
+ *     }
+ *
+ * Drawing is clipped to the current viewport, padded to leave room for axes.
+ * Viewports pushed while drawing the layer should be popped before it ends.
+ */
+bool
+grid_begin_layer(grid_context_t *gr, grid_layer_t *layer) {
+    grid_viewport_node_t *node = gr->current_node;
+    uint64_t h = grid_hash_par(GRID_FNV_OFFSET, gr->par);
+    h = grid_hash_par(h, node->par);
+
+    cairo_t *cr = gr->cr;
+
+    if (layer->pattern && layer->par_hash == h &&
+        memcmp(&layer->npc_to_dev, &node->npc_to_dev, sizeof(cairo_matrix_t)) == 0 &&
+        memcmp(&layer->npc_to_ntv, &node->npc_to_ntv, sizeof(cairo_matrix_t)) == 0)
+    {
+        cairo_save(cr);
+        cairo_set_source(cr, layer->pattern);
+        cairo_paint(cr);
+        cairo_restore(cr);
+        return false;
+    }
+
+    grid_invalidate_layer(layer);
+    layer->npc_to_dev = node->npc_to_dev;
+    layer->npc_to_ntv = node->npc_to_ntv;
+    layer->par_hash = h;
+
+    cairo_rectangle_int_t rect;
+    grid_node_device_rect(gr, node, &rect);
+
+    cairo_matrix_t m;
+    cairo_save(cr);
+    cairo_get_matrix(cr, &m);
+    cairo_identity_matrix(cr);
+    cairo_new_path(cr);
+    cairo_rectangle(cr, rect.x, rect.y, rect.width, rect.height);
+    cairo_clip(cr);
+    cairo_set_matrix(cr, &m);
+
+    cairo_push_group(cr);
+    return true;
+}
+
+/**
+ * Finish drawing a layer started with \ref grid_begin_layer: cache the
+ * captured drawing and composite it onto the surface.
+ */
+void
+grid_end_layer(grid_context_t *gr, grid_layer_t *layer) {
+    cairo_t *cr = gr->cr;
+    layer->pattern = cairo_pop_group(cr);
+
+    cairo_set_source(cr, layer->pattern);
+    cairo_paint(cr);
+    cairo_restore(cr);
+
+    // cairo_restore brought back the state that was current before the layer
+    // began; make sure it matches the global parameters
+    grid_invalidate_cairo_state(gr);
+    grid_apply_parameters(gr, NULL);
+}
+
+/**
+ * Give the context a surface of the given size, and a cairo context that draws
+ * to it, and size the root viewport to match.
+ */
+static void
+grid_attach_surface(grid_context_t *gr, int width_px, int height_px) {
+    if (gr->surface_pool)
+        gr->surface = grid_surface_pool_acquire(gr->surface_pool, 
+                                                CAIRO_FORMAT_ARGB32,
+                                                width_px, height_px);
+    else
+        gr->surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, 
+                                                 width_px, height_px);
+    gr->cr = cairo_create(gr->surface);
+    grid_invalidate_cairo_state(gr);
+
+    // put the origin at the lower left instead of the upper left
+    cairo_matrix_t m = { .xx = 1, .yy = -1, .y0 = height_px };
+    cairo_set_matrix(gr->cr, &m);
+
+    grid_viewport_node_t *root = gr->root_node;
+    cairo_matrix_init(&root->npc_to_ntv, width_px, 0, 0, height_px, 0, 0);
+    cairo_matrix_init(&root->npc_to_dev, width_px, 0, 0, height_px, 0, 0);
+}
+
+/**
+ * Destroy the context's cairo context and destroy its surface or return it to
+ * its pool.
+ */
+static void
+grid_detach_surface(grid_context_t *gr) {
+    cairo_destroy(gr->cr);
+
+    if (gr->surface_pool)
+        grid_surface_pool_release(gr->surface_pool, gr->surface);
+    else
+        cairo_surface_destroy(gr->surface);
+}
+
+/**
+ * Allocate a new grid context. The grid context contains a reference to a cairo
+ * image surface with the given width and height that it can draw to. If a
+ * surface pool has been set with \ref grid_set_surface_pool, the surface is
+ * taken from the pool and returned to it by \ref free_grid_context.
+ *
+ * The context allocates through the allocator in effect; see
+ * \ref new_grid_context_with_allocator.
+ *
+ * \param width_px The width of the underlying image in pixels.
+ * \param height_px The height of the underlying image in pixels.
+ * \return A pointer to the newly allocated \ref grid_context_t.
+ */
+grid_context_t*
+new_grid_context(int width_px, int height_px) {
+    return new_grid_context_with_allocator(width_px, height_px, NULL);
+}
+
+/**
+ * Allocate a new grid context, as \ref new_grid_context does, whose memory is
+ * allocated and freed through `allocator`, or through the allocator in effect
+ * if `allocator` is `NULL`, whatever allocator is in effect later.
+ */
+grid_context_t*
+new_grid_context_with_allocator(int width_px, int height_px,
+                                grid_allocator_t *allocator)
+{
+    if (!allocator)
+        allocator = grid_get_allocator();
+
+    grid_context_t *gr = grid_allocator_malloc(allocator, 
+                                               sizeof(grid_context_t));
+    gr->allocator = allocator;
+    gr->memory = (grid_memory_stats_t){ 0 };
+    gr->surface_pool = grid_default_surface_pool;
+
+    gr->free_nodes = NULL;
+    gr->node_blocks = NULL;
+    gr->name_index_size = 16;
+    gr->name_index = grid_context_calloc(gr, gr->name_index_size, 
+                                         sizeof(grid_viewport_node_t*));
+    gr->name_count = 0;
+    gr->node_seq = 1;
+    gr->tree_generation = 1;
+    gr->layout_generation = 1;
+    gr->path_cache = grid_context_calloc(
+        gr, GRID_PATH_CACHE_SIZE, sizeof(struct __grid_path_cache_entry_t));
+
+    grid_viewport_node_t *root = new_grid_viewport_node(gr);
+    grid_set_node_name(gr, root, "root");
+    grid_index_viewport_node(gr, root);
+    root->layout_generation = gr->layout_generation;
+    gr->current_node = gr->root_node = root;
+
+    grid_attach_surface(gr, width_px, height_px);
+
+    gr->dirty = cairo_region_create();
+    gr->redrawing = false;
+
+    gr->stats_enabled = false;
+    gr->in_phase = false;
+    gr->tracer = NULL;
+    memset(&gr->stats, 0, sizeof(grid_stats_t));
+
+    gr->scratch = NULL;
+    gr->scratch_size = 0;
+    gr->axis_ticks = (grid_ticks_t){ 0 };
+
+    // gr->par borrows its fields; the context owns the defaults
+    gr->default_par = grid_new_default_par(gr);
+    gr->par = grid_context_malloc(gr, sizeof(grid_par_t));
+    *gr->par = *gr->default_par;
+    grid_resolve_global_par(gr);
+
+    grid_apply_parameters(gr, NULL);
+
+    return gr;
+}
+
+/**
+ * Replace the context's surface with a blank one of the given size and lay
+ * the viewport tree out again for the new size. The tree is kept; each
+ * viewport's transforms are recomputed from its units the next time it
+ * becomes the current viewport. The dirty region is emptied, and cached
+ * layers drawn at the old size will be redrawn.
+ */
+void
+grid_context_resize(grid_context_t *gr, int width_px, int height_px) {
+    grid_detach_surface(gr);
+    grid_attach_surface(gr, width_px, height_px);
+
+    gr->layout_generation++;
+    gr->root_node->layout_generation = gr->layout_generation;
+
+    cairo_region_subtract(gr->dirty, gr->dirty);
+    gr->redrawing = false;
+
+    grid_update_viewport_node(gr, gr->current_node);
+    grid_apply_parameters(gr, NULL);
+}
+
+/**
+ * Prepare a grid context to draw a new frame without reallocating it. The
+ * surface is cleared to transparent, the dirty region is emptied, the
+ * viewport tree is torn down to the root viewport (its nodes are kept for
+ * reuse), and the global parameters are restored to their defaults. Values
+ * passed to the `grid_set_*` functions are borrowed by the context, so they
+ * are not freed here.
+ */
+void
+grid_context_reset(grid_context_t *gr) {
+    grid_viewport_node_t *root = gr->root_node;
+
+    if (root->child) {
+        grid_release_viewport_tree(gr, root->child);
+        root->child = NULL;
+    }
+
+    gr->current_node = root;
+    *gr->par = *gr->default_par;
+    grid_resolve_global_par(gr);
+
+    cairo_region_subtract(gr->dirty, gr->dirty);
+    gr->redrawing = false;
+
+    cairo_t *cr = gr->cr;
+    cairo_reset_clip(cr);
+    cairo_save(cr);
+    cairo_set_operator(cr, CAIRO_OPERATOR_CLEAR);
+    cairo_paint(cr);
+    cairo_restore(cr);
+
+    grid_apply_parameters(gr, NULL);
+}
+
+/**
+ * Recursively release the names and parameters held by the nodes of a
+ * context's viewport tree. The nodes themselves belong to the grid context's
+ * node pool and are deallocated by \ref free_grid_context. The implementation
+ * assumes the top-level root node does not have any siblings.
+ */
+void
+free_grid_viewport_tree(grid_context_t *gr, grid_viewport_node_t *root) {
+    if (root->gege)
+        free_grid_viewport_tree(gr, root->gege);
+
+    if (root->child)
+        free_grid_viewport_tree(gr, root->child);
+
+    grid_clear_viewport_node(gr, root);
+}
+
 /**
- * Set the global vertical justification.
+ * Deallocate a \ref grid_context_t, through the allocator that was in effect
+ * when it was created.
  */
-char*
-grid_set_vjust(grid_context_t *gr, char *vjust) {
-    char *old = gr->par->vjust;
-    gr->par->vjust = vjust;
-    return old;
-}
+void
+free_grid_context(grid_context_t *gr) {
+    free_grid_viewport_tree(gr, gr->root_node);
+
+    struct __grid_node_block_t *block;
+    while ((block = gr->node_blocks)) {
+        gr->node_blocks = block->next;
+        grid_context_free(gr, block, 
+                          sizeof(struct __grid_node_block_t) + 
+                          block->size * sizeof(grid_viewport_node_t));
+    }
 
-static void
-grid_apply_line_width(grid_context_t *gr, const unit_t *lwd) {
-    double lwd_npc = unit_to_npc(gr, 'x', lwd);
-    double temp = 0;
-    cairo_matrix_transform_distance(gr->current_node->npc_to_dev, &lwd_npc, &temp);
-    cairo_set_line_width(gr->cr, lwd_npc);
+    grid_free_par(gr, gr->default_par);
+
+    grid_context_free(gr, gr->par, sizeof(grid_par_t));
+    cairo_region_destroy(gr->dirty);
+    grid_context_free(gr, gr->name_index, 
+                      gr->name_index_size * sizeof(grid_viewport_node_t*));
+    grid_context_free(gr, gr->path_cache, GRID_PATH_CACHE_SIZE * 
+                          sizeof(struct __grid_path_cache_entry_t));
+    grid_context_free(gr, gr->scratch, gr->scratch_size * sizeof(double));
+    grid_context_free(gr, gr->axis_ticks.at, 
+                      grid_ticks_bytes(gr->axis_ticks.capacity));
+    grid_detach_surface(gr);
+    grid_allocator_free(gr->allocator, gr, sizeof(grid_context_t));
 }
 
 /**
- * Set the global line width to the given value.
+ * Write the context's surface to a PNG file.
  *
- * \return The old line width.
+ * \return `true` on success. On failure, a warning is printed.
  */
-unit_t*
-grid_set_line_width(grid_context_t *gr, unit_t *lwd) {
-    unit_t *old = gr->par->line_width;
-    gr->par->line_width = lwd;
-    grid_apply_line_width(gr, lwd);
-    return old;
+bool
+grid_write_png(grid_context_t *gr, const char *path) {
+    grid_phase_t phase = grid_begin_phase(gr, GRID_OP_WRITE_PNG);
+
+    cairo_surface_flush(gr->surface);
+    cairo_status_t status = cairo_surface_write_to_png(gr->surface, path);
+    if (status != CAIRO_STATUS_SUCCESS)
+        fprintf(stderr, "Warning: can't write '%s': %s\n", path, 
+                cairo_status_to_string(status));
+
+    grid_end_phase(gr, phase);
+    return status == CAIRO_STATUS_SUCCESS;
 }
 
 /**
- * Set the global point size to the given value.
- *
- * \return The old font size.
+ * Move a device coordinate to the nearest pixel center if the draw call under
+ * way is in hairline mode.
  */
-unit_t*
-grid_set_point_size(grid_context_t *gr, unit_t *point_size) {
-    unit_t *old = gr->par->point_size;
-    gr->par->point_size = point_size;
-    return old;
+static double
+grid_snap(const grid_context_t *gr, double v) {
+    return gr->drawing.hairline ? floor(v) + 0.5 : v;
 }
 
 static void
-grid_apply_font_size(grid_context_t *gr, const unit_t *font_size) {
-    double x_npc = unit_to_npc(gr, 'x', font_size);
-    double temp = 0;
-    cairo_matrix_transform_distance(gr->current_node->npc_to_dev, &x_npc, &temp);
-    cairo_set_font_size(gr->cr, x_npc);
+grid_move_to(grid_context_t *gr, double x_dev, double y_dev) {
+    cairo_move_to(gr->cr, grid_snap(gr, x_dev), grid_snap(gr, y_dev));
 }
 
-/**
- * Set the global font size to the given value.
- *
- * \return The old font size.
- */
-unit_t*
-grid_set_font_size(grid_context_t *gr, unit_t *font_size) {
-    unit_t *old = gr->par->font_size;
-    gr->par->font_size = font_size;
-    grid_apply_font_size(gr, font_size);
-    return old;
+static void
+grid_line_to(grid_context_t *gr, double x_dev, double y_dev) {
+    cairo_line_to(gr->cr, grid_snap(gr, x_dev), grid_snap(gr, y_dev));
 }
 
-#define Parameter(F,A,B,C) (A && A->F ? A->F : B && B->F ? B->F : C->F)
-
 /**
- * Attempt to set parameters first from the passed \ref grid_par_t, then from
- * the current node parameters, and finally from the global parameters. Sets the
- * cairo source color to the foreground color.
+ * Draw a line connecting two points.
  */
-static void
-grid_apply_parameters(grid_context_t *gr, const grid_par_t *par) {
-    rgba_t *col;
-    char *s;
-    unit_t *u;
+void
+grid_line(grid_context_t *gr, const unit_t *x1, const unit_t *y1, 
+          const unit_t *x2, const unit_t *y2, const grid_par_t *par)
+{
+    if (grid_is_culled(gr))
+        return;
 
-    grid_par_t *cur = gr->current_node->par;
-    grid_par_t *def = gr->par;
+    grid_phase_t phase = grid_begin_phase(gr, GRID_OP_LINE);
+
+    grid_apply_parameters(gr, par);
 
-    col = Parameter(color, par, cur, def);
-    grid_apply_color(gr, col);
+    cairo_t *cr = gr->cr;
+    GridCount(gr, points, 2);
+    double x1_npc = unit_to_npc(gr, 'x', x1);
+    double y1_npc = unit_to_npc(gr, 'y', y1);
+    double x2_npc = unit_to_npc(gr, 'x', x2);
+    double y2_npc = unit_to_npc(gr, 'y', y2);
 
-    s = Parameter(line_type, par, cur, def);
-    grid_apply_line_type(gr, s);
+    cairo_matrix_t *m = &gr->current_node->npc_to_dev;
+    cairo_matrix_transform_point(m, &x1_npc, &y1_npc);
+    cairo_matrix_transform_point(m, &x2_npc, &y2_npc);
 
-    u = Parameter(line_width, par, cur, def);
-    grid_apply_line_width(gr, u);
+    cairo_new_path(cr);
+    grid_move_to(gr, x1_npc, y1_npc);
+    grid_line_to(gr, x2_npc, y2_npc);
 
-    u = Parameter(font_size, par, cur, def);
-    grid_apply_font_size(gr, u);
+    grid_stroke(gr);
+    grid_restore_parameters(gr, par);
+    grid_end_phase(gr, phase);
 }
 
 /**
- * For any non-null fields in `par`, set the corresponding value to the current
- * node parameters where applicable, and the global defaults otherwise.
+ * Draw a polyline, given in device coordinates, with \ref grid_scanline_lines
+ * if the draw call under way allows it: \ref grid_par_t::fast_lines is set,
+ * the line is solid, antialiased, and no wider than
+ * \ref GRID_SCANLINE_MAX_WIDTH pixels, the target is an ARGB32 or RGB24 image
+ * surface, and the clip is a single rectangle, such as a layer's or a series'
+ * viewport. The coordinates are overwritten with pixel coordinates.
+ *
+ * \return `false` if the polyline must be stroked by cairo instead.
  */
-static void
-grid_restore_parameters(grid_context_t *gr, const grid_par_t *par) {
-    if (par) {
-        rgba_t *col;
-        char *s;
-        unit_t *u;
+static bool
+grid_scanline_polyline(grid_context_t *gr, int n, double *xs_dev, 
+                       double *ys_dev)
+{
+    const grid_resolved_par_t *r = &gr->drawing;
+    if (!r->fast_lines || r->line_type != GRID_LINE_SOLID)
+        return false;
 
-        grid_par_t *nil = NULL;
-        grid_par_t *cur = gr->current_node->par;
-        grid_par_t *def = gr->par;
+    // the scanline rasterizer always antialiases; cairo draws aliased lines
+    if (r->antialias == CAIRO_ANTIALIAS_NONE)
+        return false;
 
-        if (par->color) {
-            col = Parameter(color, nil, cur, def);
-            grid_apply_color(gr, col);
-        }
+    cairo_t *cr = gr->cr;
+    cairo_matrix_t m;
+    cairo_get_matrix(cr, &m);
+    double scale = fabs(m.xx);
+    double width = scale * gr->cairo_state.line_width;
+    if (m.xy != 0 || m.yx != 0 || fabs(m.yy) != scale ||
+        width > GRID_SCANLINE_MAX_WIDTH)
+        return false;
 
-        if (par->line_type) {
-            s = Parameter(line_type, nil, cur, def);
-            grid_apply_line_type(gr, s);
-        }
+    cairo_surface_t *target = cairo_get_group_target(cr);
+    if (cairo_surface_get_type(target) != CAIRO_SURFACE_TYPE_IMAGE)
+        return false;
 
-        if (par->line_width) {
-            u = Parameter(line_width, nil, cur, def);
-            grid_apply_line_width(gr, u);
-        }
+    cairo_format_t format = cairo_image_surface_get_format(target);
+    if (format != CAIRO_FORMAT_ARGB32 && format != CAIRO_FORMAT_RGB24)
+        return false;
 
-        if (par->font_size) {
-            u = Parameter(font_size, nil, cur, def);
-            grid_apply_font_size(gr, u);
-        }
+    // the clip must be a single rectangle; an incremental redraw may clip to
+    // several, and a clip that isn't made of rectangles has none
+    cairo_rectangle_list_t *rects = cairo_copy_clip_rectangle_list(cr);
+    if (rects->status != CAIRO_STATUS_SUCCESS || rects->num_rectangles != 1) {
+        cairo_rectangle_list_destroy(rects);
+        return false;
+    }
+
+    double x1 = rects->rectangles[0].x, y1 = rects->rectangles[0].y;
+    double x2 = x1 + rects->rectangles[0].width;
+    double y2 = y1 + rects->rectangles[0].height;
+    cairo_rectangle_list_destroy(rects);
+
+    // the clip in the target's pixels, which are offset from device space
+    // in a layer's group
+    double x_offset, y_offset;
+    cairo_surface_get_device_offset(target, &x_offset, &y_offset);
+    cairo_user_to_device(cr, &x1, &y1);
+    cairo_user_to_device(cr, &x2, &y2);
+
+    int width_px = cairo_image_surface_get_width(target);
+    int height_px = cairo_image_surface_get_height(target);
+    int clip_x1 = (int)fmax(0, round(fmin(x1, x2) + x_offset));
+    int clip_y1 = (int)fmax(0, round(fmin(y1, y2) + y_offset));
+    int clip_x2 = (int)fmin(width_px, round(fmax(x1, x2) + x_offset));
+    int clip_y2 = (int)fmin(height_px, round(fmax(y1, y2) + y_offset));
+    cairo_rectangle_int_t clip = {
+        clip_x1, clip_y1, clip_x2 - clip_x1, clip_y2 - clip_y1
+    };
+
+    int i;
+    for (i = 0; i < n; i++) {
+        double x = grid_snap(gr, xs_dev[i]), y = grid_snap(gr, ys_dev[i]);
+        cairo_user_to_device(cr, &x, &y);
+        xs_dev[i] = x + x_offset;
+        ys_dev[i] = y + y_offset;
     }
+
+    cairo_surface_flush(target);
+    grid_scanline_lines(cairo_image_surface_get_data(target), 
+                        cairo_image_surface_get_stride(target), &clip, n, 
+                        xs_dev, ys_dev, width, r->color);
+    if (clip.width > 0 && clip.height > 0)
+        cairo_surface_mark_dirty_rectangle(target, clip.x, clip.y, 
+                                           clip.width, clip.height);
+    return true;
 }
 
 /**
- * Allocate a new grid context. The grid context contains a reference to a cairo
- * image surface with the given width and height that it can draw to.
+ * Draw a line that connects the coordinates given by `xs` and `ys`.
  *
- * \param width_px The width of the underlying image in pixels.
- * \param height_px The height of the underlying image in pixels.
- * \return A pointer to the newly allocated \ref grid_context_t.
+ * With \ref grid_par_t::fast_lines set, thin solid lines drawn on image
+ * surfaces skip cairo's stroker, whose cost on long polylines grows with
+ * their self-intersections, and are rasterized straight into the surface's
+ * pixels. Pixels are covered as cairo covers them, except where the line
+ * crosses itself: there a translucent line is composited twice.
  */
-grid_context_t*
-new_grid_context(int width_px, int height_px) {
-    grid_context_t *gr = malloc(sizeof(grid_context_t));
-    gr->surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width_px, height_px);
-    gr->cr = cairo_create(gr->surface);
+void
+grid_lines(grid_context_t  *gr, const unit_array_t *xs, const unit_array_t *ys, 
+           const grid_par_t *par) 
+{
+    if (grid_is_culled(gr))
+        return;
 
-    // put the origin at the lower left instead of the upper left
-    cairo_matrix_t m = { .xx = 1, .yy = -1, .y0 = height_px };
-    cairo_set_matrix(gr->cr, &m);
+    grid_phase_t phase = grid_begin_phase(gr, GRID_OP_LINES);
 
-    grid_viewport_node_t *root = new_grid_viewport_node();
-    root->name = malloc(sizeof(char) * 5);
-    strcpy(root->name, "root");
-    cairo_matrix_scale(root->npc_to_ntv, width_px, height_px);
-    cairo_matrix_scale(root->npc_to_dev, width_px, height_px);
-    gr->current_node = gr->root_node = root;
+    grid_apply_parameters(gr, par);
+    cairo_t *cr = gr->cr;
+    
+    int x_size = unit_array_size(xs);
+    int y_size = unit_array_size(ys);
+
+    if (x_size <= 0) {
+        fprintf(stderr, "Warning: can't draw 0 length array.\n");
+        grid_end_phase(gr, phase);
+        return;
+    } else if (x_size != y_size) {
+        fprintf(stderr, "Warning: can't draw arrays of different sizes.\n");
+        grid_end_phase(gr, phase);
+        return;
+    }
 
-    grid_par_t *par = new_grid_default_par();
-    gr->par = par;
+    GridCount(gr, points, x_size);
 
-    grid_apply_parameters(gr, NULL);
+    double *xs_npc, *ys_npc;
+    grid_unit_arrays_to_npc(gr, xs, ys, x_size, &xs_npc, &ys_npc);
 
-    return gr;
+    cairo_matrix_t *m = &gr->current_node->npc_to_dev;
+    int i;
+    for (i = 0; i < x_size; i++)
+        cairo_matrix_transform_point(m, xs_npc + i, ys_npc + i);
+
+    if (!grid_scanline_polyline(gr, x_size, xs_npc, ys_npc)) {
+        cairo_new_path(cr);
+        grid_move_to(gr, xs_npc[0], ys_npc[0]);
+        for (i = 1; i < x_size; i++)
+            grid_line_to(gr, xs_npc[i], ys_npc[i]);
+
+        grid_stroke(gr);
+    }
+
+    grid_restore_parameters(gr, par);
+    grid_end_phase(gr, phase);
 }
 
 /**
- * Recursively deallocate a viewport tree and referenced viewports. The
- * implementation assumes the top-level root node does not have any siblings.
- *
- * \todo Current implementation is incomplete, it should free parameters.
+ * Draw a round point with the given size at the current location.
  */
-void
-free_grid_viewport_tree(grid_viewport_node_t *root) {
-    if (root->gege)
-        free_grid_viewport_tree(root->gege);
+static void
+grid_point_round(grid_context_t *gr, double x_dev, double y_dev, double size_dev) {
+    cairo_new_sub_path(gr->cr);
+    cairo_arc(gr->cr, x_dev, y_dev, size_dev, 0, 2 * M_PI);
+}
 
-    if (root->child)
-        free_grid_viewport_tree(root->child);
+/**
+ * Draw a square point with the given size at the current location.
+ */
+static void
+grid_point_square(grid_context_t *gr, double x_dev, double y_dev, double size_dev) {
+    // Let's normalize different point shapes to have the same area.
+    double sz = sqrt(M_PI) * size_dev;
+    cairo_rectangle(gr->cr, x_dev - sz / 2, y_dev - sz / 2, sz, sz);
+}
 
-    free_grid_viewport_node(root);
+/**
+ * Draw a diamond with the given size at the current location.
+ */
+static void
+grid_point_diamond(grid_context_t *gr, double x_dev, double y_dev, double size_dev) {
+    // Let's normalize different point shapes to have the same area.
+    double sz = sqrt(M_PI / 2) * size_dev;
+    cairo_new_sub_path(gr->cr);
+    cairo_move_to(gr->cr, x_dev, y_dev - sz);
+    cairo_line_to(gr->cr, x_dev + sz, y_dev);
+    cairo_line_to(gr->cr, x_dev, y_dev + sz);
+    cairo_line_to(gr->cr, x_dev - sz, y_dev);
 }
 
+typedef void (*grid_point_fn)(grid_context_t*, double, double, double);
+
 /**
- * Deallocate a \ref grid_context_t.
+ * The functions that add each \ref grid_point_type_t to the path.
  */
-void
-free_grid_context(grid_context_t *gr) {
-    free_grid_viewport_tree(gr->root_node);
-    cairo_destroy(gr->cr);
-    cairo_surface_destroy(gr->surface);
-    free(gr);
+static const grid_point_fn grid_point_fns[] = {
+    [GRID_POINT_ROUND] = grid_point_round,
+    [GRID_POINT_SQUARE] = grid_point_square,
+    [GRID_POINT_DIAMOND] = grid_point_diamond
+};
+
+#define GRID_POINT_TYPES (sizeof(grid_point_fns) / sizeof(grid_point_fn))
+
+/**
+ * Look up the function that adds the point type of the draw call under way to
+ * the path, and its point size in device units.
+ */
+static grid_point_fn
+grid_point_shape(grid_context_t *gr, double *size_dev) {
+    *size_dev = grid_size_to_dev(gr, &gr->drawing.point_size);
+    return grid_point_fns[gr->drawing.point_type];
 }
 
 /**
- * Draw a line connecting two points.
+ * Draw a point at the given coordinates.
  */
 void
-grid_line(grid_context_t *gr, const unit_t *x1, const unit_t *y1, 
-          const unit_t *x2, const unit_t *y2, const grid_par_t *par)
+grid_point(grid_context_t *gr, const unit_t *x, const unit_t *y, 
+           const grid_par_t *par) 
 {
+    if (grid_is_culled(gr))
+        return;
+
+    grid_phase_t phase = grid_begin_phase(gr, GRID_OP_POINT);
+
     grid_apply_parameters(gr, par);
 
-    cairo_t *cr = gr->cr;
-    double x1_npc = unit_to_npc(gr, 'x', x1);
-    double y1_npc = unit_to_npc(gr, 'y', y1);
-    double x2_npc = unit_to_npc(gr, 'x', x2);
-    double y2_npc = unit_to_npc(gr, 'y', y2);
+    GridCount(gr, points, 1);
+    double x_npc = unit_to_npc(gr, 'x', x);
+    double y_npc = unit_to_npc(gr, 'y', y);
+    cairo_matrix_transform_point(&gr->current_node->npc_to_dev, &x_npc, &y_npc);
 
-    cairo_matrix_t *m = gr->current_node->npc_to_dev;
-    cairo_matrix_transform_point(m, &x1_npc, &y1_npc);
-    cairo_matrix_transform_point(m, &x2_npc, &y2_npc);
+    double psz_dev;
+    grid_point_fn draw_fn = grid_point_shape(gr, &psz_dev);
 
-    cairo_new_path(cr);
-    cairo_move_to(cr, x1_npc, y1_npc);
-    cairo_line_to(cr, x2_npc, y2_npc);
+    cairo_new_path(gr->cr);
+    draw_fn(gr, x_npc, y_npc, psz_dev);
+
+    grid_fill(gr);
 
-    cairo_stroke(cr);
     grid_restore_parameters(gr, par);
+    grid_end_phase(gr, phase);
 }
 
 /**
- * Draw a line that connects the coordinates given by `xs` and `ys`.
+ * Draw a point at each of the coordinates defined by `xs` and `ys`.
  */
 void
-grid_lines(grid_context_t  *gr, const unit_array_t *xs, const unit_array_t *ys, 
-           const grid_par_t *par) 
+grid_points(grid_context_t *gr, const unit_array_t *xs, const unit_array_t *ys,
+            const grid_par_t *par)
 {
+    if (grid_is_culled(gr))
+        return;
+
+    grid_phase_t phase = grid_begin_phase(gr, GRID_OP_POINTS);
+
     grid_apply_parameters(gr, par);
-    cairo_t *cr = gr->cr;
-    
+
     int x_size = unit_array_size(xs);
     int y_size = unit_array_size(ys);
 
     if (x_size <= 0) {
         fprintf(stderr, "Warning: can't draw 0 length array.\n");
+        grid_end_phase(gr, phase);
         return;
     } else if (x_size != y_size) {
         fprintf(stderr, "Warning: can't draw arrays of different sizes.\n");
+        grid_end_phase(gr, phase);
         return;
     }
 
-    double *xs_npc = malloc(x_size * sizeof(double));
-    double *ys_npc = malloc(x_size * sizeof(double));
+    GridCount(gr, points, x_size);
 
-    unit_array_to_npc(xs_npc, gr, 'x', xs);
-    unit_array_to_npc(ys_npc, gr, 'y', ys);
+    double *xs_npc, *ys_npc;
+    grid_unit_arrays_to_npc(gr, xs, ys, x_size, &xs_npc, &ys_npc);
 
-    cairo_matrix_t *m = gr->current_node->npc_to_dev;
-    cairo_matrix_transform_point(m, xs_npc, ys_npc);
-    cairo_new_path(cr);
-    cairo_move_to(cr, xs_npc[0], ys_npc[0]);
+    cairo_matrix_t *m = &gr->current_node->npc_to_dev;
+    double psz_dev;
+    grid_point_fn draw_fn = grid_point_shape(gr, &psz_dev);
+
+    cairo_new_path(gr->cr);
 
     int i;
-    for (i = 1; i < x_size; i++) {
+    for (i = 0; i < x_size; i++) {
         cairo_matrix_transform_point(m, xs_npc + i, ys_npc + i);
-        cairo_line_to(cr, xs_npc[i], ys_npc[i]);
+        draw_fn(gr, xs_npc[i], ys_npc[i], psz_dev);
+    }
+
+    grid_fill(gr);
+    grid_restore_parameters(gr, par);
+    grid_end_phase(gr, phase);
+}
+
+/**
+ * Sort keys by their upper 32 bits, a byte at a time, keeping keys with equal
+ * upper bits in order. `temp` holds `n` keys and `counts` 257 ints.
+ */
+static void
+grid_radix_sort_keys(uint64_t *keys, uint64_t *temp, int n, int *counts) {
+    uint64_t *from = keys, *to = temp;
+    int shift, i;
+    for (shift = 32; shift < 64; shift += 8) {
+        memset(counts, 0, 257 * sizeof(int));
+        for (i = 0; i < n; i++)
+            counts[(from[i] >> shift & 0xff) + 1]++;
+
+        // skip bytes that all keys share
+        if (counts[(from[0] >> shift & 0xff) + 1] == n)
+            continue;
+
+        for (i = 1; i <= 256; i++)
+            counts[i] += counts[i - 1];
+        for (i = 0; i < n; i++)
+            to[counts[from[i] >> shift & 0xff]++] = from[i];
+
+        uint64_t *swap = from;
+        from = to;
+        to = swap;
+    }
+
+    if (from != keys)
+        memcpy(keys, from, n * sizeof(uint64_t));
+}
+
+/**
+ * Sort the points of a styled draw into runs of one color. Each key holds a
+ * packed color in its upper 32 bits and a point's index in its lower ones.
+ * Palette indices are sorted by counting, with `palette_size + 2` ints at
+ * `counts`; packed colors are radix sorted, with `n` more keys at `temp` and
+ * 257 ints at `counts`. Points of one color keep their order.
+ */
+static void
+grid_sort_point_colors(grid_context_t *gr, const grid_point_style_t *style,
+                       int n, uint64_t *keys, uint64_t *temp, int *counts)
+{
+    int i;
+    if (style->colors) {
+        for (i = 0; i < n; i++)
+            keys[i] = (uint64_t)style->colors[i] << 32 | (uint32_t)i;
+        grid_radix_sort_keys(keys, temp, n, counts);
+    } else if (style->color_index) {
+        int size = style->palette ? style->palette_size : 0;
+        memset(counts, 0, (size + 2) * sizeof(int));
+
+        // indices past the palette share the last bucket
+        for (i = 0; i < n; i++) {
+            int b = style->color_index[i];
+            counts[(b < size ? b : size) + 1]++;
+        }
+        for (i = 1; i <= size + 1; i++)
+            counts[i] += counts[i - 1];
+
+        for (i = 0; i < n; i++) {
+            int b = style->color_index[i];
+            uint32_t color = b < size ? style->palette[b] : gr->drawing.color;
+            keys[counts[b < size ? b : size]++] = 
+                (uint64_t)color << 32 | (uint32_t)i;
+        }
+    } else {
+        for (i = 0; i < n; i++)
+            keys[i] = (uint64_t)gr->drawing.color << 32 | (uint32_t)i;
+    }
+}
+
+/**
+ * Draw a point at each of the coordinates defined by `xs` and `ys`, with a
+ * color, size, and shape per point as given by `style`. Points are grouped
+ * by color, and each color is filled once, so a scatter colored by a
+ * variable costs a fill per color rather than a call per point. Points of
+ * one color are drawn in order, but colors are drawn in the order of their
+ * palette index or packed value, so overlapping points of different colors
+ * may stack differently than in the arrays. `style` may be `NULL`.
+ */
+void
+grid_styled_points(grid_context_t *gr, const unit_array_t *xs, 
+                   const unit_array_t *ys, const grid_point_style_t *style,
+                   const grid_par_t *par)
+{
+    if (grid_is_culled(gr))
+        return;
+
+    grid_phase_t phase = grid_begin_phase(gr, GRID_OP_STYLED_POINTS);
+
+    static const grid_point_style_t no_style = { 0 };
+    if (!style)
+        style = &no_style;
+
+    grid_apply_parameters(gr, par);
+
+    int x_size = unit_array_size(xs);
+    int y_size = unit_array_size(ys);
+
+    if (x_size <= 0) {
+        fprintf(stderr, "Warning: can't draw 0 length array.\n");
+        grid_end_phase(gr, phase);
+        return;
+    } else if (x_size != y_size ||
+               (style->sizes && unit_array_size(style->sizes) != x_size))
+    {
+        fprintf(stderr, "Warning: can't draw arrays of different sizes.\n");
+        grid_end_phase(gr, phase);
+        return;
+    }
+
+    GridCount(gr, points, x_size);
+
+    // one request for the coordinates, sizes, sort keys and their temporary
+    // copies, counts, and the space needed to convert units, which follows
+    // them
+    size_t n = x_size;
+    size_t extra = unit_array_scratch_size(xs, x_size);
+    size_t y_extra = unit_array_scratch_size(ys, x_size);
+    size_t s_extra = style->sizes ? 
+                     unit_array_scratch_size(style->sizes, x_size) : 0;
+    if (y_extra > extra)
+        extra = y_extra;
+    if (s_extra > extra)
+        extra = s_extra;
+
+    size_t n_counts = style->palette ? style->palette_size + 2 : 0;
+    if (n_counts < 257)
+        n_counts = 257;
+    size_t counts_size = n_counts * sizeof(int) / sizeof(double) + 1;
+    double *xs_npc = grid_scratch(gr, 5 * n + counts_size + extra);
+    double *ys_npc = xs_npc + n;
+    double *sizes_dev = ys_npc + n;
+    uint64_t *keys = (uint64_t*)(sizes_dev + n);
+    uint64_t *temp = (uint64_t*)(sizes_dev + 2 * n);
+    int *counts = (int*)(sizes_dev + 3 * n);
+    double *conversion = sizes_dev + 3 * n + counts_size;
+
+    unit_array_to_npc(xs_npc, conversion, gr, 'x', xs);
+    unit_array_to_npc(ys_npc, conversion, gr, 'y', ys);
+
+    cairo_matrix_t *m = &gr->current_node->npc_to_dev;
+    double psz_dev;
+    grid_point_fn draw_fn = grid_point_shape(gr, &psz_dev);
+
+    size_t i;
+    if (style->sizes) {
+        unit_array_to_npc(sizes_dev, conversion, gr, 'x', style->sizes);
+        for (i = 0; i < n; i++) {
+            double temp = 0.0;
+            cairo_matrix_transform_distance(m, sizes_dev + i, &temp);
+        }
+    }
+
+    grid_sort_point_colors(gr, style, x_size, keys, temp, counts);
+
+    size_t start = 0;
+    while (start < n) {
+        uint32_t color = keys[start] >> 32;
+        cairo_new_path(gr->cr);
+
+        for (i = start; i < n && keys[i] >> 32 == color; i++) {
+            uint32_t k = (uint32_t)keys[i];
+            double x = xs_npc[k], y = ys_npc[k];
+            cairo_matrix_transform_point(m, &x, &y);
+
+            grid_point_fn fn = draw_fn;
+            if (style->shapes && style->shapes[k] < GRID_POINT_TYPES)
+                fn = grid_point_fns[style->shapes[k]];
+            fn(gr, x, y, style->sizes ? sizes_dev[k] : psz_dev);
+        }
+
+        grid_apply_color(gr, color);
+        grid_fill(gr);
+        start = i;
     }
 
-    cairo_stroke(cr);
+    grid_apply_color(gr, gr->drawing.color);
     grid_restore_parameters(gr, par);
-
-    free(xs_npc);
-    free(ys_npc);
+    grid_end_phase(gr, phase);
 }
 
+#define GRID_STREAM_CHUNK 4096
+#define GRID_STREAM_PATH_MAX 16384
+
 /**
- * Draw a round point with the given size at the current location.
+ * Compute the transform from values in a unit type to device coordinates in
+ * the current viewport. Only single unit types, which are affine, have such a
+ * transform.
+ *
+ * \return `false` if `type` isn't a single unit type.
  */
-static void
-grid_point_round(grid_context_t *gr, double x_dev, double y_dev, double size_dev) {
-    cairo_new_sub_path(gr->cr);
-    cairo_arc(gr->cr, x_dev, y_dev, size_dev, 0, 2 * M_PI);
+static bool
+grid_unit_to_dev_matrix(grid_context_t *gr, char *type, cairo_matrix_t *m) {
+    if (strcmp(type, "npc") != 0 && strcmp(type, "px") != 0 &&
+        strncmp(type, "line", 4) != 0 && strcmp(type, "em") != 0 &&
+        strcmp(type, "native") != 0)
+    {
+        fprintf(stderr, "Warning: can't stream unit '%s'\n", type);
+        return false;
+    }
+
+    unit_t zero = Unit(0, type), one = Unit(1, type);
+    double x0 = unit_to_npc(gr, 'x', &zero), y0 = unit_to_npc(gr, 'y', &zero);
+    double x1 = unit_to_npc(gr, 'x', &one), y1 = unit_to_npc(gr, 'y', &one);
+
+    cairo_matrix_t to_npc;
+    cairo_matrix_init(&to_npc, x1 - x0, 0, 0, y1 - y0, x0, y0);
+    cairo_matrix_multiply(m, &to_npc, &gr->current_node->npc_to_dev);
+    return true;
 }
 
 /**
- * Draw a square point with the given size at the current location.
+ * State of the per-pixel-column (M4) aggregation of a streamed line. The
+ * samples falling in one device column are reduced to the first, lowest,
+ * highest, and last of them, which rasterize to the same pixels as the full
+ * run when the line is at least a pixel wide.
  */
+typedef struct {
+    grid_context_t *gr;
+    bool open;         /**< A column is being aggregated. */
+    bool connected;    /**< The path has a current point to draw from. */
+    long col, seq;
+    double x[4], y[4]; /**< First, lowest, highest, last. */
+    long at[4];        /**< Sequence numbers of the four samples. */
+    long path_size;    /**< Points added since the last stroke. */
+    double last_x, last_y;
+} grid_m4_t;
+
 static void
-grid_point_square(grid_context_t *gr, double x_dev, double y_dev, double size_dev) {
-    // Let's normalize different point shapes to have the same area.
-    double sz = sqrt(M_PI) * size_dev;
-    cairo_rectangle(gr->cr, x_dev - sz / 2, y_dev - sz / 2, sz, sz);
+grid_m4_emit(grid_m4_t *m4, double x, double y) {
+    if (m4->connected) {
+        grid_line_to(m4->gr, x, y);
+    } else {
+        grid_move_to(m4->gr, x, y);
+        m4->connected = true;
+    }
+
+    m4->last_x = x;
+    m4->last_y = y;
+    m4->path_size++;
 }
 
 /**
- * Draw a diamond with the given size at the current location.
+ * Add the aggregated column to the path, in the order its samples arrived.
+ * Long paths are stroked and restarted from their last point, which bounds
+ * the path's size.
  */
 static void
-grid_point_diamond(grid_context_t *gr, double x_dev, double y_dev, double size_dev) {
-    // Let's normalize different point shapes to have the same area.
-    double sz = sqrt(M_PI / 2) * size_dev;
-    cairo_new_sub_path(gr->cr);
-    cairo_move_to(gr->cr, x_dev, y_dev - sz);
-    cairo_line_to(gr->cr, x_dev + sz, y_dev);
-    cairo_line_to(gr->cr, x_dev, y_dev + sz);
-    cairo_line_to(gr->cr, x_dev - sz, y_dev);
+grid_m4_flush(grid_m4_t *m4) {
+    if (!m4->open)
+        return;
+
+    int order[4] = { 0, 1, 2, 3 };
+    if (m4->at[2] < m4->at[1]) {
+        order[1] = 2;
+        order[2] = 1;
+    }
+
+    long prev = -1;
+    int k;
+    for (k = 0; k < 4; k++) {
+        int i = order[k];
+        if (m4->at[i] != prev)
+            grid_m4_emit(m4, m4->x[i], m4->y[i]);
+        prev = m4->at[i];
+    }
+
+    m4->open = false;
+
+    if (m4->path_size >= GRID_STREAM_PATH_MAX) {
+        grid_stroke(m4->gr);
+        grid_move_to(m4->gr, m4->last_x, m4->last_y);
+        m4->path_size = 1;
+    }
+}
+
+static void
+grid_m4_add(grid_m4_t *m4, double x, double y) {
+    if (!isfinite(x) || !isfinite(y)) {
+        // break the line at missing samples
+        grid_m4_flush(m4);
+        m4->connected = false;
+        return;
+    }
+
+    double c = floor(x);
+    long col = c < -1e9 ? -1000000000L : c > 1e9 ? 1000000000L : (long)c;
+    long seq = m4->seq++;
+
+    if (m4->open && col == m4->col) {
+        if (y < m4->y[1]) {
+            m4->x[1] = x;
+            m4->y[1] = y;
+            m4->at[1] = seq;
+        }
+        if (y > m4->y[2]) {
+            m4->x[2] = x;
+            m4->y[2] = y;
+            m4->at[2] = seq;
+        }
+        m4->x[3] = x;
+        m4->y[3] = y;
+        m4->at[3] = seq;
+        return;
+    }
+
+    grid_m4_flush(m4);
+
+    m4->open = true;
+    m4->col = col;
+    int i;
+    for (i = 0; i < 4; i++) {
+        m4->x[i] = x;
+        m4->y[i] = y;
+        m4->at[i] = seq;
+    }
 }
 
 /**
- * Draw a point at the given coordinates.
+ * Draw lines through a series supplied in chunks by `next`, in units of type
+ * `type`. Only a chunk of samples and a path bounded in size are held at
+ * once, so the series may be larger than memory. Consecutive samples that
+ * fall in the same device column are reduced to at most four points, so
+ * drawing a long series sorted by `x` costs a path proportional to the
+ * viewport's width. Non-finite samples break the line.
+ *
+ * Lines longer than the path bound are stroked in pieces, so their dash
+ * patterns restart at the joins.
  */
 void
-grid_point(grid_context_t *gr, const unit_t *x, const unit_t *y, 
-           const grid_par_t *par) 
+grid_stream_lines(grid_context_t *gr, grid_chunk_fn next, void *data,
+                  char *type, const grid_par_t *par)
 {
-    grid_apply_parameters(gr, par);
+    if (grid_is_culled(gr))
+        return;
 
-    double x_npc = unit_to_npc(gr, 'x', x);
-    double y_npc = unit_to_npc(gr, 'y', y);
+    grid_phase_t phase = grid_begin_phase(gr, GRID_OP_STREAM_LINES);
 
-    unit_t *psz = Parameter(point_size, par, gr->current_node->par, gr->par);
-    double psz_npc = unit_to_npc(gr, 'x', psz);
-    double temp = 0.0;
+    cairo_matrix_t m;
+    if (!grid_unit_to_dev_matrix(gr, type, &m)) {
+        grid_end_phase(gr, phase);
+        return;
+    }
 
-    cairo_matrix_t *m = gr->current_node->npc_to_dev;
-    cairo_matrix_transform_point(m, &x_npc, &y_npc);
-    cairo_matrix_transform_distance(m, &psz_npc, &temp);
+    grid_apply_parameters(gr, par);
+
+    double *xs = grid_scratch(gr, 2 * GRID_STREAM_CHUNK);
+    double *ys = xs + GRID_STREAM_CHUNK;
 
+    grid_m4_t m4 = { .gr = gr };
     cairo_new_path(gr->cr);
-    cairo_move_to(gr->cr, x_npc, y_npc);
 
-    char *pty = Parameter(point_type, par, gr->current_node->par, gr->par);
-    if (strcmp(pty, "round") == 0) {
-        grid_point_round(gr, x_npc, y_npc, psz_npc);
-    } else if (strcmp(pty, "square") == 0) {
-        grid_point_square(gr, x_npc, y_npc, psz_npc);
-    } else if (strcmp(pty, "diamond") == 0) {
-        grid_point_diamond(gr, x_npc, y_npc, psz_npc);
-    }else {
-        fprintf(stderr, "Unknown point type: '%s'\n", pty);
-        grid_point_round(gr, x_npc, y_npc, psz_npc);
+    int n, i;
+    while ((n = next(data, xs, ys, GRID_STREAM_CHUNK)) > 0) {
+        GridCount(gr, points, n);
+        for (i = 0; i < n; i++) {
+            cairo_matrix_transform_point(&m, xs + i, ys + i);
+            grid_m4_add(&m4, xs[i], ys[i]);
+        }
     }
 
-    cairo_fill(gr->cr);
-
+    grid_m4_flush(&m4);
+    grid_stroke(gr);
     grid_restore_parameters(gr, par);
+    grid_end_phase(gr, phase);
 }
 
 /**
- * Draw a point at each of the coordinates defined by `xs` and `ys`.
+ * Draw a point at each sample of a series supplied in chunks by `next`, in
+ * units of type `type`. Each chunk is filled as it arrives, so only one chunk
+ * of samples and its path are held at once. Non-finite samples are skipped.
  */
 void
-grid_points(grid_context_t *gr, const unit_array_t *xs, const unit_array_t *ys,
-            const grid_par_t *par)
+grid_stream_points(grid_context_t *gr, grid_chunk_fn next, void *data,
+                   char *type, const grid_par_t *par)
 {
-    grid_apply_parameters(gr, par);
+    if (grid_is_culled(gr))
+        return;
 
-    int x_size = unit_array_size(xs);
-    int y_size = unit_array_size(ys);
+    grid_phase_t phase = grid_begin_phase(gr, GRID_OP_STREAM_POINTS);
 
-    if (x_size <= 0) {
-        fprintf(stderr, "Warning: can't draw 0 length array.\n");
-        return;
-    } else if (x_size != y_size) {
-        fprintf(stderr, "Warning: can't draw arrays of different sizes.\n");
+    cairo_matrix_t m;
+    if (!grid_unit_to_dev_matrix(gr, type, &m)) {
+        grid_end_phase(gr, phase);
         return;
     }
 
-    double *xs_npc = malloc(x_size * sizeof(double));
-    double *ys_npc = malloc(x_size * sizeof(double));
+    grid_apply_parameters(gr, par);
 
-    unit_array_to_npc(xs_npc, gr, 'x', xs);
-    unit_array_to_npc(ys_npc, gr, 'y', ys);
+    double psz_dev;
+    grid_point_fn draw_fn = grid_point_shape(gr, &psz_dev);
 
-    unit_t *psz = Parameter(point_size, par, gr->current_node->par, gr->par);
-    double psz_npc = unit_to_npc(gr, 'x', psz);
-    double temp = 0.0;
+    double *xs = grid_scratch(gr, 2 * GRID_STREAM_CHUNK);
+    double *ys = xs + GRID_STREAM_CHUNK;
 
-    cairo_matrix_t *m = gr->current_node->npc_to_dev;
-    cairo_matrix_transform_distance(m, &psz_npc, &temp);
-
-    void (*draw_fn)(grid_context_t*, double, double, double);
-    char *pty = Parameter(point_type, par, gr->current_node->par, gr->par);
-    if (strcmp(pty, "round") == 0) {
-        draw_fn = grid_point_round;
-    } else if (strcmp(pty, "square") == 0) {
-        draw_fn = grid_point_square;
-    } else if (strcmp(pty, "diamond") == 0) {
-        draw_fn = grid_point_diamond;
-    } else {
-        fprintf(stderr, "Unknown point type: '%s'\n", pty);
-        draw_fn = grid_point_round;
-    }
+    int n, i;
+    while ((n = next(data, xs, ys, GRID_STREAM_CHUNK)) > 0) {
+        GridCount(gr, points, n);
+        cairo_new_path(gr->cr);
 
-    cairo_new_path(gr->cr);
+        for (i = 0; i < n; i++) {
+            if (!isfinite(xs[i]) || !isfinite(ys[i]))
+                continue;
 
-    int i;
-    for (i = 0; i < x_size; i++) {
-        cairo_matrix_transform_point(m, xs_npc + i, ys_npc + i);
-        draw_fn(gr, xs_npc[i], ys_npc[i], psz_npc);
+            cairo_matrix_transform_point(&m, xs + i, ys + i);
+            draw_fn(gr, xs[i], ys[i], psz_dev);
+        }
+
+        grid_fill(gr);
     }
 
-    cairo_fill(gr->cr);
     grid_restore_parameters(gr, par);
-
-    free(xs_npc);
-    free(ys_npc);
+    grid_end_phase(gr, phase);
 }
 
 /**
@@ -1199,6 +3704,11 @@ void
 grid_rect(grid_context_t *gr, const unit_t *x, const unit_t *y, 
           const unit_t *width, const unit_t *height, const grid_par_t *par) 
 {
+    if (grid_is_culled(gr))
+        return;
+
+    grid_phase_t phase = grid_begin_phase(gr, GRID_OP_RECT);
+
     grid_apply_parameters(gr, par);
 
     double x_npc = unit_to_npc(gr, 'x', x);
@@ -1206,27 +3716,31 @@ grid_rect(grid_context_t *gr, const unit_t *x, const unit_t *y,
     double w_npc = unit_to_npc(gr, 'x', width);
     double h_npc = unit_to_npc(gr, 'y', height);
 
-    cairo_matrix_t *m = gr->current_node->npc_to_dev;
+    cairo_matrix_t *m = &gr->current_node->npc_to_dev;
     cairo_matrix_transform_point(m, &x_npc, &y_npc);
     cairo_matrix_transform_distance(m, &w_npc, &h_npc);
 
+    // in hairline mode, snap the corners rather than the size
+    double x2_npc = grid_snap(gr, x_npc + w_npc);
+    double y2_npc = grid_snap(gr, y_npc + h_npc);
+    x_npc = grid_snap(gr, x_npc);
+    y_npc = grid_snap(gr, y_npc);
+
     cairo_new_path(gr->cr);
-    cairo_rectangle(gr->cr, x_npc, y_npc, w_npc, h_npc);
+    cairo_rectangle(gr->cr, x_npc, y_npc, x2_npc - x_npc, y2_npc - y_npc);
 
-    rgba_t *col;
-    if ((par && (col = par->fill)) || 
-        (gr->current_node->par && (col = gr->current_node->par->fill))) 
+    // only a fill passed to the call or set on the viewport is drawn
+    if ((par && par->fill) ||
+        (gr->current_node->par && gr->current_node->par->fill))
     {
-        cairo_set_source_rgba(gr->cr, col->red, col->green,
-                              col->blue, col->alpha);
-        cairo_fill_preserve(gr->cr);
-
-        col = Parameter(color, par, gr->current_node->par, gr->par);
-        grid_apply_color(gr, col);
+        grid_apply_color(gr, gr->drawing.fill);
+        grid_fill_preserve(gr);
+        grid_apply_color(gr, gr->drawing.color);
     }
 
-    cairo_stroke(gr->cr);
+    grid_stroke(gr);
     grid_restore_parameters(gr, par);
+    grid_end_phase(gr, phase);
 }
 
 /**
@@ -1244,6 +3758,91 @@ grid_full_rect(grid_context_t *gr, const grid_par_t *par) {
     grid_rect(gr, &zero, &zero, &one, &one, par);
 }
 
+/**
+ * Draw a matrix of values as an image filling the rectangle with lower-left
+ * corner at `(x, y)`, colored by `map`. `values` holds `nrow` rows of `ncol`
+ * values each; row 0 is drawn at the bottom. The values are mapped to an
+ * image with one pixel per value, which is scaled onto the rectangle in a
+ * single composite, sampled as given by `filter`. If the context has a
+ * surface pool, the image is taken from it.
+ */
+void
+grid_raster(grid_context_t *gr, const unit_t *x, const unit_t *y, 
+            const unit_t *width, const unit_t *height, int nrow, int ncol,
+            const double *values, const grid_color_map_t *map,
+            grid_raster_filter_t filter)
+{
+    if (grid_is_culled(gr))
+        return;
+
+    grid_phase_t phase = grid_begin_phase(gr, GRID_OP_RASTER);
+
+    if (nrow <= 0 || ncol <= 0) {
+        fprintf(stderr, "Warning: can't draw an empty raster.\n");
+        grid_end_phase(gr, phase);
+        return;
+    }
+
+    double x_dev = unit_to_npc(gr, 'x', x);
+    double y_dev = unit_to_npc(gr, 'y', y);
+    double w_dev = unit_to_npc(gr, 'x', width);
+    double h_dev = unit_to_npc(gr, 'y', height);
+
+    cairo_matrix_t *m = &gr->current_node->npc_to_dev;
+    cairo_matrix_transform_point(m, &x_dev, &y_dev);
+    cairo_matrix_transform_distance(m, &w_dev, &h_dev);
+
+    if (w_dev == 0 || h_dev == 0) {
+        grid_end_phase(gr, phase);
+        return;
+    }
+
+    cairo_surface_t *image;
+    if (gr->surface_pool)
+        image = grid_surface_pool_acquire(gr->surface_pool, 
+                                          CAIRO_FORMAT_ARGB32, ncol, nrow);
+    else
+        image = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, ncol, nrow);
+
+    // image rows run from the top down
+    cairo_surface_flush(image);
+    unsigned char *data = cairo_image_surface_get_data(image);
+    int stride = cairo_image_surface_get_stride(image);
+    int row;
+    for (row = 0; row < nrow; row++) {
+        grid_color_map_apply(map, ncol, values + (long)row * ncol, 
+                             (uint32_t*)(data + (long)(nrow - 1 - row) * 
+                                                stride));
+    }
+    cairo_surface_mark_dirty(image);
+
+    // map the rectangle onto the image, whose top is at y + h
+    cairo_pattern_t *pattern = cairo_pattern_create_for_surface(image);
+    cairo_matrix_t to_image;
+    cairo_matrix_init(&to_image, ncol / w_dev, 0, 0, -nrow / h_dev,
+                      -x_dev * ncol / w_dev, (y_dev + h_dev) * nrow / h_dev);
+    cairo_pattern_set_matrix(pattern, &to_image);
+    cairo_pattern_set_filter(pattern, filter == GRID_RASTER_BILINEAR ?
+                             CAIRO_FILTER_BILINEAR : CAIRO_FILTER_NEAREST);
+    cairo_pattern_set_extend(pattern, CAIRO_EXTEND_PAD);
+
+    cairo_t *cr = gr->cr;
+    cairo_save(cr);
+    cairo_set_source(cr, pattern);
+    cairo_new_path(cr);
+    cairo_rectangle(cr, x_dev, y_dev, w_dev, h_dev);
+    grid_fill(gr);
+    cairo_restore(cr);
+    cairo_pattern_destroy(pattern);
+
+    if (gr->surface_pool)
+        grid_surface_pool_release(gr->surface_pool, image);
+    else
+        cairo_surface_destroy(image);
+
+    grid_end_phase(gr, phase);
+}
+
 /**
  * Draw a polygon with vertices at the given coordinates.
  */
@@ -1251,6 +3850,11 @@ void
 grid_polygon(grid_context_t *gr, const unit_array_t* xs, const unit_array_t *ys,
              const grid_par_t *par)
 {
+    if (grid_is_culled(gr))
+        return;
+
+    grid_phase_t phase = grid_begin_phase(gr, GRID_OP_POLYGON);
+
     grid_apply_parameters(gr, par);
 
     int x_size = unit_array_size(xs);
@@ -1258,92 +3862,102 @@ grid_polygon(grid_context_t *gr, const unit_array_t* xs, const unit_array_t *ys,
 
     if (x_size <= 0) {
         fprintf(stderr, "Warning: can't draw 0 length array.\n");
+        grid_end_phase(gr, phase);
         return;
     } else if (x_size != y_size) {
         fprintf(stderr, "Warning: can't draw arrays of different sizes.\n");
+        grid_end_phase(gr, phase);
         return;
     }
 
-    double *xs_npc = malloc(x_size * sizeof(double));
-    double *ys_npc = malloc(x_size * sizeof(double));
+    GridCount(gr, points, x_size);
 
-    unit_array_to_npc(xs_npc, gr, 'x', xs);
-    unit_array_to_npc(ys_npc, gr, 'y', ys);
+    double *xs_npc, *ys_npc;
+    grid_unit_arrays_to_npc(gr, xs, ys, x_size, &xs_npc, &ys_npc);
 
-    cairo_matrix_t *m = gr->current_node->npc_to_dev;
+    cairo_matrix_t *m = &gr->current_node->npc_to_dev;
     cairo_matrix_transform_point(m, xs_npc, ys_npc);
     cairo_new_path(gr->cr);
-    cairo_move_to(gr->cr, xs_npc[0], ys_npc[0]);
+    grid_move_to(gr, xs_npc[0], ys_npc[0]);
 
     int i;
     for (i = 1; i < x_size; i++) {
         cairo_matrix_transform_point(m, xs_npc + i, ys_npc + i);
-        cairo_line_to(gr->cr, xs_npc[i], ys_npc[i]);
+        grid_line_to(gr, xs_npc[i], ys_npc[i]);
     }
 
     cairo_close_path(gr->cr);
 
-    rgba_t *fill = Parameter(fill, par, gr->current_node->par, gr->par);
-    if (fill) {
-        rgba_t *color = grid_set_color(gr, fill);
-        cairo_fill_preserve(gr->cr);
-        grid_set_color(gr, color);
+    if (gr->drawing.fill) {
+        grid_apply_color(gr, gr->drawing.fill);
+        grid_fill_preserve(gr);
+        grid_apply_color(gr, gr->drawing.color);
     }
 
-    cairo_stroke(gr->cr);
+    grid_stroke(gr);
     grid_restore_parameters(gr, par);
-
-    free(xs_npc);
-    free(ys_npc);
+    grid_end_phase(gr, phase);
 }
 
 /**
- * Allocates a \ref unit_t indicating where to place the `x`-coordinate so that
- * text with width `width_npc` has the alignment given by `just`.
+ * Units in the storage given to \ref grid_just_to_x and \ref grid_vjust_to_y.
  */
-static unit_t*
-grid_just_to_x(char *just, const cairo_text_extents_t *extents) {
-    unit_t *x;
-
-    if (strncmp(just, "left", 1) == 0) {
-        x = unit(1, "em");
-    } else if (strncmp(just, "right", 1) == 0) {
-        x = unit_sub(unit_sub(unit(1, "npc"), unit(1, "em")),
-                     unit(extents->width + extents->x_bearing, "px"));
-    } else if (strncmp(just, "center", 1) == 0) {
-        x = unit_sub(unit(0.5, "npc"), 
-                     unit(extents->width / 2.0 + extents->x_bearing, "px"));
+#define GRID_JUST_UNITS 5
+
+/**
+ * Build a \ref unit_t in `u`, which holds `GRID_JUST_UNITS` units, indicating
+ * where to place the `x`-coordinate so that text with the given extents has
+ * the alignment given by `just`.
+ *
+ * \return The root of the unit, one of `u`.
+ */
+static const unit_t*
+grid_just_to_x(uint8_t just, const cairo_text_extents_t *extents, unit_t *u) {
+    if (just == GRID_JUST_LEFT) {
+        u[0] = Unit(1, "em");
+    } else if (just == GRID_JUST_RIGHT) {
+        u[1] = Unit(1, "npc");
+        u[2] = Unit(1, "em");
+        u[3] = (unit_t){ .type = "-", .arg1 = u + 1, .arg2 = u + 2 };
+        u[4] = Unit(extents->width + extents->x_bearing, "px");
+        u[0] = (unit_t){ .type = "-", .arg1 = u + 3, .arg2 = u + 4 };
+    } else if (just == GRID_JUST_CENTER) {
+        u[1] = Unit(0.5, "npc");
+        u[2] = Unit(extents->width / 2.0 + extents->x_bearing, "px");
+        u[0] = (unit_t){ .type = "-", .arg1 = u + 1, .arg2 = u + 2 };
     } else {
-        fprintf(stderr, "Warning: unknown justification '%s'\n", just);
-        x = unit(0, "npc");
+        u[0] = Unit(0, "npc");
     }
 
-    return x;
+    return u;
 }
 
 /**
- * Allocates a \ref unit_t indicating where to place the `y`-coordinate so that
- * text has the vertical alignment given by `vjust`.
+ * Build a \ref unit_t in `u`, which holds `GRID_JUST_UNITS` units, indicating
+ * where to place the `y`-coordinate so that text has the vertical alignment
+ * given by `vjust`.
+ *
+ * \return The root of the unit, one of `u`.
  */
-static unit_t*
-grid_vjust_to_y(char *vjust, const cairo_text_extents_t *extents) {
-    unit_t *y;
-
-    if (strncmp(vjust, "middle", 1) == 0) {
+static const unit_t*
+grid_vjust_to_y(uint8_t vjust, const cairo_text_extents_t *extents, unit_t *u) {
+    if (vjust == GRID_JUST_MIDDLE) {
         // "add" instead of "sub" because y_bearing is measured with a downward
         // y-axis.
-        y = unit_add(unit(0.5, "npc"), 
-                     unit(extents->height / 2.0 + extents->y_bearing, "px"));
-    } else if (strncmp(vjust, "bottom", 1) == 0) {
-        y = unit(1, "line");
-    } else if (strncmp(vjust, "top", 1) == 0) {
-        y = unit_sub(unit(1, "npc"), unit(1, "line"));
+        u[1] = Unit(0.5, "npc");
+        u[2] = Unit(extents->height / 2.0 + extents->y_bearing, "px");
+        u[0] = (unit_t){ .type = "+", .arg1 = u + 1, .arg2 = u + 2 };
+    } else if (vjust == GRID_JUST_BOTTOM) {
+        u[0] = Unit(1, "line");
+    } else if (vjust == GRID_JUST_TOP) {
+        u[1] = Unit(1, "npc");
+        u[2] = Unit(1, "line");
+        u[0] = (unit_t){ .type = "-", .arg1 = u + 1, .arg2 = u + 2 };
     } else {
-        fprintf(stderr, "Warning: unknown vertical justification '%s'\n", vjust);
-        y = unit(0, "npc");
+        u[0] = Unit(0, "npc");
     }
 
-    return y;
+    return u;
 }
 
 /**
@@ -1366,37 +3980,30 @@ void
 grid_text(grid_context_t *gr, const char *text, 
           const unit_t *x, const unit_t *y, const grid_par_t *par) 
 {
+    if (grid_is_culled(gr))
+        return;
+
+    grid_phase_t phase = grid_begin_phase(gr, GRID_OP_TEXT);
+
     grid_apply_parameters(gr, par);
 
     cairo_t *cr = gr->cr;
     cairo_text_extents_t text_extents;
-    cairo_text_extents(cr, text, &text_extents);
-
-    unit_t *my_x = NULL; 
+    grid_text_extents(gr, text, &text_extents);
 
-    if (!x) {
-        if (par && par->just) 
-            my_x = grid_just_to_x(par->just, &text_extents);
-        else
-            my_x = grid_just_to_x(gr->par->just, &text_extents);
-
-        x = my_x;
-    }
+    unit_t my_x[GRID_JUST_UNITS]; 
 
-    unit_t *my_y = NULL;
+    if (!x)
+        x = grid_just_to_x(gr->drawing.just, &text_extents, my_x);
 
-    if (!y) {
-        if (par && par->vjust) 
-            my_y = grid_vjust_to_y(par->vjust, &text_extents);
-        else
-            my_y = grid_vjust_to_y(gr->par->vjust, &text_extents);
+    unit_t my_y[GRID_JUST_UNITS];
 
-        y = my_y;
-    }
+    if (!y)
+        y = grid_vjust_to_y(gr->drawing.vjust, &text_extents, my_y);
 
     double x_npc = unit_to_npc(gr, 'x', x);
     double y_npc = unit_to_npc(gr, 'y', y);
-    cairo_matrix_t *npc_to_dev = gr->current_node->npc_to_dev;
+    cairo_matrix_t *npc_to_dev = &gr->current_node->npc_to_dev;
     cairo_matrix_transform_point(npc_to_dev, &x_npc, &y_npc);
 
     // unless we temporarily flip the coordinate system, cairo will draw the
@@ -1413,11 +4020,7 @@ grid_text(grid_context_t *gr, const char *text,
 
     grid_restore_parameters(gr, par);
     cairo_set_matrix(cr, &m);
-
-    if (my_x)
-        free_unit(my_x);
-    if (my_y)
-        free_unit(my_y);
+    grid_end_phase(gr, phase);
 }
 
 /**
@@ -1452,38 +4055,116 @@ grid_scale_step_and_format(double scale, char *fmt, int n) {
 }
 
 /**
- * Add labeled tick marks to the bottom of the current viewport. Tick location
- * and labels are generated from the viewport's native coordinate system.
+ * Grow the arrays of `ticks`, which share one allocation, to hold `n` ticks.
+ * They're allocated through `owner` if it isn't `NULL`, and through the
+ * allocator in effect otherwise.
  */
-void
-grid_xaxis(grid_context_t *gr, const grid_par_t *par) {
-    grid_apply_parameters(gr, par);
+static void
+grid_reserve_ticks(grid_context_t *owner, grid_ticks_t *ticks, int n) {
+    if (n <= ticks->capacity)
+        return;
 
-    double x_ntv, y_ntv, w_ntv, h_ntv;
-    x_ntv = y_ntv = 0.0;
-    w_ntv = h_ntv = 1.0;
-    cairo_matrix_transform_point(gr->current_node->npc_to_ntv, &x_ntv, &y_ntv);
-    cairo_matrix_transform_distance(gr->current_node->npc_to_ntv, &w_ntv, &h_ntv);
+    size_t old_size = grid_ticks_bytes(ticks->capacity);
+    double *block;
+    if (owner) {
+        grid_context_free(owner, ticks->at, old_size);
+        block = grid_context_malloc(owner, grid_ticks_bytes(n));
+    } else {
+        grid_free(ticks->at, old_size);
+        block = grid_malloc(grid_ticks_bytes(n));
+    }
+
+    ticks->capacity = n;
+    ticks->at = block;
+    ticks->label_width = block + n;
+    ticks->label_height = block + 2 * n;
+    ticks->labels = (void*)(block + 3 * n);
+}
 
-    double scale = log10(w_ntv);
+/**
+ * Fill `ticks` with the tick marks and labels for a native range. See
+ * \ref new_grid_ticks.
+ */
+static void
+grid_fill_ticks(grid_context_t *gr, grid_context_t *owner, grid_ticks_t *ticks,
+                double origin, double size, const grid_par_t *par)
+{
+    grid_phase_t phase = grid_begin_phase(gr, GRID_OP_TICKS);
+
+    double scale = log10(size);
     char fmt[20];
     double step = grid_scale_step_and_format(scale, fmt, 19);
 
     // TODO do a similar adjustment for scale < 0?
 
-    // find the smallest tick greater than x_ntv
-    double first_tick = ceil(x_ntv / step) * step; 
+    // find the smallest tick greater than origin
+    double first_tick = ceil(origin / step) * step; 
 
     // count the number of ticks we can fit
     int n_ticks = 0;
     double t;
-    for (t = first_tick; t < x_ntv + w_ntv; t += step)
+    for (t = first_tick; t < origin + size; t += step)
         n_ticks++;
 
-    double ticks[n_ticks];
+    grid_reserve_ticks(owner, ticks, n_ticks);
+    ticks->size = n_ticks;
+
+    grid_apply_parameters(gr, par);
+
+    cairo_text_extents_t text_extents; 
     int i;
-    for (i = 0; i < n_ticks; i++)
-        ticks[i] = first_tick + i*step;
+    for (i = 0; i < n_ticks; i++) {
+        ticks->at[i] = first_tick + i*step;
+        snprintf(ticks->labels[i], GRID_TICK_LABEL_SIZE, fmt, ticks->at[i]);
+        grid_text_extents(gr, ticks->labels[i], &text_extents);
+        ticks->label_width[i] = text_extents.width;
+        ticks->label_height[i] = text_extents.height;
+    }
+
+    grid_restore_parameters(gr, par);
+    grid_end_phase(gr, phase);
+}
+
+/**
+ * Compute the tick marks and labels for a native range `[origin, origin +
+ * size)`. Labels are measured with the font given by `par` (falling back on
+ * the context's parameters), so the ticks can be drawn by
+ * \ref grid_xaxis_ticks and \ref grid_yaxis_ticks in any viewport of any
+ * context that uses the same font and has the same range.
+ */
+grid_ticks_t*
+new_grid_ticks(grid_context_t *gr, double origin, double size, 
+               const grid_par_t *par)
+{
+    grid_ticks_t *ticks = grid_malloc(sizeof(grid_ticks_t));
+    *ticks = (grid_ticks_t){ 0 };
+    grid_fill_ticks(gr, NULL, ticks, origin, size, par);
+    return ticks;
+}
+
+/**
+ * Deallocate a \ref grid_ticks_t.
+ */
+void
+free_grid_ticks(grid_ticks_t *ticks) {
+    grid_free(ticks->at, grid_ticks_bytes(ticks->capacity));
+    grid_free(ticks, sizeof(grid_ticks_t));
+}
+
+/**
+ * Add precomputed tick marks and labels to the bottom of the current viewport.
+ * See \ref new_grid_ticks.
+ */
+void
+grid_xaxis_ticks(grid_context_t *gr, const grid_ticks_t *ticks, 
+                 const grid_par_t *par)
+{
+    if (grid_is_culled(gr))
+        return;
+
+    grid_phase_t phase = grid_begin_phase(gr, GRID_OP_AXIS);
+
+    grid_apply_parameters(gr, par);
 
     unit_t height = Unit(0.4, "lines");
     double height_npc = unit_to_npc(gr, 'y', &height);
@@ -1491,77 +4172,55 @@ grid_xaxis(grid_context_t *gr, const grid_par_t *par) {
     unit_t x_unit = { .type = "native" };
     unit_t y_unit = Unit(-1.5, "line");
     double x1_npc, x2_npc, y1_npc, y2_npc;
-    char buf[20];
-    cairo_text_extents_t text_extents; 
     cairo_matrix_t m, id;
     id = (cairo_matrix_t){ .xx = 1, .yy = 1 };
 
-    for (i = 0; i < n_ticks; i++) {
-        x_unit.value = ticks[i];
+    int i;
+    for (i = 0; i < ticks->size; i++) {
+        x_unit.value = ticks->at[i];
         x1_npc = unit_to_npc(gr, 'x', &x_unit);
         y1_npc = 0;
         x2_npc = x1_npc;
         y2_npc = -height_npc;
-        cairo_matrix_transform_point(gr->current_node->npc_to_dev, &x1_npc, &y1_npc);
-        cairo_matrix_transform_point(gr->current_node->npc_to_dev, &x2_npc, &y2_npc);
+        cairo_matrix_transform_point(&gr->current_node->npc_to_dev, &x1_npc, &y1_npc);
+        cairo_matrix_transform_point(&gr->current_node->npc_to_dev, &x2_npc, &y2_npc);
 
         cairo_new_path(gr->cr);
-        cairo_move_to(gr->cr, x1_npc, y1_npc);
-        cairo_line_to(gr->cr, x2_npc, y2_npc);
-        cairo_stroke(gr->cr);
+        grid_move_to(gr, x1_npc, y1_npc);
+        grid_line_to(gr, x2_npc, y2_npc);
+        grid_stroke(gr);
 
-        snprintf(buf, 20, fmt, ticks[i]);
-        cairo_text_extents(gr->cr, buf, &text_extents);
         x1_npc = unit_to_npc(gr, 'x', &x_unit);
         y1_npc = unit_to_npc(gr, 'y', &y_unit);
-        cairo_matrix_transform_point(gr->current_node->npc_to_dev, &x1_npc, &y1_npc);
-        x1_npc -= text_extents.width / 2;
+        cairo_matrix_transform_point(&gr->current_node->npc_to_dev, &x1_npc, &y1_npc);
+        x1_npc -= ticks->label_width[i] / 2;
 
         cairo_get_matrix(gr->cr, &m);
         cairo_set_matrix(gr->cr, &id);
         cairo_new_path(gr->cr);
         cairo_move_to(gr->cr, x1_npc, m.y0 - y1_npc);
-        cairo_show_text(gr->cr, buf);
+        cairo_show_text(gr->cr, ticks->labels[i]);
         cairo_set_matrix(gr->cr, &m);
     }
 
     grid_restore_parameters(gr, par);
+    grid_end_phase(gr, phase);
 }
 
 /**
- * Add labeled tick marks to the left side of the current viewport. Tick
- * location and labels are generated from the viewport's native coordinate
- * system.
+ * Add precomputed tick marks and labels to the left side of the current
+ * viewport. See \ref new_grid_ticks.
  */
 void
-grid_yaxis(grid_context_t *gr, const grid_par_t *par) {
-    grid_apply_parameters(gr, par);
-
-    double x_ntv, y_ntv, w_ntv, h_ntv;
-    x_ntv = y_ntv = 0.0;
-    w_ntv = h_ntv = 1.0;
-    cairo_matrix_transform_point(gr->current_node->npc_to_ntv, &x_ntv, &y_ntv);
-    cairo_matrix_transform_distance(gr->current_node->npc_to_ntv, &w_ntv, &h_ntv);
-
-    double scale = log10(h_ntv);
-    char fmt[20];
-    double step = grid_scale_step_and_format(scale, fmt, 19);
-
-    // TODO do a similar adjustment for scale < 0?
-
-    // find the smallest tick greater than x_ntv
-    double first_tick = ceil(y_ntv / step) * step; 
+grid_yaxis_ticks(grid_context_t *gr, const grid_ticks_t *ticks, 
+                 const grid_par_t *par)
+{
+    if (grid_is_culled(gr))
+        return;
 
-    // count the number of ticks we can fit
-    int n_ticks = 0;
-    double t;
-    for (t = first_tick; t < y_ntv + h_ntv; t += step)
-        n_ticks++;
+    grid_phase_t phase = grid_begin_phase(gr, GRID_OP_AXIS);
 
-    double ticks[n_ticks];
-    int i;
-    for (i = 0; i < n_ticks; i++)
-        ticks[i] = first_tick + i*step;
+    grid_apply_parameters(gr, par);
 
     unit_t width = Unit(0.75, "em");
     double width_npc = unit_to_npc(gr, 'x', &width);
@@ -1569,41 +4228,77 @@ grid_yaxis(grid_context_t *gr, const grid_par_t *par) {
     unit_t x_unit = Unit(-1.5, "em");
     unit_t y_unit = { .type = "native" };
     double x1_npc, x2_npc, y1_npc, y2_npc;
-    char buf[20];
-    cairo_text_extents_t text_extents; 
     cairo_matrix_t m, id;
     id = (cairo_matrix_t){ .xx = 1, .yy = 1 };
 
-    for (i = 0; i < n_ticks; i++) {
-        y_unit.value = ticks[i];
+    int i;
+    for (i = 0; i < ticks->size; i++) {
+        y_unit.value = ticks->at[i];
         x1_npc = 0;
         y1_npc = unit_to_npc(gr, 'y', &y_unit);
         x2_npc = -width_npc;
         y2_npc = y1_npc;
-        cairo_matrix_transform_point(gr->current_node->npc_to_dev, &x1_npc, &y1_npc);
-        cairo_matrix_transform_point(gr->current_node->npc_to_dev, &x2_npc, &y2_npc);
+        cairo_matrix_transform_point(&gr->current_node->npc_to_dev, &x1_npc, &y1_npc);
+        cairo_matrix_transform_point(&gr->current_node->npc_to_dev, &x2_npc, &y2_npc);
 
         cairo_new_path(gr->cr);
-        cairo_move_to(gr->cr, x1_npc, y1_npc);
-        cairo_line_to(gr->cr, x2_npc, y2_npc);
-        cairo_stroke(gr->cr);
+        grid_move_to(gr, x1_npc, y1_npc);
+        grid_line_to(gr, x2_npc, y2_npc);
+        grid_stroke(gr);
 
-        snprintf(buf, 20, fmt, ticks[i]);
-        cairo_text_extents(gr->cr, buf, &text_extents);
         x1_npc = unit_to_npc(gr, 'x', &x_unit);
         y1_npc = unit_to_npc(gr, 'y', &y_unit);
-        cairo_matrix_transform_point(gr->current_node->npc_to_dev, &x1_npc, &y1_npc);
-        x1_npc -= text_extents.width;
-        y1_npc -= text_extents.height / 2;
+        cairo_matrix_transform_point(&gr->current_node->npc_to_dev, &x1_npc, &y1_npc);
+        x1_npc -= ticks->label_width[i];
+        y1_npc -= ticks->label_height[i] / 2;
 
         cairo_get_matrix(gr->cr, &m);
         cairo_set_matrix(gr->cr, &id);
         cairo_new_path(gr->cr);
         cairo_move_to(gr->cr, x1_npc, m.y0 - y1_npc);
-        cairo_show_text(gr->cr, buf);
+        cairo_show_text(gr->cr, ticks->labels[i]);
         cairo_set_matrix(gr->cr, &m);
     }
 
     grid_restore_parameters(gr, par);
+    grid_end_phase(gr, phase);
+}
+
+/**
+ * Add labeled tick marks to the bottom of the current viewport. Tick location
+ * and labels are generated from the viewport's native coordinate system.
+ */
+void
+grid_xaxis(grid_context_t *gr, const grid_par_t *par) {
+    if (grid_is_culled(gr))
+        return;
+
+    grid_phase_t phase = grid_begin_phase(gr, GRID_OP_AXIS);
+
+    double x_ntv, y_ntv, w_ntv, h_ntv;
+    grid_node_ntv(gr->current_node, &x_ntv, &y_ntv, &w_ntv, &h_ntv);
+
+    grid_fill_ticks(gr, gr, &gr->axis_ticks, x_ntv, w_ntv, par);
+    grid_xaxis_ticks(gr, &gr->axis_ticks, par);
+    grid_end_phase(gr, phase);
 }
 
+/**
+ * Add labeled tick marks to the left side of the current viewport. Tick
+ * location and labels are generated from the viewport's native coordinate
+ * system.
+ */
+void
+grid_yaxis(grid_context_t *gr, const grid_par_t *par) {
+    if (grid_is_culled(gr))
+        return;
+
+    grid_phase_t phase = grid_begin_phase(gr, GRID_OP_AXIS);
+
+    double x_ntv, y_ntv, w_ntv, h_ntv;
+    grid_node_ntv(gr->current_node, &x_ntv, &y_ntv, &w_ntv, &h_ntv);
+
+    grid_fill_ticks(gr, gr, &gr->axis_ticks, y_ntv, h_ntv, par);
+    grid_yaxis_ticks(gr, &gr->axis_ticks, par);
+    grid_end_phase(gr, phase);
+}
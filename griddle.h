@@ -1,9 +1,14 @@
 #ifndef Griddle_h
 #define Griddle_h
 
+#include "grid_alloc.h"
+#include "grid_color.h"
+#include "grid_range.h"
+#include "grid_trace.h"
 #include "grid_units.h"
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <cairo.h>
 
 // types
@@ -17,12 +22,24 @@ typedef struct {
 } rgba_t;
 
 /**
- * Graphical parameters.
+ * Graphical parameters. A `NULL` field falls back on the current viewport's
+ * parameters and then on the context's. Draw functions and setters borrow
+ * parameters, so a struct on the stack whose fields point at literals and
+ * static colors is the usual way to pass them; a struct from
+ * \ref new_grid_default_par owns its fields.
  */
 typedef struct {
     rgba_t *color, *fill;
     char *line_type, *point_type, *just, *vjust;
     unit_t *line_width, *point_size, *font_size;
+    char *antialias;    /**< "default", "none", "fast", "good", or "best", as
+                             for `cairo_set_antialias`. */
+    bool *hairline;     /**< Stroke one device pixel wide, along paths
+                             snapped to pixel centers, so lines parallel to
+                             the axes cover whole pixels. */
+    bool *fast_lines;   /**< Rasterize thin solid lines on image surfaces
+                             directly, rather than stroke them with cairo.
+                             See \ref grid_lines. */
 } grid_par_t;
 
 /**
@@ -37,7 +54,8 @@ typedef struct {
 } grid_viewport_t;
 
 /**
- * Nodes are viewports that have been captured in the viewport tree.
+ * Nodes are viewports that have been captured in the viewport tree. Nodes are
+ * allocated from a pool owned by the grid context.
  */
 typedef struct __grid_viewport_node_t {
     struct __grid_viewport_node_t *parent, 
@@ -49,11 +67,238 @@ typedef struct __grid_viewport_node_t {
                                                 for younger brother). */
                                   *child;
 
-    char *name;
-    cairo_matrix_t *npc_to_ntv, *npc_to_dev;
+    char *name;         /**< Points to `name_buf` for short names. */
+    char name_buf[24];
+    cairo_matrix_t npc_to_ntv, npc_to_dev;
     grid_par_t *par;
+
+    compiled_unit_t x, y, w, h; /**< Geometry relative to the parent. */
+    compiled_unit_t rest_x, rest_y; /**< For cells of a layout, the space its
+                                         fixed columns and rows leave to the
+                                         null ones, of which the `null` terms
+                                         of the geometry are the shares. */
+    bool has_ntv;
+    double x_ntv, y_ntv, w_ntv, h_ntv;
+    double dev_per_line, dev_per_em; /**< Font metrics when the node was
+                                          pushed. */
+    unsigned long layout_generation; /**< Layout the transforms are valid
+                                          for. */
+
+    struct __grid_viewport_node_t *next_named; /**< Next node in the same
+                                                    bucket of the context's
+                                                    name index. */
+    int depth;         /**< Number of ancestors. */
+    unsigned long seq; /**< Push order; younger siblings have larger values. */
 } grid_viewport_node_t;
 
+/**
+ * A grid of rows and columns that viewports can be pushed into by cell. Row
+ * heights and column widths may mix any units; `null` units share whatever
+ * space the other units leave, in proportion to their values. The layout is
+ * solved once, when it is created, into edges that are linear in the parent's
+ * size; the edges evaluated for the most recent parent geometry are cached.
+ * Rows run from the top of the parent down. See
+ * \ref grid_push_layout_viewport.
+ */
+typedef struct {
+    int nrow, ncol;
+    compiled_unit_t *row_y, *row_h; /**< Bottom edge and height of each row. */
+    compiled_unit_t *col_x, *col_w; /**< Left edge and width of each column. */
+    compiled_unit_t row_rest, col_rest; /**< Space the fixed rows or columns
+                                             leave to the null ones. */
+
+    // npc edges for the parent geometry in `cache_key`
+    bool cached;
+    double cache_key[8];
+    double *row_npc, *col_npc; /**< Edge and size of each row or column. */
+} grid_layout_t;
+
+/**
+ * A cached rendering of a group of drawing commands. The cache is keyed by the
+ * geometry of the viewport the layer was started in and by the graphical
+ * parameters in effect. See \ref grid_begin_layer.
+ */
+typedef struct {
+    cairo_pattern_t *pattern; /**< The cached drawing, or `NULL`. */
+    cairo_matrix_t npc_to_dev, npc_to_ntv;
+    uint64_t par_hash;
+} grid_layer_t;
+
+/**
+ * Counters describing how a \ref grid_surface_pool_t has been used.
+ */
+typedef struct {
+    long hits,      /**< Acquisitions satisfied by a pooled surface. */
+         misses,    /**< Acquisitions that created a new surface. */
+         releases,  /**< Surfaces returned to the pool. */
+         evictions; /**< Pooled surfaces destroyed to respect the capacity. */
+} grid_surface_pool_stats_t;
+
+/**
+ * A bounded pool of image surfaces keyed by format, width, and height.
+ * Acquiring and releasing surfaces lock the pool, so contexts on several
+ * threads can share one.
+ */
+typedef struct {
+    cairo_surface_t **surfaces; /**< Idle surfaces, least recently released
+                                     first. */
+    int size, capacity;
+    grid_surface_pool_stats_t stats;
+    pthread_mutex_t lock;
+} grid_surface_pool_t;
+
+/**
+ * Supplies a series in chunks: stores up to `capacity` samples in `xs` and
+ * `ys` and returns how many it stored, or 0 at the end of the series.
+ */
+typedef int (*grid_chunk_fn)(void *data, double *xs, double *ys, int capacity);
+
+#define GRID_TICK_LABEL_SIZE 20
+
+/**
+ * Tick marks and labels for one axis. See \ref new_grid_ticks.
+ */
+typedef struct {
+    int size;
+    int capacity;                            /**< Allocated length of the
+                                                  arrays. */
+    double *at;                              /**< Native locations. */
+    char (*labels)[GRID_TICK_LABEL_SIZE];
+    double *label_width, *label_height;      /**< Label extents in device
+                                                  units. */
+} grid_ticks_t;
+
+typedef enum {
+    GRID_LINE_SOLID,
+    GRID_LINE_DASHED,
+    GRID_LINE_DOTTED,
+    GRID_LINE_DOTDASH
+} grid_line_type_t;
+
+typedef enum {
+    GRID_POINT_ROUND,
+    GRID_POINT_SQUARE,
+    GRID_POINT_DIAMOND
+} grid_point_type_t;
+
+/**
+ * Horizontal and vertical justifications. `GRID_JUST_NONE` stands for an
+ * unrecognized justification, which places text at the viewport's origin.
+ */
+typedef enum {
+    GRID_JUST_NONE,
+    GRID_JUST_LEFT,
+    GRID_JUST_RIGHT,
+    GRID_JUST_CENTER,
+    GRID_JUST_TOP,
+    GRID_JUST_MIDDLE,
+    GRID_JUST_BOTTOM
+} grid_just_t;
+
+/**
+ * Per-point aesthetics for \ref grid_styled_points. Every field is optional:
+ * a `NULL` field falls back on the graphical parameters in effect, as in
+ * \ref grid_points. The arrays hold one value per point.
+ */
+typedef struct {
+    const uint32_t *colors;     /**< Colors packed by \ref grid_pack_color. */
+    const uint8_t *color_index; /**< Indices into `palette`, used if `colors`
+                                     is `NULL`. Points whose index is past the
+                                     end of the palette get the color in
+                                     effect. */
+    const uint32_t *palette;    /**< Packed colors. */
+    int palette_size;
+    const unit_array_t *sizes;  /**< Point sizes, as for `point_size`. */
+    const uint8_t *shapes;      /**< \ref grid_point_type_t values. */
+} grid_point_style_t;
+
+/**
+ * How \ref grid_raster samples its image when scaling it.
+ */
+typedef enum {
+    GRID_RASTER_NEAREST,  /**< Each value fills a rectangle of its own. */
+    GRID_RASTER_BILINEAR  /**< Colors blend between the values' centers. */
+} grid_raster_filter_t;
+
+/**
+ * Graphical parameters resolved for drawing: names are parsed to enums,
+ * colors are packed as `0xAARRGGBB`, and sizes are compiled. A context keeps
+ * its global parameters in this form, resolved when they're set; the fields
+ * of a \ref grid_par_t passed to a draw function are resolved on the way in.
+ */
+typedef struct {
+    uint32_t color;
+    uint32_t fill;          /**< 0, which is fully transparent, if there's no
+                                 fill. */
+    uint8_t line_type;      /**< A \ref grid_line_type_t. */
+    uint8_t point_type;     /**< A \ref grid_point_type_t. */
+    uint8_t just, vjust;    /**< \ref grid_just_t values. */
+    uint8_t antialias;      /**< A `cairo_antialias_t`. */
+    bool hairline, fast_lines;
+    compiled_unit_t line_width, point_size, font_size;
+} grid_resolved_par_t;
+
+/**
+ * The state last set on a context's cairo context, so that setting the same
+ * state again can be skipped.
+ */
+typedef struct {
+    bool valid;             /**< False until every field has been set. */
+    uint32_t color;
+    uint8_t line_type, antialias;
+    double dash_scale;      /**< Device units per pixel of the dashes. */
+    double line_width, font_size; /**< In device units. */
+} grid_cairo_state_t;
+
+/**
+ * The public functions whose calls are counted and timed by a context's
+ * \ref grid_stats_t.
+ */
+typedef enum {
+    GRID_OP_LINE,
+    GRID_OP_LINES,
+    GRID_OP_POINT,
+    GRID_OP_POINTS,
+    GRID_OP_STYLED_POINTS,
+    GRID_OP_STREAM_LINES,
+    GRID_OP_STREAM_POINTS,
+    GRID_OP_RECT,
+    GRID_OP_POLYGON,
+    GRID_OP_RASTER,
+    GRID_OP_TEXT,
+    GRID_OP_TICKS,   /**< \ref new_grid_ticks. */
+    GRID_OP_AXIS,    /**< The axis functions, including their ticks. */
+    GRID_OP_WRITE_PNG,
+    GRID_OP_COUNT
+} grid_op_t;
+
+/**
+ * Calls of one function and the time spent in them.
+ */
+typedef struct {
+    long calls;
+    double seconds; /**< Monotonic wall-clock time. */
+} grid_op_stats_t;
+
+/**
+ * Counters describing the work done by a context while its statistics are
+ * enabled. See \ref grid_enable_stats.
+ */
+typedef struct {
+    grid_op_stats_t ops[GRID_OP_COUNT]; /**< Indexed by \ref grid_op_t. */
+    long unit_conversions,  /**< Values converted from units to NPC. */
+         font_extents,      /**< Calls of `cairo_font_extents`. */
+         text_extents,      /**< Calls of `cairo_text_extents`. */
+         strokes,           /**< Calls of `cairo_stroke`. */
+         fills,             /**< Calls of `cairo_fill` and
+                                 `cairo_fill_preserve`. */
+         points,            /**< Coordinates passed to the line, point,
+                                 polygon, and streaming functions. */
+         allocations,       /**< Times draw functions grew the context's
+                                 scratch buffer. */
+         bytes_allocated;   /**< Total size of the buffers allocated. */
+} grid_stats_t;
+
 /**
  * A grid context consists of the viewport tree, the current viewport, and
  * cairo objects used to create the drawing.
@@ -62,7 +307,50 @@ typedef struct {
     cairo_surface_t *surface;
     cairo_t *cr;
     grid_viewport_node_t *root_node, *current_node;
-    grid_par_t *par;
+    grid_par_t *par;          /**< Global parameters. Set them with the
+                                   `grid_set_*` functions, which keep
+                                   `resolved` up to date. */
+    grid_par_t *default_par;  /**< Owned default parameters; `par` is reset
+                                   to these by \ref grid_context_reset. */
+    grid_viewport_node_t *free_nodes; /**< Released nodes available for reuse,
+                                           linked through `parent`. */
+    struct __grid_node_block_t *node_blocks; /**< Storage for the nodes of the
+                                                  viewport tree. */
+    grid_surface_pool_t *surface_pool; /**< Pool that `surface` is returned to
+                                            when the context is freed. */
+    cairo_region_t *dirty; /**< Device-space area invalidated since the last
+                                redraw. */
+    bool redrawing; /**< True between \ref grid_begin_redraw and
+                         \ref grid_end_redraw. */
+    grid_viewport_node_t **name_index; /**< Hash buckets of named nodes. */
+    int name_index_size, name_count;
+    unsigned long node_seq; /**< Sequence number of the next pushed node. */
+    unsigned long tree_generation; /**< Incremented whenever the viewport
+                                        tree changes. */
+    unsigned long layout_generation; /**< Incremented whenever the surface is
+                                          resized. */
+    struct __grid_path_cache_entry_t *path_cache; /**< Resolved viewport
+                                                       paths. */
+    bool stats_enabled;
+    bool in_phase; /**< A counted function is running; the functions it
+                        calls are attributed to it. */
+    grid_stats_t stats;
+    grid_tracer_t *tracer; /**< Borrowed tracer recording the context's
+                                work, or `NULL`. */
+    grid_allocator_t *allocator; /**< Allocator the context's memory is
+                                      allocated through. See
+                                      \ref new_grid_context_with_allocator. */
+    grid_memory_stats_t memory;  /**< Memory allocated by the context. */
+    double *scratch;             /**< Buffer reused by draw functions; it
+                                      only grows, so drawing allocates
+                                      nothing once it's large enough. */
+    size_t scratch_size;         /**< Length of `scratch` in doubles. */
+    grid_ticks_t axis_ticks;     /**< Ticks reused by \ref grid_xaxis and
+                                      \ref grid_yaxis. */
+    grid_resolved_par_t resolved; /**< `par`, resolved by the setters. */
+    grid_resolved_par_t drawing; /**< Parameters of the draw call under
+                                      way. */
+    grid_cairo_state_t cairo_state;
 } grid_context_t;
 
 // graphics parameters
@@ -88,6 +376,9 @@ rgb(double, double, double);
 rgba_t*
 rgba(double, double, double, double);
 
+uint32_t
+grid_pack_color(const rgba_t*);
+
 grid_par_t*
 new_grid_default_par(void);
 
@@ -111,6 +402,9 @@ new_grid_named_default_viewport(const char*);
 grid_viewport_t*
 new_grid_data_viewport(int, const double*, const double*);
 
+grid_viewport_t*
+new_grid_range_viewport(const grid_range_t*, const grid_range_t*);
+
 grid_viewport_t*
 new_grid_plot_viewport(grid_context_t*, double, double, double, double);
 
@@ -123,6 +417,9 @@ free_grid_viewport(grid_viewport_t*);
 void
 grid_push_viewport(grid_context_t*, const grid_viewport_t*);
 
+void
+grid_push_new_viewport(grid_context_t*, grid_viewport_t*);
+
 bool
 grid_pop_viewport_1(grid_context_t*);
 
@@ -141,8 +438,61 @@ grid_down_viewport(grid_context_t*, const char*);
 int
 grid_seek_viewport(grid_context_t*, const char*);
 
+// layouts
+
+grid_layout_t*
+new_grid_layout(int, const unit_t**, int, const unit_t**);
+
+void
+free_grid_layout(grid_layout_t*);
+
+void
+grid_push_layout_viewport(grid_context_t*, grid_layout_t*, int, int);
+
+void
+grid_push_named_layout_viewport(grid_context_t*, const char*, grid_layout_t*,
+                                int, int);
+
+void
+grid_push_layout_span(grid_context_t*, const char*, grid_layout_t*, 
+                      int, int, int, int);
+
+// incremental redraw
+
+void
+grid_invalidate_viewport(grid_context_t*);
+
+bool
+grid_begin_redraw(grid_context_t*);
+
+void
+grid_end_redraw(grid_context_t*);
+
+// cached layers
+
+grid_layer_t*
+new_grid_layer(void);
+
+void
+free_grid_layer(grid_layer_t*);
+
+void
+grid_invalidate_layer(grid_layer_t*);
+
+bool
+grid_begin_layer(grid_context_t*, grid_layer_t*);
+
+void
+grid_end_layer(grid_context_t*, grid_layer_t*);
+
 // draw functions
 
+void
+grid_invalidate_cairo_state(grid_context_t*);
+
+double
+grid_resolved_line_width(grid_context_t*, const grid_par_t*);
+
 rgba_t*
 grid_set_color(grid_context_t*, rgba_t*);
 
@@ -152,6 +502,9 @@ grid_set_fill(grid_context_t*, rgba_t*);
 char*
 grid_set_line_type(grid_context_t*, char*);
 
+char*
+grid_set_point_type(grid_context_t*, char*);
+
 char*
 grid_set_just(grid_context_t*, char*);
 
@@ -161,18 +514,79 @@ grid_set_vjust(grid_context_t*, char*);
 unit_t*
 grid_set_line_width(grid_context_t*, unit_t*);
 
+unit_t*
+grid_set_point_size(grid_context_t*, unit_t*);
+
 unit_t*
 grid_set_font_size(grid_context_t*, unit_t*);
 
+char*
+grid_set_antialias(grid_context_t*, char*);
+
+bool*
+grid_set_hairline(grid_context_t*, bool*);
+
+bool*
+grid_set_fast_lines(grid_context_t*, bool*);
+
+// surface pools
+
+grid_surface_pool_t*
+new_grid_surface_pool(int);
+
+void
+free_grid_surface_pool(grid_surface_pool_t*);
+
+cairo_surface_t*
+grid_surface_pool_acquire(grid_surface_pool_t*, cairo_format_t, int, int);
+
+void
+grid_surface_pool_release(grid_surface_pool_t*, cairo_surface_t*);
+
+grid_surface_pool_t*
+grid_set_surface_pool(grid_surface_pool_t*);
+
 grid_context_t*
 new_grid_context(int, int);
 
+grid_context_t*
+new_grid_context_with_allocator(int, int, grid_allocator_t*);
+
 void
-free_grid_viewport_tree(grid_viewport_node_t*);
+grid_context_reset(grid_context_t*);
+
+void
+grid_context_resize(grid_context_t*, int, int);
+
+void
+free_grid_viewport_tree(grid_context_t*, grid_viewport_node_t*);
 
 void
 free_grid_context(grid_context_t*);
 
+bool
+grid_write_png(grid_context_t*, const char*);
+
+// statistics
+
+void
+grid_enable_stats(grid_context_t*, bool);
+
+void
+grid_get_stats(const grid_context_t*, grid_stats_t*);
+
+void
+grid_reset_stats(grid_context_t*);
+
+const char*
+grid_op_name(grid_op_t);
+
+void
+grid_set_tracer(grid_context_t*, grid_tracer_t*);
+
+void
+grid_get_memory_stats(const grid_context_t*, grid_memory_stats_t*);
+
 void
 grid_line(grid_context_t*, const unit_t*, const unit_t*, 
           const unit_t*, const unit_t*, const grid_par_t*);
@@ -188,6 +602,18 @@ void
 grid_points(grid_context_t*, const unit_array_t*, const unit_array_t*,
             const grid_par_t*);
 
+void
+grid_styled_points(grid_context_t*, const unit_array_t*, const unit_array_t*,
+                   const grid_point_style_t*, const grid_par_t*);
+
+void
+grid_stream_lines(grid_context_t*, grid_chunk_fn, void*, char*, 
+                  const grid_par_t*);
+
+void
+grid_stream_points(grid_context_t*, grid_chunk_fn, void*, char*, 
+                   const grid_par_t*);
+
 void
 grid_rect(grid_context_t*, const unit_t*, const unit_t*, 
           const unit_t*, const unit_t*, const grid_par_t*);
@@ -195,6 +621,11 @@ grid_rect(grid_context_t*, const unit_t*, const unit_t*,
 void
 grid_full_rect(grid_context_t*, const grid_par_t*);
 
+void
+grid_raster(grid_context_t*, const unit_t*, const unit_t*, const unit_t*,
+            const unit_t*, int, int, const double*, const grid_color_map_t*,
+            grid_raster_filter_t);
+
 void
 grid_polygon(grid_context_t*, const unit_array_t*, const unit_array_t*,
              const grid_par_t*);
@@ -203,6 +634,18 @@ void
 grid_text(grid_context_t*, const char*, const unit_t*, const unit_t*, 
           const grid_par_t*);
 
+grid_ticks_t*
+new_grid_ticks(grid_context_t*, double, double, const grid_par_t*);
+
+void
+free_grid_ticks(grid_ticks_t*);
+
+void
+grid_xaxis_ticks(grid_context_t*, const grid_ticks_t*, const grid_par_t*);
+
+void
+grid_yaxis_ticks(grid_context_t*, const grid_ticks_t*, const grid_par_t*);
+
 void
 grid_xaxis(grid_context_t*, const grid_par_t*);
 
@@ -1,8 +1,16 @@
 #include "griddle.h"
+#include "grid_series.h"
+#include "grid_colfile.h"
+#include "grid_csv.h"
+#include "grid_facet.h"
+#include "grid_scanline.h"
 #include "CuTest.h"
 
+#include <math.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 void
 test_units(CuTest *tc) {
@@ -18,28 +26,42 @@ test_units(CuTest *tc) {
     CuAssertDblEquals(tc, u3->value, 2, 1e-8);
     CuAssertPtrEquals(tc, u3->arg1, u1);
     CuAssertPtrEquals(tc, u3->arg2, NULL);
-    free(u3);
+
+    // a combined unit owns its arguments, so detach them to keep them
+    u3->arg1 = NULL;
+    free_unit(u3);
 
     u3 = unit_div(u1, 2);
     CuAssertDblEquals(tc, u3->value, 2, 1e-8);
     CuAssertPtrEquals(tc, u3->arg1, u1);
     CuAssertPtrEquals(tc, u3->arg2, NULL);
-    free(u3);
+    u3->arg1 = NULL;
+    free_unit(u3);
 
     u3 = unit_add(u1, u2);
     CuAssertStrEquals(tc, u3->type, "+");
     CuAssertPtrEquals(tc, u3->arg1, u1);
     CuAssertPtrEquals(tc, u3->arg2, u2);
-    free(u3);
+    u3->arg1 = u3->arg2 = NULL;
+    free_unit(u3);
 
     u3 = unit_sub(u1, u2);
     CuAssertStrEquals(tc, u3->type, "-");
     CuAssertPtrEquals(tc, u3->arg1, u1);
     CuAssertPtrEquals(tc, u3->arg2, u2);
-    free(u3);
+    free_unit(u3);
 
-    free(u1);
-    free(u2);
+    // arrays own copies of their values, and combined arrays own their
+    // arguments
+    double values[] = { 1, 2, 3 };
+    unit_array_t *a = unit_array(3, values, "px");
+    values[0] = 0;
+    CuAssertDblEquals(tc, 1, a->values[0], 1e-8);
+    unit_array_t *b = unit_array_div(unit_array_mul(a, 4), 2);
+    CuAssertIntEquals(tc, 3, unit_array_size(b));
+    unit_array_t *c = unit_array_add(b, unit_array(3, values, "npc"));
+    CuAssertIntEquals(tc, 3, unit_array_size(c));
+    free_unit_array(c);
 }
 
 void
@@ -51,6 +73,8 @@ test_grid_context_constructor(CuTest *tc) {
     CuAssertPtrNotNull(tc, gr->cr);
     CuAssertPtrNotNull(tc, gr->root_node);
     CuAssertPtrNotNull(tc, gr->current_node);
+
+    free_grid_context(gr);
 }
 
 void
@@ -97,9 +121,1400 @@ test_grid_viewport_tree(CuTest *tc) {
     CuAssertIntEquals(tc, 2, n);
     CuAssertStrEquals(tc, "banana", gr->current_node->name);
 
+    free_grid_viewport(apple);
+    free_grid_viewport(banana);
+    free_grid_viewport(carrot);
+    free_grid_context(gr);
+}
+
+void
+test_grid_context_reset(CuTest *tc) {
+    grid_context_t *gr = new_grid_context(100, 100);
+    grid_viewport_t *vp = new_grid_default_viewport();
+
+    grid_push_named_viewport(gr, "apple", vp);
+    grid_push_named_viewport(gr, "banana", vp);
+    grid_up_viewport_1(gr);
+    grid_push_named_viewport(gr, "carrot", vp);
+
+    unit_t *lwd = unit(7, "px");
+    grid_set_line_width(gr, lwd);
+    CuAssertPtrEquals(tc, lwd, gr->par->line_width);
+
+    grid_context_reset(gr);
+    CuAssertPtrEquals(tc, gr->root_node, gr->current_node);
+    CuAssertPtrEquals(tc, NULL, gr->root_node->child);
+    CuAssertPtrEquals(tc, gr->default_par->line_width, gr->par->line_width);
+    CuAssertPtrNotNull(tc, gr->free_nodes);
+
+    // released nodes are reused before new ones are allocated
+    grid_viewport_node_t *recycled = gr->free_nodes;
+    grid_push_named_viewport(gr, "durian", vp);
+    CuAssertPtrEquals(tc, recycled, gr->current_node);
+    CuAssertStrEquals(tc, "durian", gr->current_node->name);
+    CuAssertIntEquals(tc, -1, grid_seek_viewport(gr, "apple"));
+
+    free_unit(lwd);
+    free_grid_viewport(vp);
+    free_grid_context(gr);
+}
+
+void
+test_grid_context_resize(CuTest *tc) {
+    grid_context_t *gr = new_grid_context(100, 100);
+    grid_viewport_t *vp = new_grid_default_viewport();
+    free_unit(vp->x);
+    free_unit(vp->w);
+    vp->x = unit(10, "px");
+    vp->w = unit(20, "px");
+
+    grid_push_named_viewport(gr, "fixed", vp);
+    grid_up_viewport_1(gr);
+    grid_viewport_t *relative = new_grid_default_viewport();
+    grid_push_named_viewport(gr, "relative", relative);
+    grid_up_viewport_1(gr);
+
+    grid_context_resize(gr, 200, 50);
+    CuAssertIntEquals(tc, 200, cairo_image_surface_get_width(gr->surface));
+    CuAssertDblEquals(tc, 200, gr->root_node->npc_to_dev.xx, 1e-9);
+
+    // pixel units keep their size; npc units scale with the surface
+    CuAssertIntEquals(tc, 1, grid_down_viewport(gr, "fixed"));
+    CuAssertDblEquals(tc, 20, gr->current_node->npc_to_dev.xx, 1e-9);
+    CuAssertDblEquals(tc, 50, gr->current_node->npc_to_dev.yy, 1e-9);
+    CuAssertDblEquals(tc, 10, gr->current_node->npc_to_dev.x0, 1e-9);
+    grid_up_viewport_1(gr);
+
+    CuAssertIntEquals(tc, 1, grid_down_viewport(gr, "relative"));
+    CuAssertDblEquals(tc, 200, gr->current_node->npc_to_dev.xx, 1e-9);
+    CuAssertDblEquals(tc, 50, gr->current_node->npc_to_dev.yy, 1e-9);
+
+    free_grid_viewport(relative);
+    free_grid_viewport(vp);
+    free_grid_context(gr);
+}
+
+void
+test_grid_surface_pool(CuTest *tc) {
+    grid_surface_pool_t *pool = new_grid_surface_pool(2);
+    grid_set_surface_pool(pool);
+
+    grid_context_t *gr = new_grid_context(100, 100);
+    cairo_surface_t *surface = gr->surface;
+    free_grid_context(gr);
+    CuAssertIntEquals(tc, 1, pool->size);
+
+    gr = new_grid_context(100, 100);
+    CuAssertPtrEquals(tc, surface, gr->surface);
+    CuAssertIntEquals(tc, 1, pool->stats.hits);
+    CuAssertIntEquals(tc, 1, pool->stats.misses);
+
+    grid_context_t *gr2 = new_grid_context(100, 50);
+    grid_context_t *gr3 = new_grid_context(50, 50);
+    free_grid_context(gr);
+    free_grid_context(gr2);
+    free_grid_context(gr3);
+    CuAssertIntEquals(tc, 2, pool->size);
+    CuAssertIntEquals(tc, 1, pool->stats.evictions);
+
+    // a surface still referenced elsewhere isn't recycled
+    surface = grid_surface_pool_acquire(pool, CAIRO_FORMAT_ARGB32, 10, 10);
+    cairo_surface_reference(surface);
+    grid_surface_pool_release(pool, surface);
+    CuAssertIntEquals(tc, 2, pool->size);
+    CuAssertIntEquals(tc, 4, pool->stats.releases);
+    cairo_surface_destroy(surface);
+
+    CuAssertPtrEquals(tc, pool, grid_set_surface_pool(NULL));
+    free_grid_surface_pool(pool);
+}
+
+void
+test_grid_redraw(CuTest *tc) {
+    grid_context_t *gr = new_grid_context(100, 100);
+    CuAssertTrue(tc, !grid_begin_redraw(gr));
+
+    grid_viewport_t *vp = new_grid_viewport(unit(0.5, "npc"), unit(0.5, "npc"),
+                                            unit(0.1, "npc"), unit(0.1, "npc"));
+    grid_push_viewport(gr, vp);
+    grid_invalidate_viewport(gr);
+    grid_pop_viewport_1(gr);
+
+    CuAssertTrue(tc, grid_begin_redraw(gr));
+    CuAssertTrue(tc, gr->redrawing);
+    grid_full_rect(gr, NULL);
+    grid_end_redraw(gr);
+
+    CuAssertTrue(tc, !gr->redrawing);
+    CuAssertTrue(tc, !grid_begin_redraw(gr));
+
+    free_grid_viewport(vp);
+    free_grid_context(gr);
+}
+
+void
+test_grid_layer(CuTest *tc) {
+    grid_context_t *gr = new_grid_context(100, 100);
+    grid_layer_t *layer = new_grid_layer();
+
+    CuAssertTrue(tc, grid_begin_layer(gr, layer));
+    grid_full_rect(gr, NULL);
+    grid_end_layer(gr, layer);
+    CuAssertPtrNotNull(tc, layer->pattern);
+
+    // same geometry and parameters: composite the cached drawing
+    CuAssertTrue(tc, !grid_begin_layer(gr, layer));
+
+    // a different viewport invalidates the cache
+    grid_viewport_t *vp = new_grid_viewport(unit(0.5, "npc"), unit(0.5, "npc"),
+                                            unit(0.1, "npc"), unit(0.1, "npc"));
+    grid_push_viewport(gr, vp);
+    CuAssertTrue(tc, grid_begin_layer(gr, layer));
+    grid_end_layer(gr, layer);
+    CuAssertTrue(tc, !grid_begin_layer(gr, layer));
+
+    // so do different parameters
+    unit_t *lwd = unit(7, "px");
+    grid_set_line_width(gr, lwd);
+    CuAssertTrue(tc, grid_begin_layer(gr, layer));
+    grid_end_layer(gr, layer);
+
+    free_unit(lwd);
+    free_grid_viewport(vp);
+    free_grid_layer(layer);
     free_grid_context(gr);
 }
 
+void
+test_grid_series(CuTest *tc) {
+    grid_series_t *s = new_grid_series(4, 0);
+    double ys[] = {3, 1, 4, 1, 5, 9, 2, 6};
+    double min, max;
+
+    CuAssertTrue(tc, !grid_series_range(s, &min, &max));
+
+    int i;
+    for (i = 0; i < 8; i++)
+        grid_series_append(s, i, ys[i]);
+
+    // the window holds 5, 9, 2, 6
+    CuAssertIntEquals(tc, 4, grid_series_size(s));
+    CuAssertTrue(tc, grid_series_range(s, &min, &max));
+    CuAssertDblEquals(tc, 2, min, 1e-8);
+    CuAssertDblEquals(tc, 9, max, 1e-8);
+    free_grid_series(s);
+
+    // a span limits the window by x
+    s = new_grid_series(100, 2.5);
+    for (i = 0; i < 8; i++)
+        grid_series_append(s, i, ys[i]);
+
+    CuAssertIntEquals(tc, 3, grid_series_size(s));
+    grid_series_range(s, &min, &max);
+    CuAssertDblEquals(tc, 2, min, 1e-8);
+    CuAssertDblEquals(tc, 9, max, 1e-8);
+
+    grid_context_t *gr = new_grid_context(100, 100);
+    grid_viewport_t *vp = new_grid_series_viewport(s);
+    CuAssertDblEquals(tc, 4.5, vp->x_ntv, 1e-8);
+    CuAssertDblEquals(tc, 2.5, vp->w_ntv, 1e-8);
+
+    grid_push_viewport(gr, vp);
+    CuAssertTrue(tc, !grid_series_scroll(gr, s, NULL));
+    grid_pop_viewport_1(gr);
+    free_grid_viewport(vp);
+
+    // scrolling keeps the y-range, so the fast path applies
+    grid_series_append(s, 8, 9);
+    vp = new_grid_series_viewport(s);
+    grid_push_viewport(gr, vp);
+    CuAssertTrue(tc, grid_series_scroll(gr, s, NULL));
+
+    free_grid_viewport(vp);
+    free_grid_context(gr);
+    free_grid_series(s);
+}
+
+void
+test_grid_viewport_index(CuTest *tc) {
+    grid_context_t *gr = new_grid_context(100, 100);
+    grid_viewport_t *vp = new_grid_default_viewport();
+
+    grid_push_named_viewport(gr, "panel1", vp);
+    grid_push_named_viewport(gr, "plot", vp);
+    grid_up_viewport(gr, 2);
+    grid_push_named_viewport(gr, "panel2", vp);
+    grid_push_named_viewport(gr, "plot", vp);
+    grid_push_named_viewport(gr, "plot", vp);
+
+    // younger siblings are searched first, and ancestors before descendants
+    CuAssertIntEquals(tc, 2, grid_seek_viewport(gr, "plot"));
+    CuAssertStrEquals(tc, "panel2", gr->current_node->parent->name);
+
+    CuAssertIntEquals(tc, 1, grid_seek_viewport(gr, "panel1"));
+    CuAssertIntEquals(tc, 1, grid_down_viewport(gr, "plot"));
+    CuAssertStrEquals(tc, "panel1", gr->current_node->parent->name);
+
+    grid_seek_viewport(gr, "panel2");
+    grid_down_viewport(gr, "plot");
+    grid_pop_viewport_1(gr);
+    CuAssertIntEquals(tc, 2, grid_seek_viewport(gr, "plot"));
+    CuAssertStrEquals(tc, "panel1", gr->current_node->parent->name);
+
+    // enough names to grow the index
+    char name[20];
+    int i;
+    for (i = 0; i < 100; i++) {
+        snprintf(name, 20, "vp%d", i);
+        grid_push_named_viewport(gr, name, vp);
+        grid_up_viewport_1(gr);
+    }
+
+    CuAssertIntEquals(tc, 3, grid_seek_viewport(gr, "vp42"));
+    CuAssertIntEquals(tc, 0, grid_seek_viewport(gr, "root"));
+
+    free_grid_viewport(vp);
+    free_grid_context(gr);
+}
+
+void
+test_grid_viewport_path(CuTest *tc) {
+    grid_context_t *gr = new_grid_context(100, 100);
+    grid_viewport_t *vp = new_grid_default_viewport();
+    char name[20];
+    int row, col;
+
+    for (row = 0; row < 3; row++) {
+        snprintf(name, 20, "row%d", row);
+        grid_push_named_viewport(gr, name, vp);
+        for (col = 0; col < 3; col++) {
+            snprintf(name, 20, "col%d", col);
+            grid_push_named_viewport(gr, name, vp);
+            grid_push_named_viewport(gr, "plot", vp);
+            grid_up_viewport(gr, 2);
+        }
+        grid_up_viewport_1(gr);
+    }
+
+    CuAssertIntEquals(tc, 3, grid_seek_viewport(gr, "row1::col2::plot"));
+    CuAssertStrEquals(tc, "col2", gr->current_node->parent->name);
+    CuAssertStrEquals(tc, "row1", gr->current_node->parent->parent->name);
+
+    // resolved from the cache
+    grid_viewport_node_t *plot = gr->current_node;
+    CuAssertIntEquals(tc, 3, grid_seek_viewport(gr, "row1::col2::plot"));
+    CuAssertPtrEquals(tc, plot, gr->current_node);
+
+    // the first component needn't be a child of the current viewport
+    grid_seek_viewport(gr, "row2");
+    CuAssertIntEquals(tc, 2, grid_down_viewport(gr, "col0::plot"));
+    CuAssertStrEquals(tc, "row2", gr->current_node->parent->parent->name);
+
+    grid_seek_viewport(gr, "row2");
+    CuAssertIntEquals(tc, -1, grid_down_viewport(gr, "row1::col0::plot"));
+    CuAssertIntEquals(tc, -1, grid_seek_viewport(gr, "col0::row1"));
+
+    // mutating the tree invalidates cached paths
+    grid_seek_viewport(gr, "row1::col2");
+    grid_pop_viewport_1(gr);
+    CuAssertIntEquals(tc, -1, grid_seek_viewport(gr, "row1::col2::plot"));
+
+    free_grid_viewport(vp);
+    free_grid_context(gr);
+}
+
+void
+test_grid_layout(CuTest *tc) {
+    grid_context_t *gr = new_grid_context(100, 100);
+
+    unit_t *px10 = unit(10, "px"), *px20 = unit(20, "px");
+    unit_t *null1 = unit(1, "null"), *null2 = unit(2, "null");
+    const unit_t *heights[] = { null1, px20 };
+    const unit_t *widths[] = { px10, null1, null2 };
+    grid_layout_t *layout = new_grid_layout(2, heights, 3, widths);
+
+    // null columns share the 90px left by the fixed one
+    grid_push_named_layout_viewport(gr, "cell", layout, 0, 1);
+    CuAssertDblEquals(tc, 30, gr->current_node->npc_to_dev.xx, 1e-9);
+    CuAssertDblEquals(tc, 10, gr->current_node->npc_to_dev.x0, 1e-9);
+    CuAssertDblEquals(tc, 80, gr->current_node->npc_to_dev.yy, 1e-9);
+    CuAssertDblEquals(tc, 20, gr->current_node->npc_to_dev.y0, 1e-9);
+    grid_up_viewport_1(gr);
+    CuAssertTrue(tc, layout->cached);
+
+    grid_push_layout_span(gr, "span", layout, 0, 1, 2, 2);
+    CuAssertDblEquals(tc, 90, gr->current_node->npc_to_dev.xx, 1e-9);
+    CuAssertDblEquals(tc, 100, gr->current_node->npc_to_dev.yy, 1e-9);
+    CuAssertDblEquals(tc, 0, gr->current_node->npc_to_dev.y0, 1e-9);
+
+    // out-of-range cells don't push anything
+    grid_viewport_node_t *current = gr->current_node;
+    grid_push_layout_viewport(gr, layout, 2, 0);
+    CuAssertPtrEquals(tc, current, gr->current_node);
+    grid_up_viewport_1(gr);
+
+    // pushed cells follow the layout when the context is resized
+    grid_context_resize(gr, 200, 100);
+    CuAssertIntEquals(tc, 1, grid_down_viewport(gr, "cell"));
+    CuAssertDblEquals(tc, 190.0 / 3, gr->current_node->npc_to_dev.xx, 1e-9);
+    grid_up_viewport_1(gr);
+
+    grid_push_layout_viewport(gr, layout, 1, 2);
+    CuAssertDblEquals(tc, 380.0 / 3, gr->current_node->npc_to_dev.xx, 1e-9);
+    CuAssertDblEquals(tc, 20, gr->current_node->npc_to_dev.yy, 1e-9);
+    CuAssertDblEquals(tc, 200, layout->cache_key[0], 1e-9);
+    grid_up_viewport_1(gr);
+
+    // null columns get no space when the fixed ones overflow the parent,
+    // rather than pulling the columns after them back, and get it back when
+    // the parent grows
+    unit_t *px150 = unit(150, "px");
+    const unit_t *overflowing[] = { px150, null1, px20 };
+    grid_layout_t *narrow = new_grid_layout(1, NULL, 3, overflowing);
+    grid_context_resize(gr, 100, 100);
+    grid_push_named_layout_viewport(gr, "after", narrow, 0, 2);
+    CuAssertDblEquals(tc, 150, gr->current_node->npc_to_dev.x0, 1e-9);
+    grid_up_viewport_1(gr);
+
+    grid_context_resize(gr, 400, 100);
+    CuAssertIntEquals(tc, 1, grid_down_viewport(gr, "after"));
+    CuAssertDblEquals(tc, 380, gr->current_node->npc_to_dev.x0, 1e-9);
+    grid_up_viewport_1(gr);
+
+    grid_context_resize(gr, 100, 100);
+    CuAssertIntEquals(tc, 1, grid_down_viewport(gr, "after"));
+    CuAssertDblEquals(tc, 150, gr->current_node->npc_to_dev.x0, 1e-9);
+    CuAssertDblEquals(tc, 20, gr->current_node->npc_to_dev.xx, 1e-9);
+    grid_up_viewport_1(gr);
+
+    free_grid_layout(narrow);
+    free_unit(px150);
+    free_grid_layout(layout);
+    free_unit(px10);
+    free_unit(px20);
+    free_unit(null1);
+    free_unit(null2);
+    free_grid_context(gr);
+}
+
+typedef struct {
+    int size[4];
+    double x_ntv[4], w_ntv[4];
+} facet_record_t;
+
+static void
+record_panel(grid_context_t *gr, const grid_facet_t *facet, int group, 
+             int size, const double *xs, const double *ys, void *data)
+{
+    facet_record_t *record = data;
+    record->size[group] = size;
+    record->x_ntv[group] = gr->current_node->npc_to_ntv.x0;
+    record->w_ntv[group] = gr->current_node->npc_to_ntv.xx;
+}
+
+static void
+raster_panel(grid_context_t *gr, const grid_facet_t *facet, int group, 
+             int size, const double *xs, const double *ys, void *data)
+{
+    bool *pooled = data;
+    pooled[group] = gr->surface_pool != NULL;
+
+    uint32_t ramp[] = { 0xff000000, 0xffffffff };
+    grid_color_map_t *map = new_grid_color_map(2, ramp, 0, 10);
+    unit_t zero = Unit(0, "npc"), one = Unit(1, "npc");
+    grid_raster(gr, &zero, &zero, &one, &one, 1, size, ys, map, 
+                GRID_RASTER_NEAREST);
+    free_grid_color_map(map);
+}
+
+void
+test_grid_facet(CuTest *tc) {
+    double xs[] = { 0, 1, 2, 3, 4, 5, 6, 7, 8 };
+    double ys[] = { 1, 2, 3, 4, 5, 6, 7, 8, 9 };
+    int groups[] = { 0, 0, 1, 1, 2, 2, 2, 5, 3 };
+
+    grid_facet_t *facet = new_grid_facet(9, xs, ys, groups, 4, 2, 
+                                         GRID_SCALES_FREE_X);
+    CuAssertIntEquals(tc, 8, facet->size);
+    CuAssertIntEquals(tc, 2, facet->nrow);
+    CuAssertIntEquals(tc, 4, facet->offsets[2]);
+    CuAssertIntEquals(tc, 7, facet->offsets[3]);
+    CuAssertDblEquals(tc, 8, facet->xs[7], 1e-9);
+
+    // free x scales fit each group; the shared y scale covers all of them
+    CuAssertDblEquals(tc, 1 + 2 * 0.1 / 1.8, facet->x_ntv[1], 1e-9);
+    CuAssertDblEquals(tc, facet->y_ntv[0], facet->y_ntv[6], 1e-9);
+    CuAssertDblEquals(tc, 8 + 2 * 0.8 / 1.8, facet->y_ntv[7], 1e-9);
+
+    // a single sample gets a unit range around it
+    CuAssertDblEquals(tc, 7.5, facet->x_ntv[6], 1e-9);
+    CuAssertDblEquals(tc, 1, facet->x_ntv[7], 1e-9);
+
+    grid_context_t *gr = new_grid_context(400, 400);
+    facet_record_t record = { { 0 } };
+    grid_facet(gr, facet, NULL, record_panel, &record, 3, NULL);
+
+    int g;
+    for (g = 0; g < 4; g++) {
+        CuAssertIntEquals(tc, facet->offsets[g + 1] - facet->offsets[g], 
+                          record.size[g]);
+        CuAssertDblEquals(tc, facet->x_ntv[2 * g], record.x_ntv[g], 1e-9);
+        CuAssertDblEquals(tc, facet->x_ntv[2 * g + 1], record.w_ntv[g], 1e-9);
+    }
+
+    CuAssertPtrEquals(tc, gr->root_node, gr->current_node);
+    CuAssertPtrEquals(tc, NULL, gr->root_node->child);
+
+    // panels drawn on several threads share the surface pool, for their
+    // surfaces and their rasters' images, and return everything to it
+    grid_surface_pool_t *pool = new_grid_surface_pool(16);
+    grid_set_surface_pool(pool);
+    bool pooled[4] = { false };
+    grid_facet(gr, facet, NULL, raster_panel, pooled, 3, NULL);
+    for (g = 0; g < 4; g++)
+        CuAssertTrue(tc, pooled[g]);
+    CuAssertIntEquals(tc, 8, pool->stats.hits + pool->stats.misses);
+    CuAssertIntEquals(tc, 8, pool->stats.releases);
+    grid_set_surface_pool(NULL);
+    free_grid_surface_pool(pool);
+
+    free_grid_context(gr);
+    free_grid_facet(facet);
+}
+
+void
+test_grid_range(CuTest *tc) {
+    double xs[] = { NAN, 3, -INFINITY, 1, 7, NAN, INFINITY, 2, 5 };
+
+    grid_range_t r;
+    grid_range_init(&r);
+    grid_range_add_array(&r, 9, xs);
+    CuAssertDblEquals(tc, 1, r.min, 0);
+    CuAssertDblEquals(tc, 7, r.max, 0);
+    CuAssertIntEquals(tc, 5, r.count);
+
+    grid_range_t other;
+    grid_range_init(&other);
+    grid_range_add(&other, -4);
+    grid_range_add(&other, NAN);
+    grid_range_merge(&r, &other);
+    CuAssertDblEquals(tc, -4, r.min, 0);
+    CuAssertIntEquals(tc, 6, r.count);
+
+    // parallel scans agree with serial ones
+    long n = (1L << 20) + 3;
+    double *big = malloc(n * sizeof(double));
+    long i;
+    for (i = 0; i < n; i++)
+        big[i] = i % 7 == 0 ? NAN : (double)((i * 7919) % 100003);
+    big[n - 1] = -1;
+
+    grid_range_t serial, parallel;
+    grid_range_init(&serial);
+    grid_range_init(&parallel);
+    grid_range_add_array(&serial, n, big);
+    grid_range_add_array_parallel(&parallel, n, big, 4);
+    CuAssertDblEquals(tc, serial.min, parallel.min, 0);
+    CuAssertDblEquals(tc, serial.max, parallel.max, 0);
+    CuAssertIntEquals(tc, serial.count, parallel.count);
+    CuAssertDblEquals(tc, -1, parallel.min, 0);
+
+    // ranges of several series at once
+    const double *arrays[] = { xs, big };
+    long sizes[] = { 9, n };
+    grid_range_init(&r);
+    grid_range_add_arrays(&r, 2, sizes, arrays, 0);
+    CuAssertIntEquals(tc, 5 + serial.count, r.count);
+    free(big);
+
+    // NaN in the first element doesn't poison the data viewport, and a
+    // constant series gets a non-degenerate range
+    double ys[] = { 2, 2, 2, 2, 2, 2, 2, 2, 2 };
+    grid_viewport_t *vp = new_grid_data_viewport(9, xs, ys);
+    CuAssertDblEquals(tc, 1 - 6 * 0.1 / 1.8, vp->x_ntv, 1e-9);
+    CuAssertDblEquals(tc, 1.5, vp->y_ntv, 1e-9);
+    CuAssertDblEquals(tc, 1, vp->h_ntv, 1e-9);
+    free_grid_viewport(vp);
+}
+
+/**
+ * Overwrite `size` bytes of a file at `offset`.
+ */
+static void
+patch_file(const char *path, long offset, const void *value, size_t size) {
+    FILE *f = fopen(path, "r+b");
+    fseek(f, offset, SEEK_SET);
+    fwrite(value, size, 1, f);
+    fclose(f);
+}
+
+void
+test_grid_colfile(CuTest *tc) {
+    const char *path = "griddle_tests.col";
+    long n = 1000, i;
+    double *x = malloc(n * sizeof(double));
+    float *y = malloc(n * sizeof(float));
+    for (i = 0; i < n; i++) {
+        x[i] = i;
+        y[i] = (float)(i % 10);
+    }
+    x[5] = NAN;
+
+    const char *names[] = { "x", "y" };
+    grid_colfile_type_t types[] = { GRID_COLFILE_F64, GRID_COLFILE_F32 };
+    const void *columns[] = { x, y };
+    CuAssertTrue(tc, grid_write_colfile(path, n, 2, names, types, columns, 64));
+
+    grid_colfile_t *cf = new_grid_colfile(path);
+    CuAssertPtrNotNull(tc, cf);
+    CuAssertIntEquals(tc, n, grid_colfile_rows(cf));
+    CuAssertIntEquals(tc, 1, grid_colfile_column(cf, "y"));
+    CuAssertIntEquals(tc, -1, grid_colfile_column(cf, "z"));
+
+    // double columns are viewed in place
+    unit_array_t xs = grid_colfile_array(cf, 0, 10, 20, "native");
+    CuAssertIntEquals(tc, 20, xs.size);
+    CuAssertTrue(tc, (char*)xs.values > (char*)cf->map &&
+                     (char*)xs.values < (char*)cf->map + cf->map_size);
+    CuAssertDblEquals(tc, 10, xs.values[0], 0);
+
+    unit_array_t ys = grid_colfile_array(cf, 1, 0, n, "native");
+    CuAssertDblEquals(tc, 7, ys.values[997], 0);
+
+    // ranges from statistics agree with scans
+    long firsts[] = { 0, 3, 64, 100, 990 }, sizes[] = { 1000, 200, 128, 1, 10 };
+    int k;
+    for (k = 0; k < 5; k++) {
+        grid_range_t stats, scan;
+        grid_range_init(&stats);
+        grid_range_init(&scan);
+        grid_colfile_range(cf, 0, firsts[k], sizes[k], &stats);
+        grid_range_add_array(&scan, sizes[k], x + firsts[k]);
+        CuAssertDblEquals(tc, scan.min, stats.min, 0);
+        CuAssertDblEquals(tc, scan.max, stats.max, 0);
+        CuAssertIntEquals(tc, scan.count, stats.count);
+    }
+
+    grid_viewport_t *vp = new_grid_colfile_viewport(cf, 0, 1);
+    CuAssertDblEquals(tc, -999 * 0.1 / 1.8, vp->x_ntv, 1e-9);
+    CuAssertDblEquals(tc, 9 + 2 * 0.9 / 1.8, vp->h_ntv, 1e-9);
+
+    grid_context_t *gr = new_grid_context(100, 100);
+    grid_push_viewport(gr, vp);
+    grid_colfile_lines(gr, cf, 0, 1, NULL);
+    grid_colfile_points(gr, cf, 0, 1, NULL);
+    free_grid_context(gr);
+    free_grid_viewport(vp);
+
+    // only the chunks holding [300, 310] and a row either side are visible
+    long first, count;
+    grid_colfile_visible_rows(cf, 0, 300, 310, &first, &count);
+    CuAssertIntEquals(tc, 255, first);
+    CuAssertIntEquals(tc, 66, count);
+    grid_colfile_visible_rows(cf, 0, 2000, 3000, &first, &count);
+    CuAssertIntEquals(tc, 0, count);
+
+    free_grid_colfile(cf);
+
+    // a step between chunks crosses a range that neither chunk meets
+    for (i = 0; i < n; i++)
+        x[i] = i < 512 ? 0 : 100;
+    grid_write_colfile(path, n, 2, names, types, columns, 64);
+    cf = new_grid_colfile(path);
+    grid_colfile_visible_rows(cf, 0, 40, 60, &first, &count);
+    CuAssertIntEquals(tc, 447, first);
+    CuAssertIntEquals(tc, 130, count);
+    free_grid_colfile(cf);
+
+    // files with a bad header are rejected
+    FILE *f = fopen(path, "r+b");
+    fseek(f, 8, SEEK_SET);
+    fputc(99, f);
+    fclose(f);
+    CuAssertPtrEquals(tc, NULL, new_grid_colfile(path));
+
+    // so are files whose sizes and offsets overflow, overlap the column
+    // table, or run past the end of the file
+    int64_t huge = (int64_t)1 << 61;
+    grid_write_colfile(path, n, 2, names, types, columns, 64);
+    patch_file(path, offsetof(grid_colfile_header_t, n_rows), &huge, 8);
+    CuAssertPtrEquals(tc, NULL, new_grid_colfile(path));
+
+    int64_t inside = 8;
+    grid_write_colfile(path, n, 2, names, types, columns, 64);
+    patch_file(path, sizeof(grid_colfile_header_t) + 
+                     offsetof(grid_colfile_column_t, data_offset), &inside, 8);
+    CuAssertPtrEquals(tc, NULL, new_grid_colfile(path));
+
+    grid_write_colfile(path, n, 2, names, types, columns, 64);
+    patch_file(path, sizeof(grid_colfile_header_t) + 
+                     offsetof(grid_colfile_column_t, stats_offset), &huge, 8);
+    CuAssertPtrEquals(tc, NULL, new_grid_colfile(path));
+
+    grid_write_colfile(path, n, 2, names, types, columns, 0);
+    f = fopen(path, "rb");
+    char *bytes = malloc(4096);
+    size_t size = fread(bytes, 1, 4096, f);
+    fclose(f);
+    f = fopen(path, "wb");
+    fwrite(bytes, 1, size, f);
+    fclose(f);
+    CuAssertPtrEquals(tc, NULL, new_grid_colfile(path));
+    free(bytes);
+
+    remove(path);
+    free(x);
+    free(y);
+}
+
+void
+test_grid_csv(CuTest *tc) {
+    const char *path = "griddle_tests.csv";
+    FILE *f = fopen(path, "w");
+    fputs("x, \"y\" ,z\r\n"
+          "1,2.5,3\r\n"
+          "\n"
+          "-0.125,1e3,NA\n"
+          "0.000000000000000000001,12345678901234567890,\n"
+          "7,8\n"
+          "1.7976931348623157e308,-.5,nan\n"
+          "0.1,abc,4", f);
+    fclose(f);
+
+    double expected[6][3] = {
+        { 1, 2.5, 3 },
+        { -0.125, 1000, NAN },
+        { 1e-21, 12345678901234567890.0, NAN },
+        { 7, 8, NAN },
+        { 1.7976931348623157e308, -0.5, NAN },
+        { 0.1, NAN, 4 }
+    };
+
+    int n_threads;
+    for (n_threads = 1; n_threads <= 4; n_threads += 3) {
+        grid_csv_t *csv = new_grid_csv(path, ',', true, n_threads);
+        CuAssertPtrNotNull(tc, csv);
+        CuAssertIntEquals(tc, 3, csv->n_columns);
+        CuAssertIntEquals(tc, 6, csv->n_rows);
+        CuAssertIntEquals(tc, 1, grid_csv_column(csv, "y"));
+        CuAssertTrue(tc, csv->rows_per_second > 0);
+
+        int i, j;
+        for (i = 0; i < 6; i++) {
+            for (j = 0; j < 3; j++) {
+                if (isnan(expected[i][j]))
+                    CuAssertTrue(tc, isnan(csv->columns[j][i]));
+                else
+                    CuAssertDblEquals(tc, expected[i][j], csv->columns[j][i], 0);
+            }
+        }
+
+        unit_array_t zs = grid_csv_array(csv, 2, "native");
+        CuAssertIntEquals(tc, 6, zs.size);
+        CuAssertPtrEquals(tc, csv->columns[2], zs.values);
+
+        free_grid_csv(csv);
+    }
+
+    remove(path);
+}
+
+typedef struct {
+    long i, n;
+    int calls;
+} stream_state_t;
+
+static int
+next_sine_chunk(void *data, double *xs, double *ys, int capacity) {
+    stream_state_t *state = data;
+    state->calls++;
+
+    int n = 0;
+    for (; n < capacity && state->i < state->n; n++, state->i++) {
+        xs[n] = state->i;
+        ys[n] = sin(state->i / 1000.0);
+    }
+
+    return n;
+}
+
+void
+test_grid_stream(CuTest *tc) {
+    long n = 50000, i;
+    double *xs = malloc(n * sizeof(double));
+    double *ys = malloc(n * sizeof(double));
+    for (i = 0; i < n; i++) {
+        xs[i] = i;
+        ys[i] = sin(i / 1000.0);
+    }
+
+    grid_range_t x_range = { 0, n - 1, n }, y_range = { -1, 1, n };
+    grid_viewport_t *vp = new_grid_range_viewport(&x_range, &y_range);
+
+    // a series drawn whole and one streamed in chunks look the same
+    grid_context_t *whole = new_grid_context(200, 100);
+    grid_push_viewport(whole, vp);
+    unit_array_t x_units = UnitArray(n, xs, "native");
+    unit_array_t y_units = UnitArray(n, ys, "native");
+    grid_lines(whole, &x_units, &y_units, NULL);
+
+    grid_context_t *streamed = new_grid_context(200, 100);
+    grid_push_viewport(streamed, vp);
+    stream_state_t state = { 0, n, 0 };
+    grid_stream_lines(streamed, next_sine_chunk, &state, "native", NULL);
+    CuAssertIntEquals(tc, n, state.i);
+    CuAssertTrue(tc, state.calls > 2);
+
+    cairo_surface_flush(whole->surface);
+    cairo_surface_flush(streamed->surface);
+    unsigned char *a = cairo_image_surface_get_data(whole->surface);
+    unsigned char *b = cairo_image_surface_get_data(streamed->surface);
+    int stride = cairo_image_surface_get_stride(whole->surface);
+    int differing = 0;
+    for (i = 0; i < stride * 100; i++)
+        differing += abs(a[i] - b[i]) > 64;
+    CuAssertTrue(tc, differing < 4 * stride);
+
+    state = (stream_state_t){ 0, n, 0 };
+    grid_stream_points(streamed, next_sine_chunk, &state, "native", NULL);
+    CuAssertIntEquals(tc, n, state.i);
+
+    free_grid_context(whole);
+    free_grid_context(streamed);
+    free_grid_viewport(vp);
+    free(xs);
+    free(ys);
+}
+
+void
+test_grid_stats(CuTest *tc) {
+    grid_context_t *gr = new_grid_context(200, 100);
+    grid_stats_t stats;
+
+    double values[10] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9 };
+    unit_array_t xs = UnitArray(10, values, "npc");
+    unit_array_t ys = UnitArray(10, values, "px");
+
+    // nothing is counted until statistics are enabled
+    grid_lines(gr, &xs, &ys, NULL);
+    grid_get_stats(gr, &stats);
+    CuAssertIntEquals(tc, 0, stats.ops[GRID_OP_LINES].calls);
+    CuAssertIntEquals(tc, 0, stats.unit_conversions);
+
+    grid_enable_stats(gr, true);
+    grid_lines(gr, &xs, &ys, NULL);
+    grid_get_stats(gr, &stats);
+    CuAssertIntEquals(tc, 1, stats.ops[GRID_OP_LINES].calls);
+    CuAssertTrue(tc, stats.ops[GRID_OP_LINES].seconds >= 0);
+    CuAssertIntEquals(tc, 10, stats.points);
+    CuAssertTrue(tc, stats.unit_conversions >= 20);
+    CuAssertIntEquals(tc, 1, stats.strokes);
+    // the first call grew the scratch buffer, which the second reuses
+    CuAssertIntEquals(tc, 0, stats.allocations);
+    CuAssertIntEquals(tc, 0, stats.bytes_allocated);
+    CuAssertTrue(tc, stats.font_extents >= 2);
+
+    // functions called by counted functions are attributed to the caller
+    grid_viewport_t *vp = new_grid_data_viewport(10, values, values);
+    grid_push_viewport(gr, vp);
+    grid_xaxis(gr, NULL);
+    grid_full_rect(gr, NULL);
+    grid_get_stats(gr, &stats);
+    CuAssertIntEquals(tc, 1, stats.ops[GRID_OP_AXIS].calls);
+    CuAssertIntEquals(tc, 0, stats.ops[GRID_OP_TICKS].calls);
+    CuAssertIntEquals(tc, 1, stats.ops[GRID_OP_RECT].calls);
+    CuAssertTrue(tc, stats.text_extents > 0);
+    CuAssertTrue(tc, stats.strokes > 2);
+
+    const char *path = "griddle_tests.png";
+    CuAssertTrue(tc, grid_write_png(gr, path));
+    remove(path);
+    grid_get_stats(gr, &stats);
+    CuAssertIntEquals(tc, 1, stats.ops[GRID_OP_WRITE_PNG].calls);
+    CuAssertStrEquals(tc, "grid_write_png", grid_op_name(GRID_OP_WRITE_PNG));
+
+    grid_reset_stats(gr);
+    grid_get_stats(gr, &stats);
+    CuAssertIntEquals(tc, 0, stats.ops[GRID_OP_AXIS].calls);
+    CuAssertIntEquals(tc, 0, stats.strokes);
+
+    grid_enable_stats(gr, false);
+    grid_full_rect(gr, NULL);
+    grid_get_stats(gr, &stats);
+    CuAssertIntEquals(tc, 0, stats.ops[GRID_OP_RECT].calls);
+
+    free_grid_viewport(vp);
+    free_grid_context(gr);
+}
+
+void
+test_grid_par(CuTest *tc) {
+    grid_context_t *gr = new_grid_context(100, 100);
+
+    // the defaults are resolved when the context is created
+    CuAssertIntEquals(tc, 0xff000000, gr->resolved.color);
+    CuAssertIntEquals(tc, 0, gr->resolved.fill);
+    CuAssertIntEquals(tc, GRID_LINE_SOLID, gr->resolved.line_type);
+    CuAssertIntEquals(tc, GRID_POINT_ROUND, gr->resolved.point_type);
+    CuAssertIntEquals(tc, GRID_JUST_CENTER, gr->resolved.just);
+    CuAssertIntEquals(tc, GRID_JUST_TOP, gr->resolved.vjust);
+    CuAssertDblEquals(tc, 2, gr->resolved.line_width.px, 1e-12);
+
+    // and give the width of the lines that a draw call would stroke
+    unit_t wide = Unit(5, "px");
+    CuAssertDblEquals(tc, 2, grid_resolved_line_width(gr, NULL), 1e-12);
+    CuAssertDblEquals(tc, 5, grid_resolved_line_width(gr, &(grid_par_t){
+        .line_width = &wide }), 1e-12);
+
+    // setters resolve what they set
+    rgba_t orange = { 1, 0.5, 0, 1 };
+    grid_set_color(gr, &orange);
+    grid_set_fill(gr, &orange);
+    grid_set_line_type(gr, "dashed");
+    grid_set_point_type(gr, "diamond");
+    grid_set_just(gr, "left");
+    grid_set_vjust(gr, "bottom");
+    unit_t lwd = Unit(1, "line");
+    grid_set_line_width(gr, &lwd);
+    CuAssertIntEquals(tc, 0xffff8000, gr->resolved.color);
+    CuAssertIntEquals(tc, 0xffff8000, gr->resolved.fill);
+    CuAssertIntEquals(tc, GRID_LINE_DASHED, gr->resolved.line_type);
+    CuAssertIntEquals(tc, GRID_POINT_DIAMOND, gr->resolved.point_type);
+    CuAssertIntEquals(tc, GRID_JUST_LEFT, gr->resolved.just);
+    CuAssertIntEquals(tc, GRID_JUST_BOTTOM, gr->resolved.vjust);
+    CuAssertDblEquals(tc, 1, gr->resolved.line_width.lines, 1e-12);
+
+    grid_set_fill(gr, NULL);
+    CuAssertIntEquals(tc, 0, gr->resolved.fill);
+
+    // unknown names fall back on the first value
+    grid_set_point_type(gr, "hexagon");
+    CuAssertIntEquals(tc, GRID_POINT_ROUND, gr->resolved.point_type);
+
+    // a draw call's parameters override the global ones for the call only
+    rgba_t blue = { 0, 0, 1, 0.5 };
+    grid_par_t par = { .color = &blue, .line_type = "dotted" };
+    unit_t zero = Unit(0, "npc"), one = Unit(1, "npc");
+    grid_line(gr, &zero, &zero, &one, &one, &par);
+    CuAssertIntEquals(tc, 0x800000ff, gr->drawing.color);
+    CuAssertIntEquals(tc, GRID_LINE_DOTTED, gr->drawing.line_type);
+    CuAssertIntEquals(tc, GRID_POINT_ROUND, gr->drawing.point_type);
+    CuAssertIntEquals(tc, 0xffff8000, gr->cairo_state.color);
+    CuAssertIntEquals(tc, GRID_LINE_DASHED, gr->cairo_state.line_type);
+
+    // antialiasing and hairlines
+    CuAssertIntEquals(tc, CAIRO_ANTIALIAS_DEFAULT, gr->resolved.antialias);
+    CuAssertTrue(tc, !gr->resolved.hairline);
+    grid_set_antialias(gr, "none");
+    CuAssertIntEquals(tc, CAIRO_ANTIALIAS_NONE, cairo_get_antialias(gr->cr));
+    bool hairline = true;
+    grid_set_hairline(gr, &hairline);
+    CuAssertDblEquals(tc, 1, gr->cairo_state.line_width, 1e-12);
+
+    par = (grid_par_t){ .antialias = "best", .hairline = &(bool){ false } };
+    grid_line(gr, &zero, &zero, &one, &one, &par);
+    CuAssertIntEquals(tc, CAIRO_ANTIALIAS_BEST, gr->drawing.antialias);
+    CuAssertTrue(tc, !gr->drawing.hairline);
+    CuAssertIntEquals(tc, CAIRO_ANTIALIAS_NONE, cairo_get_antialias(gr->cr));
+    CuAssertDblEquals(tc, 1, gr->cairo_state.line_width, 1e-12);
+
+    grid_set_antialias(gr, "smooth");
+    CuAssertIntEquals(tc, CAIRO_ANTIALIAS_DEFAULT, gr->resolved.antialias);
+
+    grid_context_reset(gr);
+    CuAssertIntEquals(tc, 0xff000000, gr->resolved.color);
+    CuAssertIntEquals(tc, GRID_LINE_SOLID, gr->resolved.line_type);
+    CuAssertIntEquals(tc, 0xff000000, gr->cairo_state.color);
+    CuAssertTrue(tc, !gr->resolved.hairline);
+    CuAssertDblEquals(tc, 2, gr->cairo_state.line_width, 1e-12);
+
+    free_grid_context(gr);
+}
+
+void
+test_grid_styled_points(CuTest *tc) {
+    grid_context_t *gr = new_grid_context(100, 100);
+    grid_enable_stats(gr, true);
+    grid_stats_t stats;
+
+    double values[] = { 0.1, 0.2, 0.3, 0.4, 0.5, 0.6 };
+    unit_array_t xs = UnitArray(6, values, "npc");
+
+    // interleaved palette colors are filled once each; out-of-range indices
+    // get the color in effect
+    uint32_t palette[] = { 0xffff0000, 0xff0000ff };
+    uint8_t index[] = { 0, 1, 0, 1, 7, 0 };
+    uint8_t shapes[] = { 0, 1, 2, 0, 1, 9 };
+    grid_point_style_t style = { .color_index = index, .palette = palette,
+                                 .palette_size = 2, .shapes = shapes };
+    grid_styled_points(gr, &xs, &xs, &style, NULL);
+    grid_get_stats(gr, &stats);
+    CuAssertIntEquals(tc, 1, stats.ops[GRID_OP_STYLED_POINTS].calls);
+    CuAssertIntEquals(tc, 6, stats.points);
+    CuAssertIntEquals(tc, 3, stats.fills);
+    CuAssertIntEquals(tc, 0xff000000, gr->cairo_state.color);
+
+    // packed colors, and sizes per point
+    rgba_t green = { 0, 1, 0, 1 };
+    uint32_t colors[] = { 0xff00ff00, 0xffff0000, 0xff00ff00, 0xffff0000,
+                          0xff00ff00, 0xffff0000 };
+    CuAssertIntEquals(tc, 0xff00ff00, grid_pack_color(&green));
+    unit_array_t sizes = UnitArray(6, values, "lines");
+    style = (grid_point_style_t){ .colors = colors, .sizes = &sizes };
+    grid_reset_stats(gr);
+    grid_styled_points(gr, &xs, &xs, &style, NULL);
+    grid_get_stats(gr, &stats);
+    CuAssertIntEquals(tc, 2, stats.fills);
+
+    // without styles, points are drawn like grid_points
+    grid_reset_stats(gr);
+    grid_styled_points(gr, &xs, &xs, NULL, NULL);
+    grid_get_stats(gr, &stats);
+    CuAssertIntEquals(tc, 1, stats.fills);
+
+    unit_array_t short_sizes = UnitArray(2, values, "px");
+    style.sizes = &short_sizes;
+    grid_reset_stats(gr);
+    grid_styled_points(gr, &xs, &xs, &style, NULL);
+    grid_get_stats(gr, &stats);
+    CuAssertIntEquals(tc, 0, stats.fills);
+
+    free_grid_context(gr);
+}
+
+void
+test_grid_raster(CuTest *tc) {
+    uint32_t ramp[] = { 0xff000000, 0xffffffff };
+    grid_color_map_t *map = new_grid_color_map(2, ramp, 0, 1);
+    CuAssertPtrEquals(tc, NULL, new_grid_color_map(0, ramp, 0, 1));
+
+    // values are clamped to the ramp, and NaN is transparent
+    double values[] = { 0, 1, 0.5, NAN, -5, 5 };
+    uint32_t pixels[6];
+    grid_color_map_apply(map, 6, values, pixels);
+    CuAssertIntEquals(tc, 0xff000000, pixels[0]);
+    CuAssertIntEquals(tc, 0xffffffff, pixels[1]);
+    CuAssertIntEquals(tc, 0xff808080, pixels[2]);
+    CuAssertIntEquals(tc, 0, pixels[3]);
+    CuAssertIntEquals(tc, 0xff000000, pixels[4]);
+    CuAssertIntEquals(tc, 0xffffffff, pixels[5]);
+
+    // colors are premultiplied by their alpha
+    uint32_t red = 0x80ff0000;
+    grid_color_map_t *translucent = new_grid_color_map(1, &red, 0, 1);
+    grid_color_map_apply(translucent, 1, values, pixels);
+    CuAssertIntEquals(tc, 0x80800000, pixels[0]);
+    free_grid_color_map(translucent);
+
+    // more values than a block
+    double *ramp_values = malloc(1000 * sizeof(double));
+    uint32_t *ramp_pixels = malloc(1000 * sizeof(uint32_t));
+    int i;
+    for (i = 0; i < 1000; i++)
+        ramp_values[i] = i / 999.0;
+    grid_color_map_apply(map, 1000, ramp_values, ramp_pixels);
+    CuAssertIntEquals(tc, 0xff000000, ramp_pixels[0]);
+    CuAssertIntEquals(tc, 0xffffffff, ramp_pixels[999]);
+    for (i = 1; i < 1000; i++)
+        CuAssertTrue(tc, (ramp_pixels[i] & 0xff) >= (ramp_pixels[i - 1] & 0xff));
+
+    // a raster is one fill, whichever way it's sampled
+    grid_context_t *gr = new_grid_context(100, 100);
+    grid_enable_stats(gr, true);
+    unit_t zero = Unit(0, "npc"), one = Unit(1, "npc");
+    grid_raster(gr, &zero, &zero, &one, &one, 2, 3, values, map, 
+                GRID_RASTER_NEAREST);
+    grid_raster(gr, &zero, &zero, &one, &one, 25, 40, ramp_values, map, 
+                GRID_RASTER_BILINEAR);
+    grid_raster(gr, &zero, &zero, &one, &one, 0, 3, values, map, 
+                GRID_RASTER_NEAREST);
+    grid_raster(gr, &zero, &zero, &zero, &one, 2, 3, values, map, 
+                GRID_RASTER_NEAREST);
+
+    grid_stats_t stats;
+    grid_get_stats(gr, &stats);
+    CuAssertIntEquals(tc, 4, stats.ops[GRID_OP_RASTER].calls);
+    CuAssertIntEquals(tc, 2, stats.fills);
+    CuAssertStrEquals(tc, "grid_raster", grid_op_name(GRID_OP_RASTER));
+
+    free_grid_context(gr);
+    free_grid_color_map(map);
+    free(ramp_values);
+    free(ramp_pixels);
+}
+
+/**
+ * Draw a gentle curve on a 64x64 context, and copy the alpha of its pixels.
+ */
+static void
+draw_curve(const grid_par_t *par, uint8_t *alpha) {
+    double xs[50], ys[50];
+    int i;
+    for (i = 0; i < 50; i++) {
+        xs[i] = 0.05 + 0.9 * i / 49.0;
+        ys[i] = 0.5 + 0.3 * sin(4 * xs[i]);
+    }
+
+    grid_context_t *gr = new_grid_context(64, 64);
+    unit_array_t x = UnitArray(50, xs, "npc"), y = UnitArray(50, ys, "npc");
+    grid_lines(gr, &x, &y, par);
+
+    cairo_surface_flush(gr->surface);
+    unsigned char *data = cairo_image_surface_get_data(gr->surface);
+    int stride = cairo_image_surface_get_stride(gr->surface);
+    for (i = 0; i < 64 * 64; i++)
+        alpha[i] = ((uint32_t*)(data + i / 64 * stride))[i % 64] >> 24;
+    free_grid_context(gr);
+}
+
+void
+test_grid_scanline(CuTest *tc) {
+    uint32_t pixels[8 * 8] = { 0 };
+    unsigned char *data = (unsigned char*)pixels;
+    cairo_rectangle_int_t clip = { 0, 0, 8, 8 };
+
+    // a line along pixel centers covers whole pixels
+    double xs[] = { 1, 5 }, ys[] = { 2.5, 2.5 };
+    grid_scanline_lines(data, 32, &clip, 2, xs, ys, 1, 0xffff0000);
+    CuAssertIntEquals(tc, 0, pixels[2 * 8]);
+    CuAssertIntEquals(tc, 0xffff0000, pixels[2 * 8 + 1]);
+    CuAssertIntEquals(tc, 0xffff0000, pixels[2 * 8 + 4]);
+    CuAssertIntEquals(tc, 0, pixels[2 * 8 + 5]);
+    CuAssertIntEquals(tc, 0, pixels[1 * 8 + 2]);
+    CuAssertIntEquals(tc, 0, pixels[3 * 8 + 2]);
+
+    // the same line across the axes, and between pixel centers
+    double vs[] = { 6.5, 6.5 }, us[] = { 1, 5 };
+    grid_scanline_lines(data, 32, &clip, 2, vs, us, 1, 0xffff0000);
+    CuAssertIntEquals(tc, 0xffff0000, pixels[1 * 8 + 6]);
+    CuAssertIntEquals(tc, 0xffff0000, pixels[4 * 8 + 6]);
+    CuAssertIntEquals(tc, 0, pixels[5 * 8 + 6]);
+
+    memset(pixels, 0, sizeof(pixels));
+    ys[0] = ys[1] = 6;
+    grid_scanline_lines(data, 32, &clip, 2, xs, ys, 1, 0xffff0000);
+    CuAssertIntEquals(tc, 0x80800000, pixels[5 * 8 + 2]);
+    CuAssertIntEquals(tc, 0x80800000, pixels[6 * 8 + 2]);
+
+    // translucent colors are composited over the pixels, which are
+    // premultiplied
+    memset(pixels, 0xff, sizeof(pixels));
+    ys[0] = ys[1] = 2.5;
+    grid_scanline_lines(data, 32, &clip, 2, xs, ys, 1, 0x80ff0000);
+    CuAssertIntEquals(tc, 0xffff7f7f, pixels[2 * 8 + 1]);
+
+    // pixels outside the clip are left alone, as are segments that have a
+    // non-finite end or no length
+    memset(pixels, 0, sizeof(pixels));
+    clip = (cairo_rectangle_int_t){ 0, 0, 3, 8 };
+    double ws[] = { 1, 5, 5, NAN, 1 }, zs[] = { 2.5, 2.5, 2.5, 4.5, 4.5 };
+    grid_scanline_lines(data, 32, &clip, 5, ws, zs, 1, 0xffff0000);
+    CuAssertIntEquals(tc, 0xffff0000, pixels[2 * 8 + 2]);
+    CuAssertIntEquals(tc, 0, pixels[2 * 8 + 3]);
+    int i;
+    for (i = 3 * 8; i < 8 * 8; i++)
+        CuAssertIntEquals(tc, 0, pixels[i]);
+
+    // a diagonal covers sqrt(2) pixels per column for each pixel of width
+    memset(pixels, 0, sizeof(pixels));
+    clip = (cairo_rectangle_int_t){ 0, 0, 8, 8 };
+    double ds[] = { 0, 8 };
+    grid_scanline_lines(data, 32, &clip, 2, ds, ds, 1, 0xff000000);
+    int row, column = 0;
+    for (row = 0; row < 8; row++)
+        column += pixels[row * 8 + 4] >> 24;
+    CuAssertTrue(tc, abs(column - 361) <= 2);
+
+    // grid_lines takes the fast path when it's asked to
+    grid_context_t *gr = new_grid_context(20, 20);
+    grid_enable_stats(gr, true);
+    bool on = true;
+    grid_par_t par = { .fast_lines = &on, .hairline = &on };
+    double hs[] = { 0, 1 }, half[] = { 0.5, 0.5 };
+    unit_array_t hx = UnitArray(2, hs, "npc"), hy = UnitArray(2, half, "npc");
+    grid_lines(gr, &hx, &hy, &par);
+
+    grid_stats_t stats;
+    grid_get_stats(gr, &stats);
+    CuAssertIntEquals(tc, 0, stats.strokes);
+    cairo_surface_flush(gr->surface);
+    data = cairo_image_surface_get_data(gr->surface);
+    int stride = cairo_image_surface_get_stride(gr->surface);
+    uint32_t *rule = (uint32_t*)(data + 9 * stride);
+    // the line starts at the first pixel's center
+    CuAssertIntEquals(tc, 0x80000000, rule[0]);
+    for (i = 1; i < 20; i++) {
+        CuAssertIntEquals(tc, 0, ((uint32_t*)(data + 8 * stride))[i]);
+        CuAssertIntEquals(tc, 0xff000000, rule[i]);
+        CuAssertIntEquals(tc, 0, ((uint32_t*)(data + 10 * stride))[i]);
+    }
+
+    // dashed, wide, and aliased lines are stroked by cairo
+    grid_lines(gr, &hx, &hy, &(grid_par_t){ .fast_lines = &on, 
+                                            .line_type = "dashed" });
+    unit_t wide = Unit(3, "px");
+    grid_lines(gr, &hx, &hy, &(grid_par_t){ .fast_lines = &on, 
+                                            .line_width = &wide });
+    grid_lines(gr, &hx, &hy, &(grid_par_t){ .fast_lines = &on, 
+                                            .antialias = "none" });
+    grid_get_stats(gr, &stats);
+    CuAssertIntEquals(tc, 3, stats.strokes);
+    free_grid_context(gr);
+
+    // the fast path covers the pixels of a curve as cairo's stroker does,
+    // except for a few pixels at the joints where the curve turns between
+    // mostly horizontal and mostly vertical
+    uint8_t *fast = malloc(64 * 64), *stroked = malloc(64 * 64);
+    unit_t lwd = Unit(1.5, "px");
+    draw_curve(&(grid_par_t){ .fast_lines = &on, .line_width = &lwd }, fast);
+    draw_curve(&(grid_par_t){ .line_width = &lwd }, stroked);
+
+    long fast_total = 0, stroked_total = 0;
+    int outliers = 0;
+    for (i = 0; i < 64 * 64; i++) {
+        fast_total += fast[i];
+        stroked_total += stroked[i];
+        outliers += abs(fast[i] - stroked[i]) > 64;
+    }
+    CuAssertTrue(tc, stroked_total > 0);
+    CuAssertTrue(tc, labs(fast_total - stroked_total) <= stroked_total / 32);
+    CuAssertTrue(tc, outliers <= 4);
+
+    free(fast);
+    free(stroked);
+}
+
+void
+test_grid_trace(CuTest *tc) {
+    grid_context_t *gr = new_grid_context(400, 400);
+    grid_tracer_t *tracer = new_grid_tracer(0);
+    grid_set_tracer(gr, tracer);
+
+    double values[] = { 0, 1, 2, 3 };
+    int groups[] = { 0, 0, 1, 1 };
+    unit_array_t xs = UnitArray(4, values, "native");
+
+    grid_viewport_t *vp = new_grid_data_viewport(4, values, values);
+    grid_push_named_viewport(gr, "plot", vp);
+    grid_lines(gr, &xs, &xs, NULL);
+    grid_pop_viewport_1(gr);
+    free_grid_viewport(vp);
+
+    grid_facet_t *facet = new_grid_facet(4, values, values, groups, 2, 2,
+                                         GRID_SCALES_FIXED);
+    grid_facet(gr, facet, NULL, NULL, NULL, 2, NULL);
+    free_grid_facet(facet);
+
+    // every event that began has ended, on each thread
+    int i, depth[3] = { 0 };
+    for (i = 0; i < tracer->size; i++) {
+        grid_trace_event_t *e = tracer->events + i;
+        CuAssertTrue(tc, e->tid >= 0 && e->tid < 3);
+        depth[e->tid] += e->phase == 'B' ? 1 : -1;
+        CuAssertTrue(tc, depth[e->tid] >= 0);
+    }
+    CuAssertIntEquals(tc, 0, depth[0] + depth[1] + depth[2]);
+
+    const char *path = "griddle_tests.json";
+    CuAssertTrue(tc, grid_write_trace(tracer, path));
+
+    FILE *f = fopen(path, "r");
+    char json[1 << 16];
+    size_t n = fread(json, 1, sizeof(json) - 1, f);
+    json[n] = '\0';
+    fclose(f);
+    remove(path);
+
+    CuAssertTrue(tc, strstr(json, "\"name\":\"grid_lines\"") != NULL);
+    CuAssertTrue(tc, strstr(json, "\"viewport\":\"plot\"") != NULL);
+    CuAssertTrue(tc, strstr(json, "\"pushed\":\"plot\"") != NULL);
+    CuAssertTrue(tc, strstr(json, "\"group\":\"1\"") != NULL);
+    CuAssertTrue(tc, strstr(json, "\"tid\":2") != NULL);
+
+    grid_trace_clear(tracer);
+    CuAssertIntEquals(tc, 0, tracer->size);
+
+    free_grid_context(gr);
+    free_grid_tracer(tracer);
+}
+
+/**
+ * A heap that records the size of each allocation in front of it, to check
+ * the sizes griddle frees with.
+ */
+typedef struct {
+    long allocations, frees, mismatches;
+    const grid_allocator_t *in_effect; /**< If set, the allocator expected to
+                                            be in effect on each free. */
+    long swaps;                        /**< Frees made while another
+                                            allocator was in effect. */
+} checked_heap_t;
+
+#define CHECKED_HEAP_PREFIX 16
+
+static void*
+checked_malloc(size_t size, void *ud) {
+    checked_heap_t *heap = ud;
+    char *p = malloc(size + CHECKED_HEAP_PREFIX);
+    *(size_t*)p = size;
+    heap->allocations++;
+    return p + CHECKED_HEAP_PREFIX;
+}
+
+static void
+checked_free(void *ptr, size_t size, void *ud) {
+    checked_heap_t *heap = ud;
+    char *p = (char*)ptr - CHECKED_HEAP_PREFIX;
+    heap->mismatches += *(size_t*)p != size;
+    heap->swaps += heap->in_effect && grid_get_allocator() != heap->in_effect;
+    heap->frees++;
+    free(p);
+}
+
+void
+test_grid_allocator(CuTest *tc) {
+    checked_heap_t heap = { 0 };
+    grid_allocator_t *allocator = new_grid_allocator(checked_malloc, NULL,
+                                                     checked_free, &heap);
+    grid_allocator_t *old = grid_set_allocator(allocator);
+    CuAssertPtrEquals(tc, allocator, grid_get_allocator());
+
+    grid_context_t *gr = new_grid_context(300, 200);
+    CuAssertPtrEquals(tc, allocator, gr->allocator);
+
+    double values[] = { 0, 1, 2, 3, 4, 5 };
+    int groups[] = { 0, 0, 1, 1, 2, 2 };
+    unit_array_t xs = UnitArray(6, values, "native");
+
+    grid_viewport_t *vp = new_grid_data_viewport(6, values, values);
+    grid_push_named_viewport(gr, "a viewport name longer than the buffer", vp);
+
+    // the scratch buffer grows for the longer array
+    unit_array_t head = UnitArray(2, values, "native");
+    grid_lines(gr, &head, &head, NULL);
+    grid_lines(gr, &xs, &xs, NULL);
+    grid_points(gr, &xs, &xs, NULL);
+    grid_xaxis(gr, NULL);
+    free_grid_viewport(vp);
+
+    grid_memory_stats_t memory;
+    grid_get_memory_stats(gr, &memory);
+    CuAssertTrue(tc, memory.live_bytes > 0);
+    CuAssertTrue(tc, memory.high_water >= memory.live_bytes);
+    CuAssertTrue(tc, memory.frees > 0);
+
+    grid_facet_t *facet = new_grid_facet(6, values, values, groups, 3, 0,
+                                         GRID_SCALES_FREE);
+    grid_facet(gr, facet, NULL, NULL, NULL, 2, NULL);
+    free_grid_facet(facet);
+
+    grid_tracer_t *tracer = new_grid_tracer(0);
+    int i;
+    for (i = 0; i < 2000; i++)
+        grid_trace_begin(tracer, "event", "i", i % 2 ? "odd" : "even");
+    free_grid_tracer(tracer);
+
+    // the context is freed through its allocator even if another is in
+    // effect
+    grid_set_allocator(old);
+    free_grid_context(gr);
+
+    grid_memory_stats_t stats;
+    grid_allocator_stats(allocator, &stats);
+    CuAssertIntEquals(tc, heap.allocations, stats.allocations);
+    CuAssertTrue(tc, heap.allocations > 20);
+    CuAssertIntEquals(tc, 0, heap.mismatches);
+    CuAssertTrue(tc, stats.high_water >= memory.high_water);
+
+    // everything allocated was freed
+    CuAssertIntEquals(tc, heap.allocations, heap.frees);
+    CuAssertIntEquals(tc, 0, stats.live_bytes);
+
+    // a context can be given an allocator of its own, which it allocates
+    // everything it owns through without changing the allocator in effect
+    checked_heap_t own_heap = { .in_effect = old };
+    grid_allocator_t *own = new_grid_allocator(checked_malloc, NULL,
+                                               checked_free, &own_heap);
+    gr = new_grid_context_with_allocator(300, 200, own);
+    CuAssertPtrEquals(tc, own, gr->allocator);
+    CuAssertPtrEquals(tc, old, grid_get_allocator());
+    grid_lines(gr, &xs, &xs, NULL);
+    grid_context_reset(gr);
+    free_grid_context(gr);
+
+    CuAssertTrue(tc, own_heap.allocations > 0);
+    CuAssertIntEquals(tc, own_heap.allocations, own_heap.frees);
+    CuAssertIntEquals(tc, 0, own_heap.mismatches);
+    CuAssertIntEquals(tc, 0, own_heap.swaps);
+    free_grid_allocator(own);
+    free_grid_allocator(allocator);
+}
+
+/**
+ * Call `call` once to warm the context up, then again, asserting that the
+ * second call allocates nothing through `heap`.
+ */
+#define AssertNoAllocations(tc, heap, call) do { \
+        call; \
+        long allocations = (heap)->allocations; \
+        call; \
+        CuAssertIntEquals_Msg(tc, #call, allocations, (heap)->allocations); \
+    } while (0)
+
+void
+test_grid_zero_alloc(CuTest *tc) {
+    checked_heap_t heap = { 0 };
+    grid_allocator_t *allocator = new_grid_allocator(checked_malloc, NULL,
+                                                     checked_free, &heap);
+    grid_allocator_t *old = grid_set_allocator(allocator);
+
+    grid_context_t *gr = new_grid_context(200, 100);
+
+    double values[] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9 };
+    double offsets[] = { 1, 1, 1, 1, 1, 1, 1, 1, 1, 1 };
+    grid_viewport_t *vp = new_grid_data_viewport(10, values, values);
+    grid_push_viewport(gr, vp);
+
+    unit_array_t xs = UnitArray(10, values, "native");
+    unit_array_t lines = UnitArray(10, offsets, "lines");
+    unit_array_t ys = { .type = "-", .arg1 = &xs, .arg2 = &lines };
+    unit_t x = Unit(0.5, "npc"), y = Unit(1, "lines");
+    unit_t w = Unit(10, "px"), h = { .type = "+", .arg1 = &w, .arg2 = &y };
+    grid_par_t par = { .line_type = "dashed", .just = "right", 
+                       .vjust = "middle" };
+    uint8_t index[] = { 0, 1, 0, 1, 0, 1, 0, 1, 0, 1 };
+    uint32_t palette[] = { 0xffff0000, 0xff0000ff };
+    grid_point_style_t style = { .color_index = index, .palette = palette,
+                                 .palette_size = 2, .sizes = &lines };
+    stream_state_t state;
+
+    AssertNoAllocations(tc, &heap, grid_line(gr, &x, &y, &w, &h, &par));
+    AssertNoAllocations(tc, &heap, grid_lines(gr, &xs, &ys, &par));
+    AssertNoAllocations(tc, &heap, grid_point(gr, &x, &y, &par));
+    AssertNoAllocations(tc, &heap, grid_points(gr, &xs, &ys, &par));
+    AssertNoAllocations(tc, &heap, 
+                        grid_styled_points(gr, &xs, &ys, &style, &par));
+    AssertNoAllocations(tc, &heap, grid_rect(gr, &x, &y, &w, &h, &par));
+    AssertNoAllocations(tc, &heap, grid_full_rect(gr, &par));
+    AssertNoAllocations(tc, &heap, grid_polygon(gr, &xs, &ys, &par));
+    AssertNoAllocations(tc, &heap, grid_text(gr, "text", &x, &y, &par));
+    AssertNoAllocations(tc, &heap, grid_text(gr, "text", NULL, NULL, &par));
+    AssertNoAllocations(tc, &heap, grid_xaxis(gr, &par));
+    AssertNoAllocations(tc, &heap, grid_yaxis(gr, &par));
+    AssertNoAllocations(tc, &heap, 
+        (state = (stream_state_t){ 0, 10000, 0 }, 
+         grid_stream_lines(gr, next_sine_chunk, &state, "native", &par)));
+    AssertNoAllocations(tc, &heap, 
+        (state = (stream_state_t){ 0, 10000, 0 }, 
+         grid_stream_points(gr, next_sine_chunk, &state, "native", &par)));
+
+    free_grid_viewport(vp);
+    grid_set_allocator(old);
+    free_grid_context(gr);
+    CuAssertIntEquals(tc, 0, heap.mismatches);
+    free_grid_allocator(allocator);
+}
+
 CuSuite*
 grid_test_suite(void) {
     CuSuite *suite = CuSuiteNew();
@@ -107,6 +1522,28 @@ grid_test_suite(void) {
     SUITE_ADD_TEST(suite, test_units);
     SUITE_ADD_TEST(suite, test_grid_context_constructor);
     SUITE_ADD_TEST(suite, test_grid_viewport_tree);
+    SUITE_ADD_TEST(suite, test_grid_context_reset);
+    SUITE_ADD_TEST(suite, test_grid_context_resize);
+    SUITE_ADD_TEST(suite, test_grid_surface_pool);
+    SUITE_ADD_TEST(suite, test_grid_redraw);
+    SUITE_ADD_TEST(suite, test_grid_layer);
+    SUITE_ADD_TEST(suite, test_grid_series);
+    SUITE_ADD_TEST(suite, test_grid_viewport_index);
+    SUITE_ADD_TEST(suite, test_grid_viewport_path);
+    SUITE_ADD_TEST(suite, test_grid_layout);
+    SUITE_ADD_TEST(suite, test_grid_facet);
+    SUITE_ADD_TEST(suite, test_grid_range);
+    SUITE_ADD_TEST(suite, test_grid_colfile);
+    SUITE_ADD_TEST(suite, test_grid_csv);
+    SUITE_ADD_TEST(suite, test_grid_stream);
+    SUITE_ADD_TEST(suite, test_grid_stats);
+    SUITE_ADD_TEST(suite, test_grid_par);
+    SUITE_ADD_TEST(suite, test_grid_styled_points);
+    SUITE_ADD_TEST(suite, test_grid_raster);
+    SUITE_ADD_TEST(suite, test_grid_scanline);
+    SUITE_ADD_TEST(suite, test_grid_trace);
+    SUITE_ADD_TEST(suite, test_grid_allocator);
+    SUITE_ADD_TEST(suite, test_grid_zero_alloc);
 
     return suite;
 }
@@ -115,11 +1552,20 @@ int
 main(void) {
     CuString *output = CuStringNew();
     CuSuite *suite = CuSuiteNew();
+    CuSuite *grid_suite = grid_test_suite();
     
-    CuSuiteAddSuite(suite, grid_test_suite());
+    CuSuiteAddSuite(suite, grid_suite);
 
     CuSuiteRun(suite);
     CuSuiteSummary(suite, output);
     CuSuiteDetails(suite, output);
     printf("%s\n", output->buffer);
+
+    // the tests belong to both suites, so they're deleted once
+    int failed = suite->failCount;
+    CuSuiteDelete(suite);
+    free(grid_suite);
+    CuStringDelete(output);
+
+    return failed > 0;
 }